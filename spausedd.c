@@ -18,22 +18,38 @@
  * Author: Jan Friesse <jfriesse@redhat.com>
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/types.h>
 
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 
 #include <assert.h>
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <math.h>
 #include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -46,6 +62,15 @@
 #include <vmGuestLib.h>
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+
+#include "spausedd_shm.h"
+
 #define PROGRAM_NAME			"spausedd"
 
 #define DEFAULT_TIMEOUT			200
@@ -61,639 +86,7804 @@
 #define NO_NS_IN_SEC			1000000000ULL
 #define NO_NS_IN_MSEC			1000000ULL
 #define NO_MSEC_IN_SEC			1000ULL
+#define NO_NS_IN_USEC			1000ULL
+#define NO_USEC_IN_SEC			1000000ULL
+#define NO_USEC_IN_MSEC			1000ULL
 
-#ifndef LOG_TRACE
-#define LOG_TRACE			(LOG_DEBUG + 1)
-#endif
-
-enum move_to_root_cgroup_mode {
-	MOVE_TO_ROOT_CGROUP_MODE_OFF = 0,
-	MOVE_TO_ROOT_CGROUP_MODE_ON = 1,
-	MOVE_TO_ROOT_CGROUP_MODE_AUTO = 2,
-};
+/*
+ * Number of lateness histogram buckets. Bucket 0 holds lateness < 1us, bucket i
+ * holds lateness in [2^(i-1), 2^i) us and last bucket holds everything larger.
+ */
+#define LATENESS_HISTOGRAM_BUCKETS	SPAUSEDD_STATS_HISTOGRAM_BUCKETS
 
 /*
- * Globals
+ * Environment variable used to pass state fd to re-executed image
  */
-static int log_debug = 0;
-static int log_to_syslog = 0;
-static int log_to_stderr = 0;
+#define STATE_FD_ENV			"SPAUSEDD_STATE_FD"
 
-static uint64_t times_not_scheduled = 0;
+/*
+ * Suffix of /proc/self/exe after package upgrade replaced binary. It is removed so
+ * re-exec runs new binary.
+ */
+#define EXE_PATH_DELETED_SUFFIX		" (deleted)"
 
 /*
- * If current steal percent is larger than max_steal_threshold warning is shown.
- * Default is DEFAULT_MAX_STEAL_THRESHOLD (or DEFAULT_MAX_STEAL_THRESHOLD_GL if
- * HAVE_VMGUESTLIB and VMGuestLib init success)
+ * How often (in seconds) is state file saved
  */
-static double max_steal_threshold = DEFAULT_MAX_STEAL_THRESHOLD;
-static int max_steal_threshold_user_set = 0;
+#define STATE_FILE_SAVE_INTERVAL	60
 
-static volatile sig_atomic_t stop_main_loop = 0;
+/*
+ * Reserved RT runtime is measured cost of one main loop iteration multiplied by
+ * number of iterations in RT period and RT_RUNTIME_SAFETY_FACTOR, but at least
+ * RT_RUNTIME_MIN_US. RT_RATIO_SHIFT is fixed point shift of runtime / period ratio
+ * used by kernel to check that children fit into parent.
+ */
+#define RT_RUNTIME_SAFETY_FACTOR	10
+#define RT_RUNTIME_MIN_US		5000
+#define RT_RUNTIME_MAX_DEPTH		64
+#define RT_RATIO_SHIFT			20
+#define PROBE_COST_ITERATIONS		16
 
-static volatile sig_atomic_t display_statistics = 0;
+/*
+ * Utilization clamp values are in range 0 - SCHED_CAPACITY_SCALE
+ */
+#define UCLAMP_MAX_VALUE		1024
 
-#ifdef HAVE_VMGUESTLIB
-static int use_vmguestlib_stealtime = 0;
-static VMGuestLibHandle guestlib_handle;
-#endif
+#define SPAUSEDD_SCHED_FLAG_KEEP_POLICY		0x08
+#define SPAUSEDD_SCHED_FLAG_KEEP_PARAMS		0x10
+#define SPAUSEDD_SCHED_FLAG_UTIL_CLAMP_MIN	0x20
+#define SPAUSEDD_SCHED_FLAG_UTIL_CLAMP_MAX	0x40
 
 /*
- * Definitions (for attributes)
+ * Benchmark
  */
-static void	log_printf(int priority, const char *format, ...)
-    __attribute__((__format__(__printf__, 2, 3)));
+#define BENCH_RESULT_VERSION		3
+#define BENCH_MAX_LOAD_WORKERS		256
+#define BENCH_MEM_CHUNK_SIZE		(64 * 1024 * 1024)
+#define BENCH_IO_CHUNK_SIZE		(1024 * 1024)
+#define BENCH_IO_FILE_CHUNKS		64
+#define BENCH_RESULT_MAX_SIZE		(64 * 1024)
+#define BENCH_SIGNIFICANCE_LEVEL	0.05
 
-static void	log_vprintf(int priority, const char *format, va_list ap)
-    __attribute__((__format__(__printf__, 2, 0)));
+/*
+ * Fleet correlation. Pauses of different nodes overlapping in time (with clock
+ * skew tolerance FLEET_DEFAULT_SKEW ms) form cluster, clusters with at least
+ * FLEET_DEFAULT_MIN_NODES nodes are reported.
+ */
+#define FLEET_MAX_NODES			1024
+#define FLEET_DEFAULT_SKEW		50
+#define FLEET_MAX_SKEW			60000
+#define FLEET_DEFAULT_MIN_NODES		2
+#define FLEET_PAUSES_INIT_SIZE		1024
+#define FLEET_PAUSE_PREFIX		"Not scheduled for "
+#define FLEET_PAUSE_START		"started at "
 
 /*
- * Logging functions
+ * Maximum number of cgroups with watched memory.events
  */
-static const char log_month_str[][4] = {
-    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
-    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
-};
+#define MEMORY_WATCH_MAX		16
 
-static void
-log_vprintf(int priority, const char *format, va_list ap)
-{
-	va_list ap_copy;
-	int final_priority;
-	time_t current_time;
-	struct tm tm_res;
+/*
+ * cpuidle states 0 - (CPUIDLE_MAX_STATES - 1) are tracked
+ */
+#define CPUIDLE_MAX_STATES		16
 
-	if ((priority < LOG_DEBUG) || (priority == LOG_DEBUG && log_debug >= 1)
-	    || (priority == LOG_TRACE && log_debug >= 2)) {
-		if (log_to_stderr) {
-			current_time = time(NULL);
-			localtime_r(&current_time, &tm_res);
-			fprintf(stderr, "%s %02d %02d:%02d:%02d ",
-				log_month_str[tm_res.tm_mon], tm_res.tm_mday, tm_res.tm_hour,
-				tm_res.tm_min, tm_res.tm_sec);
+/*
+ * Steal counters are quantized (/proc/stat to USER_HZ ticks, VMGuestLib to ms),
+ * so difference of two readings has error in (-resolution, resolution) with
+ * triangular distribution. STEAL_CI95_FACTOR (1 - sqrt(0.05)) is half width of its
+ * 95% confidence interval in units of resolution. Sustained steal is estimated from
+ * readings at the ends of span of at least STEAL_SPAN_MIN_UNITS resolution units,
+ * last STEAL_READINGS_MAX readings are kept.
+ */
+#define STEAL_CI95_FACTOR		0.776
+#define STEAL_SPAN_MIN_UNITS		100
+#define STEAL_READINGS_MAX		256
 
-			fprintf(stderr, "%s: ", PROGRAM_NAME);
-			va_copy(ap_copy, ap);
-			vfprintf(stderr, format, ap_copy);
-			va_end(ap_copy);
-			fprintf(stderr, "\n");
-		}
+/*
+ * Pauses with less than SHM_EPISODE_GAP seconds between them belong to the same
+ * episode shown by spausedtop
+ */
+#define SHM_EPISODE_GAP			10
 
-		if (log_to_syslog) {
-			final_priority = priority;
-			if (priority > LOG_INFO) {
-				final_priority = LOG_INFO;
-			}
+/*
+ * Maximum number of probes placed into target cgroups. Main loop (RR probe)
+ * takes part in merge of probe pauses as probe PROBE_MAIN.
+ */
+#define PROBE_MAX			16
+#define PROBE_MAIN			PROBE_MAX
 
-			va_copy(ap_copy, ap);
-			vsyslog(final_priority, format, ap);
-			va_end(ap_copy);
-		}
-	}
-}
+/*
+ * Memory probe touches MEMPROBE_ANON_PAGES fresh anonymous pages every cycle
+ * and MEMPROBE_FILE_PAGES pages of file dropped from page cache every
+ * MEMPROBE_FILE_INTERVAL cycles. Operation taking more than timeout divided by
+ * MEMPROBE_STALL_DIVISOR is stall. Memory signals are sampled every
+ * MEMPROBE_SIGNALS_INTERVAL seconds.
+ */
+#define MEMPROBE_ANON_PAGES		16
+#define MEMPROBE_FILE_PAGES		16
+#define MEMPROBE_FILE_INTERVAL		10
+#define MEMPROBE_STALL_DIVISOR		10
+#define MEMPROBE_SIGNALS_INTERVAL	1
+#define MEMPROBE_SIGNALS_BUF_SIZE	(16 * 1024)
 
-static void
-log_printf(int priority, const char *format, ...)
-{
-	va_list ap;
+/*
+ * Size of per probe pause event ring (must be power of two)
+ */
+#define PROBE_EVENT_RING_SIZE		64
 
-	va_start(ap, format);
+#define SPAUSEDD_CLONE_INTO_CGROUP	0x200000000ULL
 
-	log_vprintf(priority, format, ap);
+/*
+ * Per CPU runqueue wait is tracked for CPUs 0 - (SCHEDSTAT_MAX_CPUS - 1).
+ * Buffer for /proc/schedstat is sized on init (and never reallocated) up to
+ * SCHEDSTAT_BUF_MAX_SIZE.
+ */
+#define SCHEDSTAT_MAX_CPUS		1024
+#define SCHEDSTAT_MIN_VERSION		15
+#define SCHEDSTAT_BUF_INIT_SIZE		(64 * 1024)
+#define SCHEDSTAT_BUF_MAX_SIZE		(16 * 1024 * 1024)
 
-	va_end(ap);
-}
+/*
+ * CPU is hot when tasks spent (summed) more than CPU_RUN_DELAY_HOT_THRESHOLD
+ * percent of window waiting on its runqueue
+ */
+#define CPU_RUN_DELAY_HOT_THRESHOLD	100
 
-static void
-log_perror(int priority, const char *s)
-{
-	int stored_errno;
+/*
+ * Runqueue waiters scan (-W) compares run_delay of all tasks with previous scan
+ * and logs RUNQ_WAITERS_TOP tasks with longest wait on pause. Scan interval is at
+ * most RUNQ_WAITERS_MAX_INTERVAL seconds and task array grows from
+ * RUNQ_TASKS_INIT_SIZE.
+ */
+#define RUNQ_WAITERS_TOP		5
+#define RUNQ_WAITERS_MAX_INTERVAL	3600
+#define RUNQ_TASKS_INIT_SIZE		1024
 
-	stored_errno = errno;
+/*
+ * Per CPU hardware performance counters are opened on start for allowed CPUs
+ * 0 - (PERF_MAX_CPUS - 1). At least PERF_FD_RESERVE file descriptors are kept
+ * free for everything else.
+ */
+#define PERF_MAX_CPUS			1024
+#define PERF_FD_RESERVE			256
 
-	log_printf(priority, "%s (%u): %s", s, stored_errno, strerror(stored_errno));
-}
+/*
+ * Pause window in which spausedd thread used more than PERF_SLOW_CYCLES_RATIO
+ * times cycles of average window was caused by slow running
+ */
+#define PERF_SLOW_CYCLES_RATIO		4
 
-static int
-util_strtonum(const char *str, long long int min_val, long long int max_val, long long int *res)
-{
-	long long int tmp_ll;
-	char *ep;
+/*
+ * Clock check. Counter rate is calibrated during first CLOCK_CHECK_CALIBRATION
+ * seconds. Clock and counter reads are paired when counter reads around clock
+ * read are at most CLOCK_PAIR_MAX_NS apart (CLOCK_PAIR_RETRIES attempts).
+ * Window where clock and counter differ by more than CLOCK_CHECK_JUMP_MIN_US plus
+ * CLOCK_CHECK_RATE_TOLERANCE of window is jump, unless it is off by the same rate as
+ * previous anomalous window (rate anomaly). Rate is compared on spans of
+ * CLOCK_CHECK_RATE_SPAN seconds and CLOCK_CHECK_RATE_ALPHA is weight of span
+ * rate used to follow slow drift. After CLOCK_CHECK_RATE_RECALIBRATE spans in a
+ * row with rate anomaly (counter rate changed by migration) counter is calibrated
+ * again.
+ */
+#define CLOCK_CHECK_CALIBRATION		1
+#define CLOCK_PAIR_MAX_NS		20000
+#define CLOCK_PAIR_RETRIES		3
+#define CLOCK_CHECK_JUMP_MIN_US		1000
+#define CLOCK_CHECK_RATE_TOLERANCE	0.001
+#define CLOCK_CHECK_RATE_SPAN		10
+#define CLOCK_CHECK_RATE_ALPHA		0.1
+#define CLOCK_CHECK_RATE_RECALIBRATE	3
 
-	if (min_val > max_val) {
-		return (-1);
-	}
+/*
+ * Pause risk predictor. Signals are averaged by fast (RISK_ALPHA_FAST) and slow
+ * (RISK_ALPHA_SLOW) EWMA, their difference is trend. No warning is raised during
+ * first RISK_WARMUP_SAMPLES samples while averages settle.
+ */
+#define RISK_ALPHA_FAST			0.05
+#define RISK_ALPHA_SLOW			0.005
+#define RISK_WARMUP_SAMPLES		200
 
-	errno = 0;
+/*
+ * Signal used by POSIX timer wakeup mechanism
+ */
+#define WAKEUP_TIMER_SIGNAL		(SIGRTMIN)
 
-	tmp_ll = strtoll(str, &ep, 10);
-	if (ep == str || *ep != '\0' || errno != 0) {
-		return (-1);
-	}
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id		_sigev_un._tid
+#endif
 
-	if (tmp_ll < min_val || tmp_ll > max_val) {
-		return (-1);
-	}
+#ifndef LOG_TRACE
+#define LOG_TRACE			(LOG_DEBUG + 1)
+#endif
 
-	*res = tmp_ll;
+enum move_to_root_cgroup_mode {
+	MOVE_TO_ROOT_CGROUP_MODE_OFF = 0,
+	MOVE_TO_ROOT_CGROUP_MODE_ON = 1,
+	MOVE_TO_ROOT_CGROUP_MODE_AUTO = 2,
+};
 
-	return (0);
-}
+enum memprobe_op {
+	MEMPROBE_OP_MMAP = 0,
+	MEMPROBE_OP_ANON = 1,
+	MEMPROBE_OP_FILE = 2,
+	MEMPROBE_OPS = 3,
+};
 
 /*
- * Utils
+ * vmstat counters correlated with memory probe stalls (allocstall is sum of
+ * all zones)
  */
-static void
-utils_mlockall(void)
-{
-	int res;
-	struct rlimit rlimit;
+enum memprobe_vmstat {
+	MEMPROBE_VMSTAT_PGMAJFAULT = 0,
+	MEMPROBE_VMSTAT_ALLOCSTALL = 1,
+	MEMPROBE_VMSTAT_PGSCAN_DIRECT = 2,
+	MEMPROBE_VMSTAT_COMPACT_STALL = 3,
+	MEMPROBE_VMSTAT_PSWPIN = 4,
+	MEMPROBE_VMSTATS = 5,
+};
 
-	rlimit.rlim_cur = RLIM_INFINITY;
-	rlimit.rlim_max = RLIM_INFINITY;
+enum clock_anomaly {
+	CLOCK_ANOMALY_NONE = 0,
+	CLOCK_ANOMALY_BACKWARDS = 1,
+	CLOCK_ANOMALY_JUMP = 2,
+	CLOCK_ANOMALY_RATE = 3,
+};
 
-	res = setrlimit(RLIMIT_MEMLOCK, &rlimit);
-	if (res == -1) {
-		log_printf(LOG_WARNING, "Could not increase RLIMIT_MEMLOCK, not locking memory");
+/*
+ * Per window signals of pause risk predictor (fractions of window or timeout)
+ */
+enum risk_signal {
+	RISK_SIGNAL_LATENESS = 0,
+	RISK_SIGNAL_STEAL = 1,
+	RISK_SIGNAL_RUN_DELAY = 2,
+	RISK_SIGNAL_PSI_CPU = 3,
+	RISK_SIGNAL_PSI_MEMORY = 4,
+	RISK_SIGNALS = 5,
+};
 
-		return;
-	}
+/*
+ * Features of pause risk model, names are in risk_feature_names
+ */
+enum risk_feature {
+	RISK_FEATURE_LATENESS = 0,
+	RISK_FEATURE_LATENESS_TREND = 1,
+	RISK_FEATURE_STEAL = 2,
+	RISK_FEATURE_STEAL_TREND = 3,
+	RISK_FEATURE_RUN_DELAY = 4,
+	RISK_FEATURE_PSI_CPU = 5,
+	RISK_FEATURE_PSI_MEMORY = 6,
+	RISK_FEATURE_PSI_TREND = 7,
+	RISK_FEATURES = 8,
+};
 
-	res = mlockall(MCL_CURRENT | MCL_FUTURE);
-	if (res == -1) {
-		log_printf(LOG_WARNING, "Could not mlockall");
-	}
-}
+/*
+ * Way main loop sleeps. Mechanisms differ in kernel path taken on wakeup.
+ */
+enum wakeup_mechanism {
+	WAKEUP_POLL = 0,
+	WAKEUP_PPOLL = 1,
+	WAKEUP_NANOSLEEP = 2,
+	WAKEUP_TIMERFD = 3,
+	WAKEUP_FUTEX = 4,
+	WAKEUP_TIMER = 5,
+	WAKEUP_MECHANISMS = 6,
+};
 
-static void
-utils_tty_detach(void)
-{
-	int devnull;
+/*
+ * Level of cgroup v1 cpu hierarchy on path from root to cgroup of this process.
+ * path_len is length of cgroup_v1_cpu_path prefix, new_runtime_us is runtime
+ * needed to fit reserved budget of this process.
+ */
+struct rt_runtime_level {
+	size_t path_len;
+	long long int period_us;
+	long long int runtime_us;
+	long long int new_runtime_us;
+};
 
-	switch (fork()) {
-		case -1:
-			err(1, "Can't create child process");
-			break;
-		case 0:
-			break;
-		default:
-			exit(0);
-			break;
-	}
+/*
+ * Cgroup v2 with watched memory.events. Counters are last values read from
+ * memory.events / memory.stat, window_* are increments during current poll
+ * window.
+ */
+struct memory_watch {
+	char dir[PATH_MAX];
+	int events_fd;
+	int wd;
+	uint64_t high;
+	uint64_t max;
+	uint64_t oom;
+	uint64_t pgscan;
+	uint64_t window_high;
+	uint64_t window_max;
+	uint64_t window_oom;
+	uint64_t window_pgscan;
+};
 
-	/* Create new session */
-	(void)setsid();
+/*
+ * Steal time estimate with 95% confidence interval (in percent of elapsed time)
+ */
+struct steal_estimate {
+	uint64_t elapsed;
+	uint64_t steal;
+	double perc;
+	double perc_low;
+	double perc_high;
+};
 
-	/*
-	 * Map stdin/out/err to /dev/null.
-	 */
-	devnull = open("/dev/null", O_RDWR);
-	if (devnull == -1) {
-		err(1, "Can't open /dev/null");
-	}
+/*
+ * Steal counter reading taken at the end of main loop window
+ */
+struct steal_reading {
+	uint64_t tv;
+	uint64_t steal;
+};
 
-	if (dup2(devnull, 0) < 0 || dup2(devnull, 1) < 0
-	    || dup2(devnull, 2) < 0) {
-		close(devnull);
-		err(1, "Can't dup2 stdin/out/err to /dev/null");
-	}
-	close(devnull);
-}
+/*
+ * Lateness of windows grouped by deepest cpuidle state entered during window
+ */
+struct cpuidle_state_stats {
+	char name[32];
+	uint64_t exit_latency_us;
+	uint64_t windows;
+	uint64_t lateness_sum;
+	uint64_t lateness_max;
+};
 
-static int
-utils_set_rr_scheduler(int silent)
-{
-#ifdef _POSIX_PRIORITY_SCHEDULING
-	int max_prio;
-	struct sched_param param;
-	int res;
+/*
+ * Runqueue statistics of one CPU from /proc/schedstat. run_delay (sum of time
+ * tasks waited on runqueue) and pcount (number of timeslices) are last values
+ * read, window_* are increments since previous read.
+ */
+struct cpu_schedstat {
+	uint64_t run_delay;
+	uint64_t pcount;
+	uint64_t window_run_delay;
+	uint64_t window_pcount;
+	uint64_t hot_windows;
+	double run_delay_perc_max;
+	int valid;
+};
 
-	max_prio = sched_get_priority_max(SCHED_RR);
-	if (max_prio == -1) {
-		if (!silent) {
-			log_perror(LOG_WARNING, "Can't get maximum SCHED_RR priority");
-		}
+/*
+ * Task with run_delay read from /proc/<pid>/task/<tid>/schedstat. wait is
+ * increment since previous scan.
+ */
+struct runq_task {
+	pid_t pid;
+	pid_t tid;
+	uint64_t run_delay;
+	uint64_t wait;
+};
 
-		return (-1);
-	}
+/*
+ * Group of hardware performance events counted together (cycles is leader).
+ * Bit (1 << event) of mask is set for opened events, group is read in order of
+ * events (count is 0 for group which is not open). pages are mmaped user pages
+ * used for rdpmc (NULL when not used).
+ */
+struct perf_group {
+	int fds[SPAUSEDD_SHM_PERF_EVENTS];
+	struct perf_event_mmap_page *pages[SPAUSEDD_SHM_PERF_EVENTS];
+	uint32_t mask;
+	int count;
+};
 
-	param.sched_priority = max_prio;
-	res = sched_setscheduler(0, SCHED_RR, &param);
-	if (res == -1) {
-		if (!silent) {
+/*
+ * Sums of hardware counters of spausedd thread over windows
+ */
+struct perf_window_stats {
+	uint64_t windows;
+	uint64_t sum[SPAUSEDD_SHM_PERF_EVENTS];
+};
+
+/*
+ * Logistic pause risk model. Risk is 1 / (1 + exp(-(bias + sum of weighted
+ * features))).
+ */
+struct risk_model {
+	double bias;
+	double weights[RISK_FEATURES];
+	double warn_on;
+	double warn_off;
+};
+
+/*
+ * Lateness of windows slept by one wakeup mechanism
+ */
+struct wakeup_stats {
+	uint64_t histogram[LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t lateness_sum;
+	uint64_t lateness_max;
+};
+
+/*
+ * Pause detected by probe. start is CLOCK_MONOTONIC time when probe went to sleep.
+ */
+struct probe_event {
+	uint64_t start;
+	uint64_t duration;
+};
+
+/*
+ * Statistics of probe running in target cgroup. Lives in memory shared between
+ * probe process (writer) and main process (reader). Pauses are passed in single
+ * producer single consumer ring, events_head is written only by probe and
+ * events_tail only by main process.
+ */
+struct probe_shared {
+	uint64_t samples;
+	uint64_t times_not_scheduled;
+	uint64_t events_overflow;
+	uint64_t lateness_histogram[LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t events_head __attribute__((aligned(64)));
+	uint64_t events_tail __attribute__((aligned(64)));
+	struct probe_event events[PROBE_EVENT_RING_SIZE];
+};
+
+/*
+ * Memory operation of memory probe which took longer than stall threshold
+ */
+struct memprobe_event {
+	uint64_t start;
+	uint64_t duration;
+	uint32_t op;
+	uint32_t reserved;
+};
+
+/*
+ * Statistics of memory probe shared between probe process (writer) and main
+ * process (reader), stalls are passed in ring same way as for probes
+ */
+struct memprobe_shared {
+	uint64_t samples[MEMPROBE_OPS];
+	uint64_t stalls[MEMPROBE_OPS];
+	uint64_t events_overflow;
+	uint64_t histogram[MEMPROBE_OPS][LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t events_head __attribute__((aligned(64)));
+	uint64_t events_tail __attribute__((aligned(64)));
+	struct memprobe_event events[PROBE_EVENT_RING_SIZE];
+};
+
+/*
+ * Memory PSI totals (in ns) and vmstat counters
+ */
+struct memprobe_signals {
+	uint64_t tv;
+	uint64_t psi_some;
+	uint64_t psi_full;
+	uint64_t vmstat[MEMPROBE_VMSTATS];
+	int psi_valid;
+	int vmstat_valid;
+};
+
+struct probe {
+	char cgroup_dir[PATH_MAX];
+	pid_t pid;
+	uint64_t events_overflow_seen;
+	struct probe_shared *shared;
+};
+
+/*
+ * Pauses of probes overlapping in time merged into one system event.
+ * probes is bitmask of probe indexes (including PROBE_MAIN).
+ */
+struct probe_event_group {
+	uint64_t start;
+	uint64_t end;
+	uint64_t duration_max;
+	uint32_t probes;
+	unsigned int events;
+};
+
+/*
+ * Node of fleet with its pause count and statistics merged from its state files
+ */
+struct fleet_node {
+	char name[64];
+	uint64_t pauses;
+	uint64_t snapshots;
+	uint64_t runtime;
+	uint64_t samples;
+	uint64_t times_not_scheduled;
+	uint64_t lateness_max;
+	uint64_t histogram[LATENESS_HISTOGRAM_BUCKETS];
+};
+
+/*
+ * Pause record of node, start is CLOCK_REALTIME
+ */
+struct fleet_pause {
+	int64_t start_us;
+	uint64_t duration_us;
+	int node;
+};
+
+struct fleet_cluster {
+	int64_t start;
+	int64_t end;
+	uint64_t duration_max;
+	unsigned int pauses;
+	int node_count;
+};
+
+struct fleet {
+	struct fleet_node *nodes;
+	int node_count;
+	struct fleet_pause *pauses;
+	size_t pause_count;
+	size_t pause_size;
+};
+
+/*
+ * Layout of struct clone_args (CLONE_ARGS_SIZE_VER2). Defined locally because
+ * libc doesn't provide it.
+ */
+struct spausedd_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+	uint64_t cgroup;
+};
+
+/*
+ * Layout of struct sched_attr (SCHED_ATTR_SIZE_VER1). Defined locally because
+ * libc may not provide it.
+ */
+struct spausedd_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+	uint32_t sched_util_min;
+	uint32_t sched_util_max;
+};
+
+/*
+ * Globals
+ */
+static int log_debug = 0;
+static int log_to_syslog = 0;
+static int log_to_stderr = 0;
+
+static uint64_t times_not_scheduled = 0;
+
+/*
+ * Histogram of how much later than requested poll returned. Buckets have fixed
+ * boundaries so histograms from multiple runs or nodes can be merged
+ * losslessly by adding counts.
+ */
+static uint64_t lateness_histogram[LATENESS_HISTOGRAM_BUCKETS];
+
+/*
+ * Sum and maximum of lateness in ns
+ */
+static uint64_t lateness_sum = 0;
+static uint64_t lateness_max = 0;
+
+/*
+ * Pauses by most likely cause and sums of pause duration, steal and runqueue wait
+ * during pauses in ns
+ */
+static uint64_t pauses_by_class[SPAUSEDD_STATS_CLASSES];
+static uint64_t pause_duration_sum = 0;
+static uint64_t pause_steal_sum = 0;
+static uint64_t pause_run_delay_sum = 0;
+
+/*
+ * If current steal percent is larger than max_steal_threshold warning is shown.
+ * Default is DEFAULT_MAX_STEAL_THRESHOLD (or DEFAULT_MAX_STEAL_THRESHOLD_GL if
+ * HAVE_VMGUESTLIB and VMGuestLib init success)
+ */
+static double max_steal_threshold = DEFAULT_MAX_STEAL_THRESHOLD;
+static int max_steal_threshold_user_set = 0;
+
+/*
+ * Resolution of steal counter in ns, USER_HZ of /proc/stat and recent readings
+ * used for span estimate. steal_sustained is set while span estimate is
+ * significantly over max_steal_threshold.
+ */
+static uint64_t steal_resolution = 0;
+static long int steal_clock_tick = 0;
+static struct steal_reading steal_readings[STEAL_READINGS_MAX];
+static unsigned int steal_readings_count = 0;
+static unsigned int steal_readings_next = 0;
+static int steal_sustained = 0;
+static uint64_t times_steal_uncertain = 0;
+
+static volatile sig_atomic_t stop_main_loop = 0;
+
+static volatile sig_atomic_t display_statistics = 0;
+
+static volatile sig_atomic_t reexec_requested = 0;
+
+/*
+ * Path to executable and arguments used for re-exec
+ */
+static char exe_path[PATH_MAX];
+static char **saved_argv;
+
+static const char *state_file = NULL;
+
+/*
+ * Watched memory.events of own cgroup and cgroups set by -M
+ */
+static struct memory_watch memory_watches[MEMORY_WATCH_MAX];
+static int memory_watch_count = 0;
+static const char *memory_watch_dirs[MEMORY_WATCH_MAX];
+static int memory_watch_dirs_count = 0;
+static int memory_inotify_fd = -1;
+static uint64_t times_memory_throttled = 0;
+
+/*
+ * cpuidle state usage fds of CPU cpuidle_usage_cpu (reopened when process
+ * migrates, so only one CPU has fds open) and per state statistics.
+ * Item 0 of cpuidle_stats is used for windows without idle state entered,
+ * item i + 1 for state i.
+ */
+static int cpuidle_state_count = 0;
+static int cpuidle_usage_cpu = -1;
+static int cpuidle_usage_fds[CPUIDLE_MAX_STATES];
+static struct cpuidle_state_stats cpuidle_stats[CPUIDLE_MAX_STATES + 1];
+
+/*
+ * Probes placed into target cgroups set by -C
+ */
+static const char *probe_cgroups[PROBE_MAX];
+static int probe_cgroups_count = 0;
+static struct probe probes[PROBE_MAX];
+static int probe_count = 0;
+static struct probe_shared *probes_shared = NULL;
+static struct probe_shared probe_main_shared;
+static struct probe_event_group probe_event_group;
+static uint64_t probe_timeout = 0;
+
+/*
+ * /proc/pressure fds shared by memory probe and pause risk predictor
+ */
+static int psi_cpu_fd = -1;
+static int psi_memory_fd = -1;
+
+/*
+ * Memory probe enabled by -F, its shared statistics, /proc/vmstat fd and memory
+ * signals at previous sample
+ */
+static int memprobe_enabled = 0;
+static struct memprobe_shared *memprobe_shared = NULL;
+static pid_t memprobe_pid = 0;
+static uint64_t memprobe_timeout = 0;
+static uint64_t memprobe_events_overflow_seen = 0;
+static int memprobe_vmstat_fd = -1;
+static struct memprobe_signals memprobe_signals_prev;
+static char memprobe_signals_buf[MEMPROBE_SIGNALS_BUF_SIZE];
+static uint64_t memprobe_stalls_with_pressure = 0;
+
+/*
+ * Shared statistics page read by spausedtop or NULL if not available
+ */
+static struct spausedd_shm *shm_stats = NULL;
+
+/*
+ * /dev/cpu_dma_latency fd when PM QoS request is held
+ */
+static int pm_qos_fd = -1;
+
+/*
+ * Benchmark mode is enabled when benchmark_duration or benchmark_samples is not 0
+ */
+static uint64_t benchmark_duration = 0;
+static uint64_t benchmark_samples = 0;
+static const char *benchmark_load = NULL;
+static pid_t benchmark_load_pids[BENCH_MAX_LOAD_WORKERS];
+static int benchmark_load_workers = 0;
+
+/*
+ * Cgroup v1 cpu controller and cgroup v2 mount points and cgroup of this
+ * process relative to them (empty string for root cgroup or when not found)
+ */
+static char cgroup_v1_cpu_mount[PATH_MAX];
+static char cgroup_v1_cpu_path[PATH_MAX];
+static char cgroup_v2_mount[PATH_MAX];
+static char cgroup_v2_path[PATH_MAX];
+
+/*
+ * Levels of cgroup v1 cpu hierarchy whose RT runtime was raised (0 if none), kept
+ * so original values can be restored when RR scheduler still can't be set
+ */
+static struct rt_runtime_level rt_runtime_levels[RT_RUNTIME_MAX_DEPTH];
+static int rt_runtime_level_count = 0;
+
+#ifdef HAVE_VMGUESTLIB
+static int use_vmguestlib_stealtime = 0;
+static VMGuestLibHandle guestlib_handle;
+#endif
+
+/*
+ * File descriptor of /proc/self/schedstat or -1 if not available
+ */
+static int schedstat_self_fd = -1;
+
+/*
+ * If more than RUN_DELAY_THRESHOLD percent of pause was spent waiting on runqueue
+ * warning is shown.
+ */
+#define RUN_DELAY_THRESHOLD		50
+
+/*
+ * /proc/schedstat fd, buffer and per CPU statistics. cpu_schedstat_window is
+ * length of window between last two reads.
+ */
+static int schedstat_fd = -1;
+static char *schedstat_buf = NULL;
+static size_t schedstat_buf_size = 0;
+static struct cpu_schedstat cpu_schedstats[SCHEDSTAT_MAX_CPUS];
+static int cpu_schedstat_count = 0;
+static uint64_t cpu_schedstat_tv = 0;
+static uint64_t cpu_schedstat_window = 0;
+
+/*
+ * Runqueue waiters scan enabled by -W (interval in seconds, 0 when disabled).
+ * runq_tasks are tasks of previous scan sorted by tid, runq_tasks_new is buffer
+ * for next scan. Scan statistics are part of benchmark result.
+ */
+static uint64_t runq_waiters_interval = 0;
+static struct runq_task *runq_tasks = NULL;
+static size_t runq_task_count = 0;
+static size_t runq_tasks_size = 0;
+static struct runq_task *runq_tasks_new = NULL;
+static size_t runq_tasks_new_size = 0;
+static uint64_t runq_scan_tv = 0;
+static uint64_t runq_scans = 0;
+static uint64_t runq_scan_tasks_sum = 0;
+static uint64_t runq_scan_cost_sum = 0;
+static uint64_t runq_scan_cost_max = 0;
+
+/*
+ * Hardware performance counters of spausedd thread and (with permission) of CPUs
+ * spausedd runs on. Only group of CPU spausedd currently runs on
+ * (perf_cpu_active) is enabled, so PMU counters of other CPUs stay free.
+ * perf_window* are deltas of last window, perf_window_cpu_id is CPU window started
+ * on. perf_exclude_kernel is set when only user space events are allowed.
+ */
+static int perf_enabled = 0;
+static int perf_exclude_kernel = 0;
+static int perf_cpu_allowed = 0;
+static int perf_cpu_active = -1;
+static struct perf_group perf_thread_group;
+static struct perf_group perf_cpu_groups[PERF_MAX_CPUS];
+static uint64_t perf_thread_prev[SPAUSEDD_SHM_PERF_EVENTS];
+static uint64_t perf_cpu_prev[SPAUSEDD_SHM_PERF_EVENTS];
+static uint64_t perf_window[SPAUSEDD_SHM_PERF_EVENTS];
+static uint64_t perf_window_cpu[SPAUSEDD_SHM_PERF_EVENTS];
+static uint32_t perf_window_mask = 0;
+static uint32_t perf_window_cpu_mask = 0;
+static int perf_window_cpu_id = -1;
+static struct perf_window_stats perf_normal_stats;
+static struct perf_window_stats perf_pause_stats;
+
+/*
+ * Clock check state. clock_check_ns_per_tick is 0 until calibrated, span_* are
+ * sums of windows of current rate span, window_dev is relative difference of clock
+ * and counter of previous window (0 if it was not anomalous) and rate_spans is
+ * number of spans with rate anomaly in a row.
+ */
+static int clock_check_enabled = 0;
+static double clock_check_ns_per_tick = 0;
+static uint64_t clock_check_calib_tv = 0;
+static uint64_t clock_check_calib_counter = 0;
+static uint64_t clock_check_span_tv = 0;
+static uint64_t clock_check_span_counter = 0;
+static double clock_check_window_dev = 0;
+static unsigned int clock_check_rate_spans = 0;
+static uint64_t times_clock_backwards = 0;
+static uint64_t times_clock_jump = 0;
+static uint64_t times_clock_rate = 0;
+
+/*
+ * Pause risk predictor enabled by -R. Default model is used with -R default.
+ */
+static int risk_enabled = 0;
+static struct risk_model risk_model = {
+	.bias = -6.0,
+	.weights = {
+		[RISK_FEATURE_LATENESS] = 8.0,
+		[RISK_FEATURE_LATENESS_TREND] = 10.0,
+		[RISK_FEATURE_STEAL] = 10.0,
+		[RISK_FEATURE_STEAL_TREND] = 15.0,
+		[RISK_FEATURE_RUN_DELAY] = 6.0,
+		[RISK_FEATURE_PSI_CPU] = 4.0,
+		[RISK_FEATURE_PSI_MEMORY] = 6.0,
+		[RISK_FEATURE_PSI_TREND] = 8.0,
+	},
+	.warn_on = 0.8,
+	.warn_off = 0.5,
+};
+static uint64_t risk_psi_cpu_prev = 0;
+static uint64_t risk_psi_memory_prev = 0;
+static double risk_fast[RISK_SIGNALS];
+static double risk_slow[RISK_SIGNALS];
+static uint64_t risk_samples = 0;
+static double risk_score = 0;
+static int risk_warning = 0;
+static uint64_t risk_warning_start = 0;
+static uint64_t times_risk_warning = 0;
+static uint64_t times_risk_warned_pause = 0;
+static uint64_t times_risk_pause = 0;
+
+/*
+ * Wakeup mechanism set by -w (current one when rotating) and its resources
+ */
+static enum wakeup_mechanism wakeup_mechanism = WAKEUP_POLL;
+static int wakeup_rotate = 0;
+static int wakeup_available[WAKEUP_MECHANISMS];
+static struct wakeup_stats wakeup_stats[WAKEUP_MECHANISMS];
+static int wakeup_timer_fd = -1;
+static int wakeup_epoll_fd = -1;
+static timer_t wakeup_timer_id;
+static int wakeup_timer_created = 0;
+static sigset_t wakeup_sigset;
+static uint32_t wakeup_futex_word = 0;
+
+/*
+ * Definitions (for attributes)
+ */
+static void	log_printf(int priority, const char *format, ...)
+    __attribute__((__format__(__printf__, 2, 3)));
+
+static void	log_vprintf(int priority, const char *format, va_list ap)
+    __attribute__((__format__(__printf__, 2, 0)));
+
+static void	realtime_ago_get(uint64_t ago_ns, struct timespec *res);
+static void	usage(void);
+
+/*
+ * Logging functions
+ */
+static const char log_month_str[][4] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static void
+log_vprintf(int priority, const char *format, va_list ap)
+{
+	va_list ap_copy;
+	int final_priority;
+	time_t current_time;
+	struct tm tm_res;
+
+	if ((priority < LOG_DEBUG) || (priority == LOG_DEBUG && log_debug >= 1)
+	    || (priority == LOG_TRACE && log_debug >= 2)) {
+		if (log_to_stderr) {
+			current_time = time(NULL);
+			localtime_r(&current_time, &tm_res);
+			fprintf(stderr, "%s %02d %02d:%02d:%02d ",
+				log_month_str[tm_res.tm_mon], tm_res.tm_mday, tm_res.tm_hour,
+				tm_res.tm_min, tm_res.tm_sec);
+
+			fprintf(stderr, "%s: ", PROGRAM_NAME);
+			va_copy(ap_copy, ap);
+			vfprintf(stderr, format, ap_copy);
+			va_end(ap_copy);
+			fprintf(stderr, "\n");
+		}
+
+		if (log_to_syslog) {
+			final_priority = priority;
+			if (priority > LOG_INFO) {
+				final_priority = LOG_INFO;
+			}
+
+			va_copy(ap_copy, ap);
+			vsyslog(final_priority, format, ap);
+			va_end(ap_copy);
+		}
+	}
+}
+
+static void
+log_printf(int priority, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+
+	log_vprintf(priority, format, ap);
+
+	va_end(ap);
+}
+
+static void
+log_perror(int priority, const char *s)
+{
+	int stored_errno;
+
+	stored_errno = errno;
+
+	log_printf(priority, "%s (%u): %s", s, stored_errno, strerror(stored_errno));
+}
+
+static int
+util_strtonum(const char *str, long long int min_val, long long int max_val, long long int *res)
+{
+	long long int tmp_ll;
+	char *ep;
+
+	if (min_val > max_val) {
+		return (-1);
+	}
+
+	errno = 0;
+
+	tmp_ll = strtoll(str, &ep, 10);
+	if (ep == str || *ep != '\0' || errno != 0) {
+		return (-1);
+	}
+
+	if (tmp_ll < min_val || tmp_ll > max_val) {
+		return (-1);
+	}
+
+	*res = tmp_ll;
+
+	return (0);
+}
+
+/*
+ * Utils
+ */
+static void
+utils_mlockall(void)
+{
+	int res;
+	struct rlimit rlimit;
+
+	rlimit.rlim_cur = RLIM_INFINITY;
+	rlimit.rlim_max = RLIM_INFINITY;
+
+	res = setrlimit(RLIMIT_MEMLOCK, &rlimit);
+	if (res == -1) {
+		log_printf(LOG_WARNING, "Could not increase RLIMIT_MEMLOCK, not locking memory");
+
+		return;
+	}
+
+	res = mlockall(MCL_CURRENT | MCL_FUTURE);
+	if (res == -1) {
+		log_printf(LOG_WARNING, "Could not mlockall");
+	}
+}
+
+static void
+utils_tty_detach(void)
+{
+	int devnull;
+
+	switch (fork()) {
+		case -1:
+			err(1, "Can't create child process");
+			break;
+		case 0:
+			break;
+		default:
+			exit(0);
+			break;
+	}
+
+	/* Create new session */
+	(void)setsid();
+
+	/*
+	 * Map stdin/out/err to /dev/null.
+	 */
+	devnull = open("/dev/null", O_RDWR);
+	if (devnull == -1) {
+		err(1, "Can't open /dev/null");
+	}
+
+	if (dup2(devnull, 0) < 0 || dup2(devnull, 1) < 0
+	    || dup2(devnull, 2) < 0) {
+		close(devnull);
+		err(1, "Can't dup2 stdin/out/err to /dev/null");
+	}
+	close(devnull);
+}
+
+static int
+utils_set_rr_scheduler(int silent)
+{
+#ifdef _POSIX_PRIORITY_SCHEDULING
+	int max_prio;
+	struct sched_param param;
+	int res;
+
+	max_prio = sched_get_priority_max(SCHED_RR);
+	if (max_prio == -1) {
+		if (!silent) {
+			log_perror(LOG_WARNING, "Can't get maximum SCHED_RR priority");
+		}
+
+		return (-1);
+	}
+
+	param.sched_priority = max_prio;
+	res = sched_setscheduler(0, SCHED_RR, &param);
+	if (res == -1) {
+		if (!silent) {
 			log_perror(LOG_WARNING, "Can't set SCHED_RR");
 		}
 
-		return (-1);
+		return (-1);
+	}
+#else
+	log_printf(LOG_WARNING, "Platform without sched_get_priority_min");
+#endif
+
+	return (0);
+}
+
+/*
+ * Cgroup
+ */
+static int
+cgroup_controller_list_contains(const char *list, const char *controller)
+{
+	size_t len;
+	const char *ep;
+
+	len = strlen(controller);
+
+	while (*list != '\0') {
+		ep = strchr(list, ',');
+		if (ep == NULL) {
+			ep = list + strlen(list);
+		}
+
+		if ((size_t)(ep - list) == len && strncmp(list, controller, len) == 0) {
+			return (1);
+		}
+
+		list = (*ep == ',' ? ep + 1 : ep);
+	}
+
+	return (0);
+}
+
+/*
+ * Store path of cgroup relative to mount point. Root cgroup is stored as empty
+ * string so paths can be constructed as mount + path + "/" + file.
+ */
+static void
+cgroup_path_set(char *dst, const char *path, const char *mount_root)
+{
+	size_t root_len;
+
+	root_len = strlen(mount_root);
+	if (strcmp(mount_root, "/") != 0 && strncmp(path, mount_root, root_len) == 0) {
+		path += root_len;
+	}
+
+	if (strcmp(path, "/") == 0) {
+		path = "";
+	}
+
+	snprintf(dst, PATH_MAX, "%s", path);
+}
+
+/*
+ * Find cgroup mount points in /proc/self/mountinfo and cgroups of this process
+ * in /proc/self/cgroup.
+ */
+static void
+cgroup_discover(void)
+{
+	FILE *f;
+	char buf[PATH_MAX * 2];
+	char mnt_root[PATH_MAX];
+	char mnt_point[PATH_MAX];
+	char fstype[64];
+	char super_opts[256];
+	char v1_cpu_root[PATH_MAX];
+	char v2_root[PATH_MAX];
+	char *sep;
+	char *controllers;
+	char *path;
+
+	cgroup_v1_cpu_mount[0] = cgroup_v1_cpu_path[0] = '\0';
+	cgroup_v2_mount[0] = cgroup_v2_path[0] = '\0';
+	strcpy(v1_cpu_root, "/");
+	strcpy(v2_root, "/");
+
+	f = fopen("/proc/self/mountinfo", "rt");
+	if (f == NULL) {
+		log_printf(LOG_DEBUG, "Can't open /proc/self/mountinfo");
+		return ;
+	}
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		if (sscanf(buf, "%*s %*s %*s %4095s %4095s", mnt_root, mnt_point) != 2) {
+			continue;
+		}
+
+		sep = strstr(buf, " - ");
+		if (sep == NULL || sscanf(sep + 3, "%63s %*s %255s", fstype, super_opts) != 2) {
+			continue;
+		}
+
+		if (strcmp(fstype, "cgroup") == 0 && cgroup_v1_cpu_mount[0] == '\0' &&
+		    cgroup_controller_list_contains(super_opts, "cpu")) {
+			snprintf(cgroup_v1_cpu_mount, sizeof(cgroup_v1_cpu_mount), "%s", mnt_point);
+			snprintf(v1_cpu_root, sizeof(v1_cpu_root), "%s", mnt_root);
+		} else if (strcmp(fstype, "cgroup2") == 0 && cgroup_v2_mount[0] == '\0') {
+			snprintf(cgroup_v2_mount, sizeof(cgroup_v2_mount), "%s", mnt_point);
+			snprintf(v2_root, sizeof(v2_root), "%s", mnt_root);
+		}
+	}
+
+	fclose(f);
+
+	f = fopen("/proc/self/cgroup", "rt");
+	if (f == NULL) {
+		log_printf(LOG_DEBUG, "Can't open /proc/self/cgroup");
+		return ;
+	}
+
+	/*
+	 * Lines have format hierarchy-ID:controller-list:cgroup-path
+	 */
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+
+		controllers = strchr(buf, ':');
+		if (controllers == NULL) {
+			continue;
+		}
+		controllers++;
+
+		path = strchr(controllers, ':');
+		if (path == NULL) {
+			continue;
+		}
+		*path++ = '\0';
+
+		if (strcmp(buf, "0:") == 0 && *controllers == '\0') {
+			cgroup_path_set(cgroup_v2_path, path, v2_root);
+		} else if (cgroup_controller_list_contains(controllers, "cpu")) {
+			cgroup_path_set(cgroup_v1_cpu_path, path, v1_cpu_root);
+		}
+	}
+
+	fclose(f);
+
+	log_printf(LOG_DEBUG, "cgroup v1 cpu mount = \"%s\", path = \"%s\", "
+	    "cgroup v2 mount = \"%s\", path = \"%s\"",
+	    cgroup_v1_cpu_mount, cgroup_v1_cpu_path, cgroup_v2_mount, cgroup_v2_path);
+}
+
+/*
+ * Construct name of file in cgroup. Path may be only prefix of path_len
+ * characters. Returns -1 if name is too long.
+ */
+static int
+cgroup_file_name_get(char *dst, const char *mount, const char *path, size_t path_len,
+    const char *file)
+{
+	int res;
+
+	res = snprintf(dst, PATH_MAX, "%s%.*s/%s", mount, (int)path_len, path, file);
+	if (res < 0 || res >= PATH_MAX) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+cgroup_file_read_ll(const char *fname, long long int *res)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(fname, "rt");
+	if (f == NULL) {
+		return (-1);
+	}
+
+	ret = (fscanf(f, "%lld", res) == 1 ? 0 : -1);
+
+	fclose(f);
+
+	return (ret);
+}
+
+static int
+cgroup_file_write_ll(const char *fname, long long int val)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		return (-1);
+	}
+
+	ret = 0;
+
+	if (fprintf(f, "%lld\n", val) <= 0) {
+		ret = -1;
+	}
+
+	if (fclose(f) != 0) {
+		ret = -1;
+	}
+
+	return (ret);
+}
+
+/*
+ * Set utilization clamp of this process so schedutil doesn't keep CPU on lowest
+ * frequency because of small duty cycle. Policy and priority are kept.
+ */
+static int
+utils_set_uclamp(uint32_t util_min, uint32_t util_max)
+{
+	struct spausedd_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_flags = SPAUSEDD_SCHED_FLAG_KEEP_POLICY | SPAUSEDD_SCHED_FLAG_KEEP_PARAMS |
+	    SPAUSEDD_SCHED_FLAG_UTIL_CLAMP_MIN | SPAUSEDD_SCHED_FLAG_UTIL_CLAMP_MAX;
+	attr.sched_util_min = util_min;
+	attr.sched_util_max = util_max;
+
+	if (syscall(SYS_sched_setattr, 0, &attr, 0) == -1) {
+		log_perror(LOG_WARNING, "Can't set utilization clamp");
+
+		return (-1);
+	}
+
+	log_printf(LOG_INFO, "Utilization clamp set to %"PRIu32" - %"PRIu32, util_min, util_max);
+
+	return (0);
+}
+
+/*
+ * Restrict process to CPUs with highest capacity (big cores on heterogeneous
+ * systems) as reported by cpu_capacity in sysfs.
+ */
+static int
+utils_set_capacity_affinity(void)
+{
+	cpu_set_t cur_set;
+	cpu_set_t new_set;
+	char fname[PATH_MAX];
+	FILE *f;
+	long int capacity;
+	long int max_capacity;
+	long int min_capacity;
+	int cpu;
+
+	if (sched_getaffinity(0, sizeof(cur_set), &cur_set) == -1) {
+		log_perror(LOG_WARNING, "Can't get CPU affinity");
+
+		return (-1);
+	}
+
+	CPU_ZERO(&new_set);
+	max_capacity = -1;
+	min_capacity = LONG_MAX;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &cur_set)) {
+			continue;
+		}
+
+		snprintf(fname, sizeof(fname), "/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu);
+		f = fopen(fname, "rt");
+		if (f == NULL) {
+			continue;
+		}
+
+		if (fscanf(f, "%ld", &capacity) != 1) {
+			capacity = -1;
+		}
+		fclose(f);
+
+		if (capacity < 0) {
+			continue;
+		}
+
+		if (capacity < min_capacity) {
+			min_capacity = capacity;
+		}
+
+		if (capacity > max_capacity) {
+			max_capacity = capacity;
+			CPU_ZERO(&new_set);
+		}
+
+		if (capacity == max_capacity) {
+			CPU_SET(cpu, &new_set);
+		}
+	}
+
+	if (max_capacity == -1) {
+		log_printf(LOG_DEBUG, "cpu_capacity not available, not changing CPU affinity");
+
+		return (-1);
+	}
+
+	if (min_capacity == max_capacity) {
+		log_printf(LOG_DEBUG, "All CPUs have same capacity, not changing CPU affinity");
+
+		return (0);
+	}
+
+	if (sched_setaffinity(0, sizeof(new_set), &new_set) == -1) {
+		log_perror(LOG_WARNING, "Can't set CPU affinity");
+
+		return (-1);
+	}
+
+	log_printf(LOG_INFO, "Running on %d CPUs with capacity %ld (lowest is %ld)",
+	    CPU_COUNT(&new_set), max_capacity, min_capacity);
+
+	return (0);
+}
+
+/*
+ * Resolve cgroup v2 directory. Path is either full path of cgroup directory
+ * (containing file) or path relative to cgroup v2 mount point. Returns -1 if
+ * resulting name is too long.
+ */
+static int
+cgroup_v2_dir_get(const char *path, const char *file, char *dst)
+{
+	char fname[PATH_MAX];
+
+	if (path[0] == '/' && cgroup_file_name_get(fname, path, "", 0, file) == 0 &&
+	    access(fname, F_OK) == 0) {
+		snprintf(dst, PATH_MAX, "%s", path);
+
+		return (0);
+	}
+
+	if (snprintf(fname, sizeof(fname), "%s%s", (path[0] == '/' ? "" : "/"), path) >=
+	    (int)sizeof(fname) ||
+	    cgroup_file_name_get(dst, cgroup_v2_mount, fname, strlen(fname), "") == -1) {
+		return (-1);
+	}
+	dst[strlen(dst) - 1] = '\0';
+
+	return (0);
+}
+
+static void
+utils_move_to_root_cgroup(void)
+{
+	FILE *f;
+	char cgroup_task_fname[PATH_MAX];
+	char rt_runtime_fname[PATH_MAX];
+
+	/*
+	 * Mount points are discovered from /proc/self/mountinfo.
+	 *
+	 * This feature is expected to be removed as soon as systemd gets support
+	 * for managing RT configuration.
+	 */
+	if (cgroup_v1_cpu_mount[0] != '\0' &&
+	    cgroup_file_name_get(rt_runtime_fname, cgroup_v1_cpu_mount, "", 0,
+	    "cpu.rt_runtime_us") == 0 &&
+	    access(rt_runtime_fname, F_OK) == 0 &&
+	    cgroup_file_name_get(cgroup_task_fname, cgroup_v1_cpu_mount, "", 0, "tasks") == 0) {
+		log_printf(LOG_DEBUG, "Moving main pid to cgroup v1 root cgroup");
+	} else if (cgroup_v2_mount[0] != '\0' &&
+	    cgroup_file_name_get(cgroup_task_fname, cgroup_v2_mount, "", 0, "cgroup.procs") == 0) {
+		log_printf(LOG_DEBUG, "Moving main pid to cgroup v2 root cgroup");
+	} else {
+		log_printf(LOG_DEBUG, "cpu.rt_runtime_us or cgroup.procs doesn't exist -> "
+		    "system without cgroup or with disabled CONFIG_RT_GROUP_SCHED");
+
+		return ;
+	}
+
+	f = fopen(cgroup_task_fname, "w");
+	if (f == NULL) {
+		log_printf(LOG_WARNING, "Can't open cgroups tasks file for writing");
+		return ;
+	}
+
+	if (fprintf(f, "%jd\n", (intmax_t)getpid()) <= 0) {
+		log_printf(LOG_WARNING, "Can't write spausedd pid into cgroups tasks file");
+	}
+
+	if (fclose(f) != 0) {
+		log_printf(LOG_WARNING, "Can't close cgroups tasks file");
+		return ;
+	}
+}
+
+/*
+ * Read first line of file (without newline). Returns empty string on error.
+ */
+static void
+utils_file_first_line_get(const char *fname, char *buf, size_t buf_size)
+{
+	FILE *f;
+
+	buf[0] = '\0';
+
+	f = fopen(fname, "rt");
+	if (f == NULL) {
+		return ;
+	}
+
+	if (fgets(buf, buf_size, f) == NULL) {
+		buf[0] = '\0';
+	}
+	buf[strcspn(buf, "\n")] = '\0';
+
+	fclose(f);
+}
+
+/*
+ * Read whole (small) proc file into buf without allocating memory. File is read
+ * from offset 0 so the same fd can be reused for every sample. Returned
+ * string is always NUL terminated. Returns number of bytes read or -1 on error.
+ */
+static ssize_t
+utils_proc_file_pread(int fd, char *buf, size_t buf_size)
+{
+	ssize_t res;
+
+	res = pread(fd, buf, buf_size - 1, 0);
+	if (res < 0) {
+		buf[0] = '\0';
+		return (-1);
+	}
+
+	buf[res] = '\0';
+
+	return (res);
+}
+
+/*
+ * Signal handlers
+ */
+static void
+signal_int_handler(int sig)
+{
+
+	stop_main_loop = 1;
+}
+
+static void
+signal_usr1_handler(int sig)
+{
+
+	display_statistics = 1;
+}
+
+static void
+signal_hup_handler(int sig)
+{
+
+	reexec_requested = 1;
+}
+
+static void
+signal_handlers_register(void)
+{
+	struct sigaction act;
+	sigset_t sigset;
+
+	act.sa_handler = signal_int_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+
+	sigaction(SIGINT, &act, NULL);
+
+	act.sa_handler = signal_int_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+
+	sigaction(SIGTERM, &act, NULL);
+
+	act.sa_handler = signal_usr1_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+
+	sigaction(SIGUSR1, &act, NULL);
+
+	act.sa_handler = signal_hup_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+
+	sigaction(SIGHUP, &act, NULL);
+
+	/*
+	 * Signals blocked by previous image during re-exec are delivered now
+	 */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGHUP);
+	sigaddset(&sigset, SIGUSR1);
+	(void)sigprocmask(SIG_UNBLOCK, &sigset, NULL);
+}
+
+/*
+ * Function to get current CLOCK_MONOTONIC in nanoseconds
+ */
+static uint64_t
+nano_current_get(void)
+{
+	uint64_t res;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	res = (uint64_t)(ts.tv_sec * NO_NS_IN_SEC) + (uint64_t)ts.tv_nsec;
+	return (res);
+}
+
+/*
+ * Get steal time provided by kernel
+ */
+static uint64_t
+nano_stealtime_kernel_get(void)
+{
+	FILE *f;
+	char buf[4096];
+	uint64_t s_user, s_nice, s_system, s_idle, s_iowait, s_irq, s_softirq, s_steal;
+	uint64_t res_steal;
+	long int clock_tick;
+	uint64_t factor;
+
+	res_steal = 0;
+
+	f = fopen("/proc/stat", "rt");
+	if (f == NULL) {
+		return (res_steal);
+	}
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		s_user = s_nice = s_system = s_idle = s_iowait = s_irq = s_softirq = s_steal = 0;
+		if (sscanf(buf, "cpu %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64
+		    " %"PRIu64" %"PRIu64,
+		    &s_user, &s_nice, &s_system, &s_idle, &s_iowait, &s_irq, &s_softirq,
+		    &s_steal) > 4) {
+			/*
+			 * Got valid line
+			 */
+			clock_tick = steal_clock_tick;
+			if (clock_tick <= 0) {
+				clock_tick = sysconf(_SC_CLK_TCK);
+				if (clock_tick == -1) {
+					log_printf(LOG_TRACE, "Can't get _SC_CLK_TCK, using 100");
+					clock_tick = 100;
+				}
+			}
+
+			factor = NO_NS_IN_SEC / clock_tick;
+			res_steal = s_steal * factor;
+
+			log_printf(LOG_TRACE, "nano_stealtime_get kernel stats: "
+			    "user = %"PRIu64", nice = %"PRIu64"s, system = %"PRIu64
+			    ", idle = %"PRIu64", iowait = %"PRIu64", irq = %"PRIu64
+			    ", softirq = %"PRIu64", steal = %"PRIu64", factor = %"PRIu64
+			    ", result steal = %"PRIu64,
+			    s_user, s_nice, s_system, s_idle, s_iowait, s_irq, s_softirq, s_steal,
+			    factor, res_steal);
+
+			break;
+		}
+	}
+
+	fclose(f);
+
+	return (res_steal);
+}
+
+/*
+ * Get steal time provided by vmguestlib
+ */
+#ifdef HAVE_VMGUESTLIB
+/* vSphere SDKの場合 */
+static uint64_t
+nano_stealtime_vmguestlib_get(void)
+{
+	VMGuestLibError gl_err;
+	uint64_t stolen_ms;
+	uint64_t res_steal;
+	uint64_t used_ms, elapsed_ms;
+	static uint64_t prev_stolen_ms, prev_used_ms, prev_elapsed_ms;
+
+	/*
+          仮想マシンに関する情報を更新します。この情報はVMGuestLibHandleに関連付けられています。
+          VMGuestLib_UpdateInfoは、システムコールと同様のCPUリソースを必要とするため、パフォーマンスに影響を与える可能性があります。パフォーマンスが心配な場合は、VMGuestLib_UpdateInfoへの呼び出しの数を最小限に抑えてください。
+
+          プログラムが複数のスレッドを使用する場合、各スレッドは異なるハンドルを使用する必要があります。それ以外の場合は、更新呼び出しの周りにロックスキームを実装する必要があります。vSphere Guest APIは、ハンドルを使用したアクセスに関する内部ロックを実装していません。
+	*/
+	gl_err = VMGuestLib_UpdateInfo(guestlib_handle);
+	if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
+		log_printf(LOG_WARNING, "Can't update stolen time from guestlib: %s",
+		    VMGuestLib_GetErrorText(gl_err));
+
+		return (0);
+	}
+        /* 仮想マシンが準備完了状態（実行状態に移行可能）であったが、実行がスケジュールされていなかったミリ秒数を取得 */
+	gl_err = VMGuestLib_GetCpuStolenMs(guestlib_handle, &stolen_ms);
+	if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
+		log_printf(LOG_WARNING, "Can't get stolen time from guestlib: %s",
+		    VMGuestLib_GetErrorText(gl_err));
+
+		return (0);
+	}
+
+	/*
+	 * For debug purpose, returned errors ignored
+	 */
+	used_ms = elapsed_ms = 0;
+        /*
+        仮想マシンがCPUを使用したミリ秒数を取得します。この値には、ゲストオペレーティングシステムによって使用された時間と、この仮想マシンのタスクの仮想化コードによって使用された時間が含まれます。この値を経過時間（VMGuestLib_GetElapsedMs）と組み合わせて、仮想マシンの実効CPU速度を見積もることができます。この値はelapsedMsのサブセットです。 
+        */
+	(void)VMGuestLib_GetCpuUsedMs(guestlib_handle, &used_ms);
+        /* 
+        仮想マシンがサーバー上で最後に実行を開始してから経過したミリ秒数を取得します。経過時間のカウントは、仮想マシンの電源がオンになるか、再開されるか、VMotionを使用して移行されるたびに再開されます。この値は、仮想マシンがその時間中に処理能力を使用しているかどうかに関係なく、ミリ秒をカウントします。この値を仮想マシンが使用するCPU時間（VMGuestLib_GetCpuUsedMs）と組み合わせて、仮想マシンの実効CPU速度を見積もることができます。cpuUsedMSは、この値のサブセットです
+        */
+	(void)VMGuestLib_GetElapsedMs(guestlib_handle, &elapsed_ms);
+
+	log_printf(LOG_TRACE, "nano_stealtime_vmguestlib_get stats: "
+	    "stolen = %"PRIu64" (%"PRIu64"), used = %"PRIu64" (%"PRIu64"), "
+	    "elapsed = %"PRIu64" (%"PRIu64")",
+	    stolen_ms, stolen_ms - prev_stolen_ms, used_ms, used_ms - prev_used_ms,
+	    elapsed_ms, elapsed_ms - prev_elapsed_ms);
+
+	prev_stolen_ms = stolen_ms;
+	prev_used_ms = used_ms;
+	prev_elapsed_ms = elapsed_ms;
+
+	res_steal = NO_NS_IN_MSEC * stolen_ms;
+
+	return (res_steal);
+}
+#endif
+
+/*
+ * Get steal time
+ */
+static uint64_t
+nano_stealtime_get(void)
+{
+	uint64_t res;
+
+#ifdef HAVE_VMGUESTLIB
+	if (use_vmguestlib_stealtime) {
+		res = nano_stealtime_vmguestlib_get();
+	} else {
+		res = nano_stealtime_kernel_get();
+	}
+#else
+	res = nano_stealtime_kernel_get();
+#endif
+
+	return (res);
+}
+
+
+/*
+ * Get time spent waiting on runqueue provided by per-task schedstat.
+ * /proc/self/schedstat contains "sum_exec_runtime run_delay pcount".
+ * Returns 0 on success or -1 if run_delay is not available.
+ */
+static int
+nano_run_delay_get(uint64_t *run_delay)
+{
+	char buf[128];
+	char *ep;
+	char *ep2;
+
+	if (schedstat_self_fd == -1) {
+		return (-1);
+	}
+
+	if (utils_proc_file_pread(schedstat_self_fd, buf, sizeof(buf)) <= 0) {
+		return (-1);
+	}
+
+	(void)strtoull(buf, &ep, 10);
+	if (ep == buf) {
+		return (-1);
+	}
+
+	*run_delay = strtoull(ep, &ep2, 10);
+	if (ep2 == ep) {
+		return (-1);
+	}
+
+	log_printf(LOG_TRACE, "nano_run_delay_get stats: run_delay = %"PRIu64, *run_delay);
+
+	return (0);
+}
+
+/*
+ * Schedstat
+ */
+static void
+schedstat_init(void)
+{
+	char buf[128];
+
+	schedstat_self_fd = open("/proc/self/schedstat", O_RDONLY | O_CLOEXEC);
+	if (schedstat_self_fd == -1) {
+		log_printf(LOG_DEBUG, "Can't open /proc/self/schedstat -> "
+		    "kernel without CONFIG_SCHED_INFO, runqueue wait is not reported");
+
+		return ;
+	}
+
+	if (utils_proc_file_pread(schedstat_self_fd, buf, sizeof(buf)) <= 0) {
+		log_printf(LOG_DEBUG, "Can't read /proc/self/schedstat, runqueue wait is not reported");
+
+		(void)close(schedstat_self_fd);
+		schedstat_self_fd = -1;
+	}
+}
+
+static void
+schedstat_fini(void)
+{
+
+	if (schedstat_self_fd != -1) {
+		(void)close(schedstat_self_fd);
+		schedstat_self_fd = -1;
+	}
+}
+
+/*
+ * System-wide schedstat
+ */
+
+/*
+ * Parse cpu lines of /proc/schedstat in schedstat_buf. Line is
+ * "cpuN yld_count 0 sched_count sched_goidle ttwu_count ttwu_local rq_cpu_time
+ * run_delay pcount". Only complete lines are parsed so truncated read is
+ * harmless. When update is set, window increments are computed.
+ */
+static void
+cpu_schedstat_parse(int update)
+{
+	struct cpu_schedstat *stats;
+	uint64_t values[9];
+	char *line;
+	char *eol;
+	char *ep;
+	long int cpu;
+	int i;
+
+	for (line = schedstat_buf; (eol = strchr(line, '\n')) != NULL; line = eol + 1) {
+		if (strncmp(line, "cpu", 3) != 0 || line[3] < '0' || line[3] > '9') {
+			continue;
+		}
+
+		cpu = strtol(line + 3, &ep, 10);
+		for (i = 0; i < 9; i++) {
+			values[i] = strtoull(ep, &ep, 10);
+		}
+
+		if (ep > eol || cpu < 0 || cpu >= SCHEDSTAT_MAX_CPUS) {
+			continue;
+		}
+
+		stats = &cpu_schedstats[cpu];
+		if (update && stats->valid &&
+		    values[7] >= stats->run_delay && values[8] >= stats->pcount) {
+			stats->window_run_delay = values[7] - stats->run_delay;
+			stats->window_pcount = values[8] - stats->pcount;
+		} else {
+			stats->window_run_delay = 0;
+			stats->window_pcount = 0;
+		}
+
+		stats->run_delay = values[7];
+		stats->pcount = values[8];
+		stats->valid = 1;
+
+		if (cpu >= cpu_schedstat_count) {
+			cpu_schedstat_count = cpu + 1;
+		}
+	}
+}
+
+static int
+cpu_schedstat_is_hot(const struct cpu_schedstat *stats)
+{
+
+	return (stats->valid && cpu_schedstat_window > 0 &&
+	    stats->window_run_delay * 100 > cpu_schedstat_window * CPU_RUN_DELAY_HOT_THRESHOLD);
+}
+
+static void
+cpu_schedstat_init(void)
+{
+	ssize_t res;
+	size_t size;
+	long int version;
+
+	memset(cpu_schedstats, 0, sizeof(cpu_schedstats));
+
+	schedstat_fd = open("/proc/schedstat", O_RDONLY | O_CLOEXEC);
+	if (schedstat_fd == -1) {
+		log_printf(LOG_DEBUG, "Can't open /proc/schedstat -> "
+		    "kernel without CONFIG_SCHEDSTATS, per CPU runqueue wait is not reported");
+
+		return ;
+	}
+
+	/*
+	 * Size buffer so whole file fits with room for growth. Buffer is allocated
+	 * only here so reading samples is allocation free.
+	 */
+	for (size = SCHEDSTAT_BUF_INIT_SIZE; size <= SCHEDSTAT_BUF_MAX_SIZE; size *= 2) {
+		free(schedstat_buf);
+		schedstat_buf = malloc(size);
+		if (schedstat_buf == NULL) {
+			break;
+		}
+		schedstat_buf_size = size;
+
+		res = utils_proc_file_pread(schedstat_fd, schedstat_buf, size);
+		if (res <= 0 || (size_t)res < size / 2) {
+			break;
+		}
+	}
+
+	if (schedstat_buf == NULL ||
+	    strncmp(schedstat_buf, "version ", strlen("version ")) != 0) {
+		log_printf(LOG_DEBUG, "Can't read /proc/schedstat, per CPU runqueue wait is not "
+		    "reported");
+
+		goto error_close;
+	}
+
+	version = strtol(schedstat_buf + strlen("version "), NULL, 10);
+	if (version < SCHEDSTAT_MIN_VERSION) {
+		log_printf(LOG_DEBUG, "Unsupported /proc/schedstat version %ld, per CPU runqueue "
+		    "wait is not reported", version);
+
+		goto error_close;
+	}
+
+	cpu_schedstat_parse(0);
+	cpu_schedstat_tv = nano_current_get();
+
+	log_printf(LOG_DEBUG, "Tracking runqueue wait of %d CPUs", cpu_schedstat_count);
+
+	return ;
+
+error_close:
+	(void)close(schedstat_fd);
+	schedstat_fd = -1;
+	free(schedstat_buf);
+	schedstat_buf = NULL;
+}
+
+static void
+cpu_schedstat_fini(void)
+{
+
+	if (schedstat_fd != -1) {
+		(void)close(schedstat_fd);
+		schedstat_fd = -1;
+	}
+
+	free(schedstat_buf);
+	schedstat_buf = NULL;
+}
+
+/*
+ * Read /proc/schedstat and compute runqueue wait of all CPUs during window since
+ * previous read
+ */
+static void
+cpu_schedstat_update(void)
+{
+	struct cpu_schedstat *stats;
+	uint64_t tv_now;
+	double perc;
+	int cpu;
+
+	if (schedstat_fd == -1) {
+		return ;
+	}
+
+	if (utils_proc_file_pread(schedstat_fd, schedstat_buf, schedstat_buf_size) <= 0) {
+		return ;
+	}
+
+	tv_now = nano_current_get();
+	cpu_schedstat_window = tv_now - cpu_schedstat_tv;
+	cpu_schedstat_tv = tv_now;
+
+	cpu_schedstat_parse(1);
+
+	if (cpu_schedstat_window == 0) {
+		return ;
+	}
+
+	for (cpu = 0; cpu < cpu_schedstat_count; cpu++) {
+		stats = &cpu_schedstats[cpu];
+
+		perc = ((double)stats->window_run_delay / cpu_schedstat_window) * (double)100;
+		if (perc > stats->run_delay_perc_max) {
+			stats->run_delay_perc_max = perc;
+		}
+
+		if (cpu_schedstat_is_hot(stats)) {
+			stats->hot_windows++;
+		}
+	}
+}
+
+/*
+ * Log hot CPUs during pause. own_cpu is CPU spausedd was running on.
+ */
+static void
+cpu_schedstat_pause_report(int own_cpu)
+{
+	const struct cpu_schedstat *stats;
+	char buf[512];
+	size_t pos;
+	int cpu;
+	int hot_cpus;
+	int res;
+
+	if (schedstat_fd == -1 || cpu_schedstat_window == 0) {
+		return ;
+	}
+
+	pos = 0;
+	buf[0] = '\0';
+	hot_cpus = 0;
+
+	for (cpu = 0; cpu < cpu_schedstat_count; cpu++) {
+		stats = &cpu_schedstats[cpu];
+
+		if (!cpu_schedstat_is_hot(stats)) {
+			continue;
+		}
+
+		hot_cpus++;
+
+		if (pos < sizeof(buf)) {
+			res = snprintf(buf + pos, sizeof(buf) - pos, " %d%s (%0.1f%%, %"PRIu64
+			    " timeslices)", cpu, (cpu == own_cpu ? "*" : ""),
+			    ((double)stats->window_run_delay / cpu_schedstat_window) * (double)100,
+			    stats->window_pcount);
+			pos += (res > 0 ? (size_t)res : 0);
+		}
+	}
+
+	if (hot_cpus == 0) {
+		log_printf(LOG_INFO, "No CPU had runqueue wait > %u%%", CPU_RUN_DELAY_HOT_THRESHOLD);
+
+		return ;
+	}
+
+	log_printf(LOG_WARNING, "%d CPUs had runqueue wait > %u%% (* marks own CPU):%s%s",
+	    hot_cpus, CPU_RUN_DELAY_HOT_THRESHOLD, buf, (pos >= sizeof(buf) ? " ..." : ""));
+}
+
+static void
+cpu_schedstat_statistics_print(void)
+{
+	const struct cpu_schedstat *stats;
+	int cpu;
+
+	for (cpu = 0; cpu < cpu_schedstat_count; cpu++) {
+		stats = &cpu_schedstats[cpu];
+
+		if (stats->hot_windows == 0) {
+			continue;
+		}
+
+		log_printf(LOG_INFO, "CPU %d had runqueue wait > %u%% in %"PRIu64" windows, "
+		    "max runqueue wait %0.1f%%", cpu, CPU_RUN_DELAY_HOT_THRESHOLD,
+		    stats->hot_windows, stats->run_delay_perc_max);
+	}
+}
+
+/*
+ * Runqueue waiters
+ */
+static int
+runq_task_cmp(const void *a, const void *b)
+{
+	const struct runq_task *ta = a;
+	const struct runq_task *tb = b;
+
+	return ((ta->tid > tb->tid) - (ta->tid < tb->tid));
+}
+
+/*
+ * Read run_delay (second field) of task schedstat file. Returns 0 on success.
+ */
+static int
+runq_task_run_delay_get(const char *pid_str, const char *tid_str, uint64_t *run_delay)
+{
+	char fname[PATH_MAX];
+	char buf[128];
+	char *ep;
+	ssize_t res;
+	int fd;
+
+	if (snprintf(fname, sizeof(fname), "/proc/%s/task/%s/schedstat", pid_str,
+	    tid_str) >= (int)sizeof(fname)) {
+		return (-1);
+	}
+
+	fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return (-1);
+	}
+
+	res = utils_proc_file_pread(fd, buf, sizeof(buf));
+	(void)close(fd);
+	if (res <= 0) {
+		return (-1);
+	}
+
+	(void)strtoull(buf, &ep, 10);
+	if (ep == buf) {
+		return (-1);
+	}
+	*run_delay = strtoull(ep, NULL, 10);
+
+	return (0);
+}
+
+static int
+runq_task_add(pid_t pid, pid_t tid, uint64_t run_delay, size_t *count)
+{
+	struct runq_task *new_tasks;
+	size_t new_size;
+
+	if (*count >= runq_tasks_new_size) {
+		new_size = (runq_tasks_new_size == 0 ? RUNQ_TASKS_INIT_SIZE :
+		    runq_tasks_new_size * 2);
+		new_tasks = realloc(runq_tasks_new, new_size * sizeof(*new_tasks));
+		if (new_tasks == NULL) {
+			return (-1);
+		}
+		runq_tasks_new = new_tasks;
+		runq_tasks_new_size = new_size;
+	}
+
+	runq_tasks_new[*count].pid = pid;
+	runq_tasks_new[*count].tid = tid;
+	runq_tasks_new[*count].run_delay = run_delay;
+	runq_tasks_new[*count].wait = 0;
+	(*count)++;
+
+	return (0);
+}
+
+/*
+ * Read run_delay of all tasks (except spausedd) and compute wait since previous
+ * scan. RUNQ_WAITERS_TOP tasks with longest wait are stored into top (sorted by
+ * wait) and their number into top_count. Returns -1 if /proc can't be read.
+ */
+static int
+runq_waiters_scan(struct runq_task *top, int *top_count)
+{
+	struct runq_task key;
+	struct runq_task *prev;
+	struct runq_task *task;
+	struct runq_task *tmp_tasks;
+	struct timespec ts_start, ts_end;
+	struct dirent *pid_de;
+	struct dirent *tid_de;
+	char dname[PATH_MAX];
+	DIR *proc_dir;
+	DIR *task_dir;
+	uint64_t run_delay;
+	uint64_t cost;
+	size_t tmp_size;
+	size_t count;
+	size_t i;
+	pid_t own_pid;
+	int j;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts_start);
+
+	proc_dir = opendir("/proc");
+	if (proc_dir == NULL) {
+		return (-1);
+	}
+
+	own_pid = getpid();
+	count = 0;
+
+	while ((pid_de = readdir(proc_dir)) != NULL) {
+		if (pid_de->d_name[0] < '1' || pid_de->d_name[0] > '9' ||
+		    (pid_t)atoi(pid_de->d_name) == own_pid) {
+			continue;
+		}
+
+		if (snprintf(dname, sizeof(dname), "/proc/%s/task",
+		    pid_de->d_name) >= (int)sizeof(dname) ||
+		    (task_dir = opendir(dname)) == NULL) {
+			continue;
+		}
+
+		while ((tid_de = readdir(task_dir)) != NULL) {
+			if (tid_de->d_name[0] < '1' || tid_de->d_name[0] > '9' ||
+			    runq_task_run_delay_get(pid_de->d_name, tid_de->d_name,
+			    &run_delay) == -1) {
+				continue;
+			}
+
+			if (runq_task_add((pid_t)atoi(pid_de->d_name), (pid_t)atoi(tid_de->d_name),
+			    run_delay, &count) == -1) {
+				break;
+			}
+		}
+
+		(void)closedir(task_dir);
+	}
+
+	(void)closedir(proc_dir);
+
+	qsort(runq_tasks_new, count, sizeof(*runq_tasks_new), runq_task_cmp);
+
+	/*
+	 * Tasks not found in previous scan were created since then and their whole
+	 * run_delay is wait
+	 */
+	*top_count = 0;
+	for (i = 0; i < count; i++) {
+		task = &runq_tasks_new[i];
+		key.tid = task->tid;
+		prev = (runq_task_count > 0 ? bsearch(&key, runq_tasks, runq_task_count,
+		    sizeof(*runq_tasks), runq_task_cmp) : NULL);
+		task->wait = (prev == NULL || prev->pid != task->pid ? task->run_delay :
+		    (task->run_delay >= prev->run_delay ? task->run_delay - prev->run_delay : 0));
+
+		if (top == NULL || task->wait == 0 || (*top_count == RUNQ_WAITERS_TOP &&
+		    task->wait <= top[RUNQ_WAITERS_TOP - 1].wait)) {
+			continue;
+		}
+
+		if (*top_count < RUNQ_WAITERS_TOP) {
+			(*top_count)++;
+		}
+
+		for (j = *top_count - 1; j > 0 && top[j - 1].wait < task->wait; j--) {
+			top[j] = top[j - 1];
+		}
+		top[j] = *task;
+	}
+
+	tmp_tasks = runq_tasks;
+	tmp_size = runq_tasks_size;
+	runq_tasks = runq_tasks_new;
+	runq_tasks_size = runq_tasks_new_size;
+	runq_task_count = count;
+	runq_tasks_new = tmp_tasks;
+	runq_tasks_new_size = tmp_size;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts_end);
+	cost = (uint64_t)(ts_end.tv_sec - ts_start.tv_sec) * NO_NS_IN_SEC +
+	    ts_end.tv_nsec - ts_start.tv_nsec;
+
+	runq_scan_tv = nano_current_get();
+	runq_scans++;
+	runq_scan_tasks_sum += count;
+	runq_scan_cost_sum += cost;
+	if (cost > runq_scan_cost_max) {
+		runq_scan_cost_max = cost;
+	}
+
+	return (0);
+}
+
+static void
+runq_waiters_init(void)
+{
+	int top_count;
+
+	if (runq_waiters_interval == 0) {
+		return ;
+	}
+
+	if (runq_waiters_scan(NULL, &top_count) == -1 || runq_task_count == 0) {
+		log_printf(LOG_WARNING, "Can't read schedstat of tasks -> kernel without "
+		    "CONFIG_SCHED_INFO, runqueue waiters are not reported");
+		runq_waiters_interval = 0;
+
+		return ;
+	}
+
+	log_printf(LOG_DEBUG, "Scanning runqueue wait of %zu tasks every %"PRIu64"s",
+	    runq_task_count, runq_waiters_interval);
+}
+
+static void
+runq_waiters_fini(void)
+{
+
+	free(runq_tasks);
+	runq_tasks = NULL;
+	runq_task_count = runq_tasks_size = 0;
+	free(runq_tasks_new);
+	runq_tasks_new = NULL;
+	runq_tasks_new_size = 0;
+}
+
+/*
+ * Scan tasks when interval since previous scan elapsed, so wait reported on pause
+ * covers at most interval before pause
+ */
+static void
+runq_waiters_update(uint64_t tv_now)
+{
+	int top_count;
+
+	if (runq_waiters_interval == 0 ||
+	    tv_now - runq_scan_tv < runq_waiters_interval * NO_NS_IN_SEC) {
+		return ;
+	}
+
+	(void)runq_waiters_scan(NULL, &top_count);
+}
+
+/*
+ * Log tasks with longest runqueue wait since previous scan (including pause)
+ */
+static void
+runq_waiters_pause_report(void)
+{
+	struct runq_task top[RUNQ_WAITERS_TOP];
+	char fname[PATH_MAX];
+	char comm[64];
+	char buf[512];
+	uint64_t span;
+	size_t pos;
+	int top_count;
+	int res;
+	int i;
+
+	if (runq_waiters_interval == 0) {
+		return ;
+	}
+
+	span = nano_current_get() - runq_scan_tv;
+	if (runq_waiters_scan(top, &top_count) == -1) {
+		return ;
+	}
+
+	if (top_count == 0) {
+		log_printf(LOG_INFO, "No task waited on runqueue during last %0.4fs",
+		    (double)span / NO_NS_IN_SEC);
+
+		return ;
+	}
+
+	pos = 0;
+	buf[0] = '\0';
+
+	for (i = 0; i < top_count && pos < sizeof(buf); i++) {
+		snprintf(fname, sizeof(fname), "/proc/%jd/task/%jd/comm", (intmax_t)top[i].pid,
+		    (intmax_t)top[i].tid);
+		utils_file_first_line_get(fname, comm, sizeof(comm));
+
+		res = snprintf(buf + pos, sizeof(buf) - pos, "%s %s[%jd] %0.4fs",
+		    (i > 0 ? "," : ""), (comm[0] != '\0' ? comm : "?"), (intmax_t)top[i].tid,
+		    (double)top[i].wait / NO_NS_IN_SEC);
+		if (res < 0) {
+			break;
+		}
+		pos += res;
+	}
+
+	log_printf(LOG_INFO, "Longest runqueue waits during last %0.4fs:%s",
+	    (double)span / NO_NS_IN_SEC, buf);
+}
+
+static void
+runq_waiters_statistics_print(void)
+{
+
+	if (runq_waiters_interval == 0 || runq_scans == 0) {
+		return ;
+	}
+
+	log_printf(LOG_INFO, "Runqueue waiters: %"PRIu64" scans of %"PRIu64" tasks on average, "
+	    "scan CPU time mean %0.4fs, max %0.4fs", runq_scans, runq_scan_tasks_sum / runq_scans,
+	    (double)runq_scan_cost_sum / runq_scans / NO_NS_IN_SEC,
+	    (double)runq_scan_cost_max / NO_NS_IN_SEC);
+}
+
+/*
+ * Clock check against invariant TSC (cntvct on arm64)
+ */
+static uint64_t
+clock_counter_get(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t low;
+	uint32_t high;
+
+	__asm__ __volatile__("lfence; rdtsc" : "=a" (low), "=d" (high) : : "memory");
+
+	return ((uint64_t)high << 32 | low);
+#elif defined(__aarch64__)
+	uint64_t val;
+
+	__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r" (val) : : "memory");
+
+	return (val);
+#else
+	return (0);
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Return 1 when kernel reports both constant_tsc and nonstop_tsc flags. Hypervisors
+ * with migratable CPU models usually hide invariant TSC CPUID bit, but kernel still
+ * sets these flags on such guests.
+ */
+static int
+clock_cpuinfo_tsc_stable(void)
+{
+	FILE *f;
+	char *line;
+	size_t line_size;
+	char *flag;
+	char *saveptr;
+	int constant_tsc;
+	int nonstop_tsc;
+
+	f = fopen("/proc/cpuinfo", "rt");
+	if (f == NULL) {
+		return (0);
+	}
+
+	line = NULL;
+	line_size = 0;
+	constant_tsc = nonstop_tsc = 0;
+
+	while (getline(&line, &line_size, f) != -1) {
+		if (strncmp(line, "flags", strlen("flags")) != 0 ||
+		    (flag = strchr(line, ':')) == NULL) {
+			continue;
+		}
+
+		for (flag = strtok_r(flag + 1, " \t\n", &saveptr); flag != NULL;
+		    flag = strtok_r(NULL, " \t\n", &saveptr)) {
+			if (strcmp(flag, "constant_tsc") == 0) {
+				constant_tsc = 1;
+			} else if (strcmp(flag, "nonstop_tsc") == 0) {
+				nonstop_tsc = 1;
+			}
+		}
+
+		/*
+		 * Flags of first CPU are enough
+		 */
+		break;
+	}
+
+	free(line);
+	fclose(f);
+
+	return (constant_tsc && nonstop_tsc);
+}
+#endif
+
+static void
+clock_check_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+	char clocksource[64];
+
+	if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || !(edx & (1U << 8))) {
+		utils_file_first_line_get(
+		    "/sys/devices/system/clocksource/clocksource0/current_clocksource",
+		    clocksource, sizeof(clocksource));
+
+		if (clock_cpuinfo_tsc_stable()) {
+			log_printf(LOG_DEBUG, "TSC is not reported as invariant by CPUID, "
+			    "using constant_tsc and nonstop_tsc flags");
+		} else if (strcmp(clocksource, "tsc") == 0 ||
+		    strcmp(clocksource, "kvm-clock") == 0) {
+			log_printf(LOG_DEBUG, "TSC is not reported as invariant by CPUID, "
+			    "using %s clocksource", clocksource);
+		} else {
+			log_printf(LOG_INFO, "TSC is not invariant, clock is not checked");
+
+			return ;
+		}
+	}
+#elif !defined(__aarch64__)
+	log_printf(LOG_INFO, "No constant rate counter, clock is not checked");
+
+	return ;
+#endif
+
+	clock_check_enabled = 1;
+}
+
+/*
+ * Get CLOCK_MONOTONIC time together with counter value read at the same moment.
+ * Reads are retried when counter reads around clock_gettime are too far apart
+ * (because of interrupt or preemption).
+ */
+static void
+clock_pair_get(uint64_t *tv, uint64_t *counter)
+{
+	uint64_t counter_before;
+	uint64_t counter_after;
+	int i;
+
+	if (!clock_check_enabled) {
+		*tv = nano_current_get();
+		*counter = 0;
+
+		return ;
+	}
+
+	for (i = 0; i < CLOCK_PAIR_RETRIES; i++) {
+		counter_before = clock_counter_get();
+		*tv = nano_current_get();
+		counter_after = clock_counter_get();
+
+		if (clock_check_ns_per_tick == 0 ||
+		    (counter_after - counter_before) * clock_check_ns_per_tick <= CLOCK_PAIR_MAX_NS) {
+			break;
+		}
+	}
+
+	*counter = counter_before + (counter_after - counter_before) / 2;
+}
+
+/*
+ * Compare window measured by clock with window measured by counter. Clock going
+ * backwards or jumping makes window length taken from counter (returned in
+ * tv_diff), otherwise tv_diff is clock difference. Window with rate anomaly is only
+ * marked, because counter rate is then not known. Clock rate is compared on spans
+ * of CLOCK_CHECK_RATE_SPAN seconds.
+ */
+static enum clock_anomaly
+clock_check_window(uint64_t tv_prev, uint64_t tv_now, uint64_t counter_prev,
+    uint64_t counter_now, uint64_t *tv_diff)
+{
+	uint64_t counter_diff;
+	uint64_t counter_ns;
+	uint64_t deviation;
+	uint64_t max_deviation;
+	uint64_t rate_counter_ns;
+	enum clock_anomaly res;
+	double span_rate;
+	double rate_dev;
+
+	*tv_diff = (tv_now >= tv_prev ? tv_now - tv_prev : 0);
+
+	/*
+	 * Counter going backwards (unsynchronized counters of CPUs) makes window
+	 * impossible to check
+	 */
+	if (!clock_check_enabled || counter_now <= counter_prev) {
+		return (CLOCK_ANOMALY_NONE);
+	}
+	counter_diff = counter_now - counter_prev;
+
+	if (clock_check_ns_per_tick == 0) {
+		if (clock_check_calib_counter == 0) {
+			clock_check_calib_tv = tv_prev;
+			clock_check_calib_counter = counter_prev;
+		}
+
+		if (tv_now > clock_check_calib_tv + CLOCK_CHECK_CALIBRATION * NO_NS_IN_SEC &&
+		    counter_now > clock_check_calib_counter) {
+			clock_check_ns_per_tick = (double)(tv_now - clock_check_calib_tv) /
+			    (counter_now - clock_check_calib_counter);
+
+			log_printf(LOG_DEBUG, "Clock check calibrated, counter rate is %0.3fMHz",
+			    1000.0 / clock_check_ns_per_tick);
+		}
+
+		if (tv_now < tv_prev) {
+			times_clock_backwards++;
+			log_printf(LOG_WARNING, "CLOCK_MONOTONIC went backwards by %0.4fs",
+			    (double)(tv_prev - tv_now) / NO_NS_IN_SEC);
+
+			return (CLOCK_ANOMALY_BACKWARDS);
+		}
+
+		return (CLOCK_ANOMALY_NONE);
+	}
+
+	counter_ns = (uint64_t)(counter_diff * clock_check_ns_per_tick);
+
+	if (tv_now < tv_prev) {
+		times_clock_backwards++;
+		*tv_diff = counter_ns;
+		log_printf(LOG_WARNING, "CLOCK_MONOTONIC went backwards by %0.4fs, window is %0.4fs "
+		    "by counter", (double)(tv_prev - tv_now) / NO_NS_IN_SEC,
+		    (double)counter_ns / NO_NS_IN_SEC);
+
+		return (CLOCK_ANOMALY_BACKWARDS);
+	}
+
+	res = CLOCK_ANOMALY_NONE;
+	max_deviation = CLOCK_CHECK_JUMP_MIN_US * NO_NS_IN_USEC +
+	    counter_ns * CLOCK_CHECK_RATE_TOLERANCE;
+	deviation = (*tv_diff > counter_ns ? *tv_diff - counter_ns : counter_ns - *tv_diff);
+
+	if (deviation <= max_deviation) {
+		clock_check_window_dev = 0;
+	} else {
+		/*
+		 * Window off by the same rate as previous anomalous window is rate
+		 * anomaly (counter rate changed), not jump
+		 */
+		rate_counter_ns = (uint64_t)(counter_ns * (1 + clock_check_window_dev));
+		if (clock_check_window_dev != 0 &&
+		    (*tv_diff > rate_counter_ns ? *tv_diff - rate_counter_ns :
+		    rate_counter_ns - *tv_diff) <= max_deviation) {
+			res = CLOCK_ANOMALY_RATE;
+		}
+		clock_check_window_dev = (double)*tv_diff / counter_ns - 1;
+
+		if (res != CLOCK_ANOMALY_RATE) {
+			times_clock_jump++;
+			log_printf(LOG_WARNING, "CLOCK_MONOTONIC jumped %s by %0.4fs, window is "
+			    "%0.4fs by counter", (*tv_diff > counter_ns ? "forward" : "backward"),
+			    (double)deviation / NO_NS_IN_SEC, (double)counter_ns / NO_NS_IN_SEC);
+			*tv_diff = counter_ns;
+
+			return (CLOCK_ANOMALY_JUMP);
+		}
+	}
+
+	clock_check_span_tv += *tv_diff;
+	clock_check_span_counter += counter_diff;
+
+	if (clock_check_span_tv >= CLOCK_CHECK_RATE_SPAN * NO_NS_IN_SEC) {
+		span_rate = (double)clock_check_span_tv / clock_check_span_counter;
+		rate_dev = span_rate / clock_check_ns_per_tick - 1;
+
+		if (fabs(rate_dev) > CLOCK_CHECK_RATE_TOLERANCE) {
+			times_clock_rate++;
+			clock_check_rate_spans++;
+			log_printf(LOG_WARNING, "CLOCK_MONOTONIC ran %+0.3f%% off counter rate during "
+			    "last %0.4fs", rate_dev * 100, (double)clock_check_span_tv / NO_NS_IN_SEC);
+
+			if (clock_check_rate_spans >= CLOCK_CHECK_RATE_RECALIBRATE) {
+				log_printf(LOG_WARNING, "Counter rate changed, calibrating clock check "
+				    "again");
+				clock_check_ns_per_tick = 0;
+				clock_check_calib_tv = 0;
+				clock_check_calib_counter = 0;
+				clock_check_window_dev = 0;
+				clock_check_rate_spans = 0;
+			}
+		} else {
+			clock_check_rate_spans = 0;
+
+			/*
+			 * Follow slow drift (NTP frequency adjustment)
+			 */
+			clock_check_ns_per_tick += (span_rate - clock_check_ns_per_tick) *
+			    CLOCK_CHECK_RATE_ALPHA;
+		}
+
+		clock_check_span_tv = 0;
+		clock_check_span_counter = 0;
+	}
+
+	return (res);
+}
+
+static void
+clock_check_statistics_print(void)
+{
+
+	if (!clock_check_enabled) {
+		return ;
+	}
+
+	log_printf(LOG_INFO, "Clock check: %"PRIu64" times went backwards, %"PRIu64" jumps, "
+	    "%"PRIu64" rate anomalies", times_clock_backwards, times_clock_jump,
+	    times_clock_rate);
+}
+
+/*
+ * Hardware performance counters
+ */
+static const char *perf_event_names[SPAUSEDD_SHM_PERF_EVENTS] = {
+	"cycles",
+	"instructions",
+	"LLC misses",
+	"stalled cycles",
+};
+
+static const uint64_t perf_event_configs[SPAUSEDD_SHM_PERF_EVENTS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_STALLED_CYCLES_BACKEND,
+};
+
+static int
+perf_event_open_one(uint64_t config, pid_t pid, int cpu, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = perf_exclude_kernel;
+	attr.exclude_hv = 1;
+
+	if (group_fd == -1) {
+		/*
+		 * Pinned group is never multiplexed so deltas don't need scaling
+		 */
+		attr.disabled = 1;
+		attr.pinned = 1;
+	}
+
+	return (syscall(SYS_perf_event_open, &attr, pid, cpu, group_fd, PERF_FLAG_FD_CLOEXEC));
+}
+
+static void
+perf_group_close(struct perf_group *group)
+{
+	long int page_size;
+	int i;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	for (i = SPAUSEDD_SHM_PERF_EVENTS - 1; i >= 0; i--) {
+		if (group->pages[i] != NULL) {
+			(void)munmap(group->pages[i], page_size);
+			group->pages[i] = NULL;
+		}
+
+		if (group->mask & (1U << i)) {
+			(void)close(group->fds[i]);
+		}
+		group->fds[i] = -1;
+	}
+
+	group->mask = 0;
+	group->count = 0;
+}
+
+/*
+ * Open group of events of pid (0 = own thread) on cpu (-1 = any). Events not
+ * supported by PMU are skipped, only cycles is required. User pages are mapped
+ * when map_pages is set and group is enabled when enable is set. Returns 0 on
+ * success or -1 (with errno set of cycles event) on error.
+ */
+static int
+perf_group_open(struct perf_group *group, pid_t pid, int cpu, int map_pages, int enable)
+{
+	long int page_size;
+	int stored_errno;
+	int fd;
+	int i;
+
+	memset(group, 0, sizeof(*group));
+	for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		group->fds[i] = -1;
+	}
+
+	fd = perf_event_open_one(perf_event_configs[SPAUSEDD_SHM_PERF_CYCLES], pid, cpu, -1);
+	if (fd == -1 && (errno == EACCES || errno == EPERM) && !perf_exclude_kernel) {
+		/*
+		 * perf_event_paranoid may allow only user space events
+		 */
+		perf_exclude_kernel = 1;
+		fd = perf_event_open_one(perf_event_configs[SPAUSEDD_SHM_PERF_CYCLES], pid, cpu,
+		    -1);
+	}
+
+	if (fd == -1) {
+		return (-1);
+	}
+
+	group->fds[SPAUSEDD_SHM_PERF_CYCLES] = fd;
+	group->mask = 1U << SPAUSEDD_SHM_PERF_CYCLES;
+	group->count = 1;
+
+	for (i = SPAUSEDD_SHM_PERF_CYCLES + 1; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		fd = perf_event_open_one(perf_event_configs[i], pid, cpu,
+		    group->fds[SPAUSEDD_SHM_PERF_CYCLES]);
+
+		if (fd == -1 && i == SPAUSEDD_SHM_PERF_STALLED_CYCLES) {
+			/*
+			 * Many PMUs count only one kind of stalls
+			 */
+			fd = perf_event_open_one(PERF_COUNT_HW_STALLED_CYCLES_FRONTEND, pid, cpu,
+			    group->fds[SPAUSEDD_SHM_PERF_CYCLES]);
+		}
+
+		if (fd != -1) {
+			group->fds[i] = fd;
+			group->mask |= 1U << i;
+			group->count++;
+		}
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (map_pages) {
+		page_size = sysconf(_SC_PAGESIZE);
+
+		for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+			if (!(group->mask & (1U << i))) {
+				continue;
+			}
+
+			group->pages[i] = mmap(NULL, page_size, PROT_READ, MAP_SHARED, group->fds[i], 0);
+			if (group->pages[i] == MAP_FAILED) {
+				group->pages[i] = NULL;
+			}
+		}
+	}
+#else
+	(void)page_size;
+	(void)map_pages;
+#endif
+
+	if (enable && ioctl(group->fds[SPAUSEDD_SHM_PERF_CYCLES], PERF_EVENT_IOC_ENABLE,
+	    PERF_IOC_FLAG_GROUP) == -1) {
+		stored_errno = errno;
+		perf_group_close(group);
+		errno = stored_errno;
+
+		return (-1);
+	}
+
+	return (0);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Read counter of own thread event from user page without syscall. Returns -1
+ * if rdpmc is not allowed or event is not currently counting.
+ */
+static int
+perf_page_rdpmc(const volatile struct perf_event_mmap_page *page, uint64_t *value)
+{
+	uint32_t seq;
+	uint32_t index;
+	uint32_t low;
+	uint32_t high;
+	uint64_t count;
+	uint16_t width;
+	int64_t pmc;
+
+	do {
+		seq = page->lock;
+		__asm__ __volatile__("" ::: "memory");
+
+		index = page->index;
+		if (!page->cap_user_rdpmc || index == 0) {
+			return (-1);
+		}
+
+		count = page->offset;
+		width = page->pmc_width;
+
+		__asm__ __volatile__("rdpmc" : "=a" (low), "=d" (high) : "c" (index - 1));
+
+		/*
+		 * Sign extend pmc_width bits wide value
+		 */
+		pmc = (int64_t)(((uint64_t)high << 32 | low) << (64 - width)) >> (64 - width);
+		count += pmc;
+
+		__asm__ __volatile__("" ::: "memory");
+	} while (page->lock != seq);
+
+	*value = count;
+
+	return (0);
+}
+#endif
+
+/*
+ * Read counters of group into values indexed by event. Returns -1 on error
+ * (including pinned group which lost its counters).
+ */
+static int
+perf_group_read(const struct perf_group *group, uint64_t *values)
+{
+	uint64_t buf[1 + SPAUSEDD_SHM_PERF_EVENTS];
+	ssize_t res;
+	int i;
+	int j;
+
+#if defined(__x86_64__) || defined(__i386__)
+	for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		if (!(group->mask & (1U << i))) {
+			values[i] = 0;
+			continue;
+		}
+
+		if (group->pages[i] == NULL || perf_page_rdpmc(group->pages[i], &values[i]) == -1) {
+			break;
+		}
+	}
+
+	if (i == SPAUSEDD_SHM_PERF_EVENTS) {
+		return (0);
+	}
+#endif
+
+	res = read(group->fds[SPAUSEDD_SHM_PERF_CYCLES], buf, sizeof(buf));
+	if (res < (ssize_t)(sizeof(buf[0]) * (1 + group->count)) || buf[0] != (uint64_t)group->count) {
+		return (-1);
+	}
+
+	for (i = 0, j = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		values[i] = ((group->mask & (1U << i)) ? buf[1 + j++] : 0);
+	}
+
+	return (0);
+}
+
+/*
+ * Make group of cpu the only enabled per CPU group. Groups are opened by
+ * perf_cpu_groups_open, so no perf_event_open is called from main loop. Returns
+ * NULL if group of cpu is not available.
+ */
+static struct perf_group *
+perf_cpu_group_activate(int cpu)
+{
+	struct perf_group *group;
+
+	if (!perf_cpu_allowed) {
+		return (NULL);
+	}
+
+	if (cpu == perf_cpu_active) {
+		return (&perf_cpu_groups[cpu]);
+	}
+
+	if (perf_cpu_active != -1) {
+		(void)ioctl(perf_cpu_groups[perf_cpu_active].fds[SPAUSEDD_SHM_PERF_CYCLES],
+		    PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		perf_cpu_active = -1;
+	}
+
+	if (cpu < 0 || cpu >= PERF_MAX_CPUS) {
+		return (NULL);
+	}
+
+	group = &perf_cpu_groups[cpu];
+	if (group->count == 0) {
+		return (NULL);
+	}
+
+	if (ioctl(group->fds[SPAUSEDD_SHM_PERF_CYCLES], PERF_EVENT_IOC_ENABLE,
+	    PERF_IOC_FLAG_GROUP) == -1) {
+		perf_group_close(group);
+
+		return (NULL);
+	}
+	perf_cpu_active = cpu;
+
+	return (group);
+}
+
+/*
+ * Make sure that fds file descriptors can be opened with PERF_FD_RESERVE left
+ * for everything else, raising soft limit when needed. Returns 0 on success or -1
+ * if hard limit is too low.
+ */
+static int
+perf_fd_limit_ensure(rlim_t fds)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1) {
+		return (-1);
+	}
+
+	if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < fds + PERF_FD_RESERVE) {
+		if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < fds + PERF_FD_RESERVE) {
+			return (-1);
+		}
+
+		rl.rlim_cur = fds + PERF_FD_RESERVE;
+		if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Open (disabled) groups for all CPUs spausedd is allowed to run on. Returns
+ * number of opened groups.
+ */
+static int
+perf_cpu_groups_open(void)
+{
+	cpu_set_t cpu_set;
+	int opened;
+	int cpu;
+
+	if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == -1) {
+		log_perror(LOG_DEBUG, "Can't get CPU affinity");
+		return (0);
+	}
+
+	if (perf_fd_limit_ensure((rlim_t)CPU_COUNT(&cpu_set) * SPAUSEDD_SHM_PERF_EVENTS) == -1) {
+		log_printf(LOG_INFO, "Not enough file descriptors to count hardware performance "
+		    "events of %d CPUs, per CPU counters are disabled", CPU_COUNT(&cpu_set));
+		return (0);
+	}
+
+	opened = 0;
+	for (cpu = 0; cpu < PERF_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &cpu_set)) {
+			continue;
+		}
+
+		if (perf_group_open(&perf_cpu_groups[cpu], -1, cpu, 0, 0) == -1) {
+			/*
+			 * Counting of whole CPU needs CAP_PERFMON or perf_event_paranoid <= 0
+			 */
+			if (opened == 0 && (errno == EACCES || errno == EPERM)) {
+				log_perror(LOG_DEBUG, "Can't open per CPU hardware performance "
+				    "counters");
+				break;
+			}
+
+			continue;
+		}
+		opened++;
+	}
+
+	return (opened);
+}
+
+static void
+perf_init(void)
+{
+	char names[128];
+	int rdpmc;
+	int cpus;
+	int i;
+
+	if (!perf_enabled) {
+		return ;
+	}
+
+	if (perf_group_open(&perf_thread_group, 0, -1, 1, 1) == -1) {
+		log_perror(LOG_INFO, "Hardware performance counters are not available, disabled");
+		perf_enabled = 0;
+
+		return ;
+	}
+
+	rdpmc = 1;
+	names[0] = '\0';
+	for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		if (!(perf_thread_group.mask & (1U << i))) {
+			continue;
+		}
+
+		if (perf_thread_group.pages[i] == NULL ||
+		    !perf_thread_group.pages[i]->cap_user_rdpmc) {
+			rdpmc = 0;
+		}
+
+		snprintf(names + strlen(names), sizeof(names) - strlen(names), "%s%s",
+		    (names[0] != '\0' ? ", " : ""), perf_event_names[i]);
+	}
+
+	log_printf(LOG_DEBUG, "Counting %s of %s thread%s, read by %s", names, PROGRAM_NAME,
+	    (perf_exclude_kernel ? " (user space only)" : ""), (rdpmc ? "rdpmc" : "read"));
+
+	cpus = perf_cpu_groups_open();
+	if (cpus > 0) {
+		log_printf(LOG_DEBUG, "Counting hardware performance events of %d CPUs", cpus);
+		perf_cpu_allowed = 1;
+	}
+}
+
+static void
+perf_fini(void)
+{
+	int cpu;
+
+	perf_group_close(&perf_thread_group);
+
+	for (cpu = 0; cpu < PERF_MAX_CPUS; cpu++) {
+		if (perf_cpu_groups[cpu].count > 0) {
+			perf_group_close(&perf_cpu_groups[cpu]);
+		}
+	}
+	perf_cpu_allowed = 0;
+	perf_cpu_active = -1;
+}
+
+static void
+perf_disable(void)
+{
+
+	log_printf(LOG_WARNING, "Can't read hardware performance counters, disabled");
+
+	perf_fini();
+	perf_enabled = 0;
+	perf_window_mask = 0;
+	perf_window_cpu_mask = 0;
+}
+
+/*
+ * Read counters at start of window. cpu is CPU window starts on.
+ */
+static void
+perf_window_begin(int cpu)
+{
+	struct perf_group *group;
+
+	if (!perf_enabled) {
+		return ;
+	}
+
+	perf_window_cpu_id = -1;
+	group = perf_cpu_group_activate(cpu);
+	if (group != NULL) {
+		if (perf_group_read(group, perf_cpu_prev) == 0) {
+			perf_window_cpu_id = cpu;
+		} else {
+			perf_group_close(group);
+			perf_cpu_active = -1;
+		}
+	}
+
+	if (perf_group_read(&perf_thread_group, perf_thread_prev) == -1) {
+		perf_disable();
+	}
+}
+
+/*
+ * Read counters at end of window and compute deltas. pause is set when window
+ * was pause.
+ */
+static void
+perf_window_end(int pause)
+{
+	struct perf_window_stats *stats;
+	uint64_t values[SPAUSEDD_SHM_PERF_EVENTS];
+	int i;
+
+	if (!perf_enabled) {
+		return ;
+	}
+
+	if (perf_group_read(&perf_thread_group, values) == -1) {
+		perf_disable();
+
+		return ;
+	}
+
+	for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		perf_window[i] = values[i] - perf_thread_prev[i];
+	}
+	perf_window_mask = perf_thread_group.mask;
+
+	perf_window_cpu_mask = 0;
+	if (perf_window_cpu_id != -1 &&
+	    perf_group_read(&perf_cpu_groups[perf_window_cpu_id], values) == 0) {
+		for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+			perf_window_cpu[i] = values[i] - perf_cpu_prev[i];
+		}
+		perf_window_cpu_mask = perf_cpu_groups[perf_window_cpu_id].mask;
+	}
+
+	stats = (pause ? &perf_pause_stats : &perf_normal_stats);
+	stats->windows++;
+	for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+		stats->sum[i] += perf_window[i];
+	}
+}
+
+/*
+ * Format counters as "cycles N, instructions N (IPC x), ..."
+ */
+static void
+perf_counters_format(const uint64_t *values, uint32_t mask, char *buf, size_t buf_size)
+{
+	size_t pos;
+	int res;
+	int i;
+
+	pos = 0;
+	buf[0] = '\0';
+
+	for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS && pos < buf_size; i++) {
+		if (!(mask & (1U << i))) {
+			continue;
+		}
+
+		res = snprintf(buf + pos, buf_size - pos, "%s%s %"PRIu64, (pos > 0 ? ", " : ""),
+		    perf_event_names[i], values[i]);
+		pos += (res > 0 ? (size_t)res : 0);
+
+		if (pos >= buf_size || values[SPAUSEDD_SHM_PERF_CYCLES] == 0) {
+			continue;
+		}
+
+		if (i == SPAUSEDD_SHM_PERF_INSTRUCTIONS) {
+			res = snprintf(buf + pos, buf_size - pos, " (IPC %0.2f)",
+			    (double)values[i] / values[SPAUSEDD_SHM_PERF_CYCLES]);
+			pos += (res > 0 ? (size_t)res : 0);
+		} else if (i == SPAUSEDD_SHM_PERF_STALLED_CYCLES) {
+			res = snprintf(buf + pos, buf_size - pos, " (%0.1f%%)",
+			    (double)values[i] / values[SPAUSEDD_SHM_PERF_CYCLES] * 100);
+			pos += (res > 0 ? (size_t)res : 0);
+		}
+	}
+}
+
+/*
+ * Log counters of pause window. Thread using much more cycles than in average
+ * window was running slowly (low IPC, cache thrashing) rather than not running.
+ */
+static void
+perf_pause_report(void)
+{
+	char buf[256];
+	double cycles_avg;
+	double cycles_ratio;
+
+	if (perf_window_mask == 0) {
+		return ;
+	}
+
+	perf_counters_format(perf_window, perf_window_mask, buf, sizeof(buf));
+	log_printf(LOG_INFO, "Hardware counters of %s thread during pause: %s", PROGRAM_NAME, buf);
+
+	if (perf_window_cpu_mask != 0) {
+		perf_counters_format(perf_window_cpu, perf_window_cpu_mask, buf, sizeof(buf));
+		log_printf(LOG_INFO, "Hardware counters of CPU %d during pause: %s", perf_window_cpu_id,
+		    buf);
+	}
+
+	if (perf_normal_stats.windows == 0) {
+		return ;
+	}
+
+	cycles_avg = (double)perf_normal_stats.sum[SPAUSEDD_SHM_PERF_CYCLES] /
+	    perf_normal_stats.windows;
+	if (cycles_avg == 0) {
+		return ;
+	}
+
+	cycles_ratio = perf_window[SPAUSEDD_SHM_PERF_CYCLES] / cycles_avg;
+	if (cycles_ratio > PERF_SLOW_CYCLES_RATIO) {
+		log_printf(LOG_WARNING, "%s thread used %0.1fx cycles of average window, it was "
+		    "running slowly rather than not running", PROGRAM_NAME, cycles_ratio);
+	} else {
+		log_printf(LOG_INFO, "%s thread used %0.1fx cycles of average window, it was not "
+		    "running", PROGRAM_NAME, cycles_ratio);
+	}
+}
+
+static void
+perf_statistics_print(void)
+{
+	uint64_t avg[SPAUSEDD_SHM_PERF_EVENTS];
+	const struct perf_window_stats *stats;
+	char buf[256];
+	int pause;
+	int i;
+
+	if (!perf_enabled) {
+		return ;
+	}
+
+	for (pause = 0; pause <= 1; pause++) {
+		stats = (pause ? &perf_pause_stats : &perf_normal_stats);
+		if (stats->windows == 0) {
+			continue;
+		}
+
+		for (i = 0; i < SPAUSEDD_SHM_PERF_EVENTS; i++) {
+			avg[i] = stats->sum[i] / stats->windows;
+		}
+
+		perf_counters_format(avg, perf_thread_group.mask, buf, sizeof(buf));
+		log_printf(LOG_INFO, "Average hardware counters of %s thread in %s: %s",
+		    PROGRAM_NAME, (pause ? "pauses" : "windows without pause"), buf);
+	}
+}
+
+/*
+ * Cgroup v2 memory.events watch
+ */
+
+/*
+ * Get value of key from flat keyed file content ("key value" lines)
+ */
+static uint64_t
+utils_flat_keyed_get(const char *buf, const char *key)
+{
+	const char *line;
+	size_t key_len;
+
+	key_len = strlen(key);
+
+	for (line = buf; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+		if (*line == '\n') {
+			line++;
+		}
+
+		if (strncmp(line, key, key_len) == 0 && line[key_len] == ' ') {
+			return (strtoull(line + key_len + 1, NULL, 10));
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Read memory.events (and memory.stat when events changed) and add increments
+ * to window counters. Returns 1 if memory.events changed.
+ */
+static int
+memory_watch_update(struct memory_watch *watch)
+{
+	char buf[1024];
+	char stat_buf[8192];
+	char fname[PATH_MAX];
+	uint64_t high, max, oom, pgscan;
+	int fd;
+
+	if (utils_proc_file_pread(watch->events_fd, buf, sizeof(buf)) <= 0) {
+		return (0);
+	}
+
+	high = utils_flat_keyed_get(buf, "high");
+	max = utils_flat_keyed_get(buf, "max");
+	oom = utils_flat_keyed_get(buf, "oom");
+
+	if (high == watch->high && max == watch->max && oom == watch->oom) {
+		return (0);
+	}
+
+	/*
+	 * Counters are monotonic, but ignore decrease caused by partial read
+	 */
+	watch->window_high += (high > watch->high ? high - watch->high : 0);
+	watch->window_max += (max > watch->max ? max - watch->max : 0);
+	watch->window_oom += (oom > watch->oom ? oom - watch->oom : 0);
+	watch->high = high;
+	watch->max = max;
+	watch->oom = oom;
+
+	/*
+	 * Reclaim counters are read only when limits were hit
+	 */
+	pgscan = watch->pgscan;
+
+	if (cgroup_file_name_get(fname, watch->dir, "", 0, "memory.stat") == 0) {
+		fd = open(fname, O_RDONLY | O_CLOEXEC);
+		if (fd != -1) {
+			if (utils_proc_file_pread(fd, stat_buf, sizeof(stat_buf)) > 0) {
+				pgscan = utils_flat_keyed_get(stat_buf, "pgscan");
+			}
+			(void)close(fd);
+		}
+	}
+
+	watch->window_pgscan += (pgscan > watch->pgscan ? pgscan - watch->pgscan : 0);
+	watch->pgscan = pgscan;
+
+	log_printf(LOG_DEBUG, "memory.events of %s changed: high = %"PRIu64", max = %"PRIu64
+	    ", oom = %"PRIu64", pgscan = %"PRIu64, watch->dir, high, max, oom, pgscan);
+
+	return (1);
+}
+
+static void
+memory_watch_add(const char *dir)
+{
+	struct memory_watch *watch;
+	char fname[PATH_MAX];
+
+	if (memory_watch_count >= MEMORY_WATCH_MAX) {
+		log_printf(LOG_WARNING, "Too many watched cgroups, ignoring %s", dir);
+		return ;
+	}
+
+	watch = &memory_watches[memory_watch_count];
+	memset(watch, 0, sizeof(*watch));
+	snprintf(watch->dir, sizeof(watch->dir), "%s", dir);
+
+	if (cgroup_file_name_get(fname, dir, "", 0, "memory.events") == -1) {
+		log_printf(LOG_WARNING, "Cgroup path %s is too long", dir);
+		return ;
+	}
+
+	watch->events_fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (watch->events_fd == -1) {
+		log_printf(LOG_DEBUG, "Can't open %s -> cgroup without memory controller", fname);
+		return ;
+	}
+
+	watch->wd = inotify_add_watch(memory_inotify_fd, fname, IN_MODIFY);
+	if (watch->wd == -1) {
+		log_perror(LOG_WARNING, "Can't add inotify watch for memory.events");
+		(void)close(watch->events_fd);
+		return ;
+	}
+
+	(void)memory_watch_update(watch);
+	watch->window_high = watch->window_max = watch->window_oom = watch->window_pgscan = 0;
+
+	log_printf(LOG_INFO, "Watching memory throttling of cgroup %s", dir);
+
+	memory_watch_count++;
+}
+
+static void
+memory_watch_init(void)
+{
+	char dir[PATH_MAX];
+	int i;
+
+	if (cgroup_v2_mount[0] == '\0') {
+		log_printf(LOG_DEBUG, "cgroup v2 not mounted, memory throttling is not watched");
+		return ;
+	}
+
+	memory_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (memory_inotify_fd == -1) {
+		log_perror(LOG_WARNING, "Can't initialize inotify");
+		return ;
+	}
+
+	if (cgroup_file_name_get(dir, cgroup_v2_mount, cgroup_v2_path, strlen(cgroup_v2_path),
+	    "") == 0) {
+		dir[strlen(dir) - 1] = '\0';
+		memory_watch_add(dir);
+	}
+
+	for (i = 0; i < memory_watch_dirs_count; i++) {
+		if (cgroup_v2_dir_get(memory_watch_dirs[i], "memory.events", dir) == 0) {
+			memory_watch_add(dir);
+		}
+	}
+
+	if (memory_watch_count == 0) {
+		(void)close(memory_inotify_fd);
+		memory_inotify_fd = -1;
+	}
+}
+
+static void
+memory_watch_fini(void)
+{
+	int i;
+
+	for (i = 0; i < memory_watch_count; i++) {
+		(void)close(memory_watches[i].events_fd);
+	}
+	memory_watch_count = 0;
+
+	if (memory_inotify_fd != -1) {
+		(void)close(memory_inotify_fd);
+		memory_inotify_fd = -1;
+	}
+}
+
+static void
+memory_watch_window_reset(void)
+{
+	int i;
+
+	for (i = 0; i < memory_watch_count; i++) {
+		memory_watches[i].window_high = 0;
+		memory_watches[i].window_max = 0;
+		memory_watches[i].window_oom = 0;
+		memory_watches[i].window_pgscan = 0;
+	}
+}
+
+/*
+ * Drain inotify events and update changed watches
+ */
+static void
+memory_watch_dispatch(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t len;
+	char *ptr;
+	int i;
+
+	while ((len = read(memory_inotify_fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+
+			for (i = 0; i < memory_watch_count; i++) {
+				if (memory_watches[i].wd == event->wd) {
+					(void)memory_watch_update(&memory_watches[i]);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Report memory throttling which happened during pause window. Returns 1 if
+ * some watched cgroup was throttled.
+ */
+static int
+memory_watch_pause_report(void)
+{
+	struct memory_watch *watch;
+	int throttled;
+	int i;
+
+	throttled = 0;
+
+	for (i = 0; i < memory_watch_count; i++) {
+		watch = &memory_watches[i];
+
+		if (watch->window_high == 0 && watch->window_max == 0 && watch->window_oom == 0) {
+			continue;
+		}
+
+		log_printf(LOG_WARNING, "Cgroup %s hit memory.high %"PRIu64"x, memory.max %"PRIu64
+		    "x, oom %"PRIu64"x (%"PRIu64" pages scanned), pause is probably caused by "
+		    "memory throttling", watch->dir, watch->window_high, watch->window_max,
+		    watch->window_oom, watch->window_pgscan);
+
+		throttled = 1;
+	}
+
+	return (throttled);
+}
+
+/*
+ * Sleep until deadline (CLOCK_MONOTONIC ns) while handling memory.events
+ * notifications. Returns -1 on error (with errno set), otherwise 0.
+ */
+static int
+memory_watch_poll(uint64_t deadline)
+{
+	struct pollfd pfd;
+	struct timespec ts;
+	uint64_t now;
+	uint64_t remaining;
+	int res;
+
+	pfd.fd = memory_inotify_fd;
+	pfd.events = POLLIN;
+
+	do {
+		now = nano_current_get();
+		remaining = (deadline > now ? deadline - now : 0);
+		ts.tv_sec = remaining / NO_NS_IN_SEC;
+		ts.tv_nsec = remaining % NO_NS_IN_SEC;
+
+		pfd.revents = 0;
+		res = ppoll(&pfd, 1, &ts, NULL);
+		if (res > 0) {
+			memory_watch_dispatch();
+		}
+	} while (res > 0 && !stop_main_loop);
+
+	return (res == -1 ? -1 : 0);
+}
+
+/*
+ * VMGuestlib
+ */
+static void
+guestlib_init(void)
+{
+#ifdef HAVE_VMGUESTLIB
+/* vSphere SDKの場合 */
+	VMGuestLibError gl_err;
+
+	/*
+他のvSphereGuestAPI関数で使用するためのハンドルを取得します。ゲストライブラリハンドルは、仮想マシンに関する情報にアクセスするためのコンテキストを提供します。仮想マシンの統計と状態データは特定のゲストライブラリハンドルに関連付けられているため、1つのハンドルを使用しても、別のハンドルに関連付けられているデータには影響しません。
+	*/
+	gl_err = VMGuestLib_OpenHandle(&guestlib_handle);
+	if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
+		log_printf(LOG_DEBUG, "Can't open guestlib handle: %s", VMGuestLib_GetErrorText(gl_err));
+		return ;
+	}
+
+	log_printf(LOG_INFO, "Using VMGuestLib");
+
+	use_vmguestlib_stealtime = 1;
+
+	if (!max_steal_threshold_user_set) {
+//オプションなし時のデフォルト閾値:100
+		max_steal_threshold = DEFAULT_MAX_STEAL_THRESHOLD_GL;
+	}
+#endif
+}
+
+static void
+guestlib_fini(void)
+{
+#ifdef HAVE_VMGUESTLIB
+	VMGuestLibError gl_err;
+
+	if (use_vmguestlib_stealtime) {
+		/*
+			VMGuestLib_OpenHandleで取得したハンドルを解放します。
+		*/
+		gl_err = VMGuestLib_CloseHandle(guestlib_handle);
+
+		if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
+			log_printf(LOG_DEBUG, "Can't close guestlib handle: %s", VMGuestLib_GetErrorText(gl_err));
+		}
+	}
+#endif
+}
+
+/*
+ * Steal estimation
+ */
+static void
+steal_estimator_init(void)
+{
+
+	steal_clock_tick = sysconf(_SC_CLK_TCK);
+	if (steal_clock_tick <= 0) {
+		steal_clock_tick = 100;
+	}
+
+	steal_resolution = NO_NS_IN_SEC / steal_clock_tick;
+#ifdef HAVE_VMGUESTLIB
+	if (use_vmguestlib_stealtime) {
+		steal_resolution = NO_NS_IN_MSEC;
+	}
+#endif
+
+	steal_readings_count = 0;
+	steal_readings_next = 0;
+
+	log_printf(LOG_DEBUG, "Steal time resolution is %0.4fs", (double)steal_resolution / NO_NS_IN_SEC);
+}
+
+/*
+ * Compute steal percent of elapsed time together with 95% confidence interval
+ * given by counter quantization
+ */
+static void
+steal_estimate_get(uint64_t steal, uint64_t elapsed, struct steal_estimate *est)
+{
+	double half_width;
+
+	memset(est, 0, sizeof(*est));
+	est->elapsed = elapsed;
+	est->steal = steal;
+
+	if (elapsed == 0) {
+		return ;
+	}
+
+	est->perc = ((double)steal / elapsed) * (double)100;
+	half_width = ((double)steal_resolution * STEAL_CI95_FACTOR / elapsed) * (double)100;
+
+	est->perc_low = est->perc - half_width;
+	if (est->perc_low < 0) {
+		est->perc_low = 0;
+	}
+	est->perc_high = est->perc + half_width;
+}
+
+static void
+steal_reading_add(uint64_t tv, uint64_t steal)
+{
+
+	steal_readings[steal_readings_next].tv = tv;
+	steal_readings[steal_readings_next].steal = steal;
+
+	steal_readings_next = (steal_readings_next + 1) % STEAL_READINGS_MAX;
+	if (steal_readings_count < STEAL_READINGS_MAX) {
+		steal_readings_count++;
+	}
+}
+
+/*
+ * Estimate steal over the shortest span of recent windows which is at least
+ * STEAL_SPAN_MIN_UNITS resolution units long. Span is taken between two counter
+ * readings so quantization error doesn't accumulate over windows. Returns -1
+ * if readings don't cover such span yet.
+ */
+static int
+steal_span_estimate_get(struct steal_estimate *est)
+{
+	const struct steal_reading *newest;
+	const struct steal_reading *reading;
+	unsigned int i;
+
+	if (steal_readings_count < 2) {
+		return (-1);
+	}
+
+	newest = &steal_readings[(steal_readings_next + STEAL_READINGS_MAX - 1) % STEAL_READINGS_MAX];
+
+	for (i = 2; i <= steal_readings_count; i++) {
+		reading = &steal_readings[(steal_readings_next + STEAL_READINGS_MAX - i) %
+		    STEAL_READINGS_MAX];
+
+		if (newest->tv - reading->tv >= steal_resolution * STEAL_SPAN_MIN_UNITS) {
+			steal_estimate_get(newest->steal - reading->steal, newest->tv - reading->tv,
+			    est);
+
+			return (0);
+		}
+	}
+
+	return (-1);
+}
+
+/*
+ * Decide if steal during pause window is over max_steal_threshold. Decision is
+ * certain when whole confidence interval is on one side of threshold, otherwise
+ * point estimate is used and uncertain is set.
+ */
+static int
+steal_threshold_exceeded(const struct steal_estimate *est, int *uncertain)
+{
+
+	*uncertain = 0;
+
+	if (est->perc_low > max_steal_threshold) {
+		return (1);
+	}
+
+	if (est->perc_high <= max_steal_threshold) {
+		return (0);
+	}
+
+	*uncertain = 1;
+
+	return (est->perc > max_steal_threshold);
+}
+
+/*
+ * Log when span estimate starts or stops being significantly over threshold.
+ * Short windows alone can't tell this because of counter quantization.
+ */
+static void
+steal_sustained_check(void)
+{
+	struct steal_estimate est;
+
+	if (steal_span_estimate_get(&est) == -1) {
+		return ;
+	}
+
+	if (!steal_sustained && est.perc_low > max_steal_threshold) {
+		steal_sustained = 1;
+
+		log_printf(LOG_WARNING, "Steal time during last %0.4fs is %0.2f%% (95%% CI %0.2f-%0.2f%%), "
+		    "which is > %0.1f%%, this is usually because of overloaded host machine",
+		    (double)est.elapsed / NO_NS_IN_SEC, est.perc, est.perc_low, est.perc_high,
+		    max_steal_threshold);
+	} else if (steal_sustained && est.perc_high <= max_steal_threshold) {
+		steal_sustained = 0;
+
+		log_printf(LOG_INFO, "Steal time during last %0.4fs is %0.2f%% (95%% CI %0.2f-%0.2f%%), "
+		    "back under %0.1f%%", (double)est.elapsed / NO_NS_IN_SEC, est.perc,
+		    est.perc_low, est.perc_high, max_steal_threshold);
+	}
+}
+
+/*
+ * Lateness histogram
+ */
+static unsigned int
+lateness_histogram_bucket(uint64_t lateness_ns)
+{
+	uint64_t lateness_us;
+	unsigned int bucket;
+
+	lateness_us = lateness_ns / NO_NS_IN_USEC;
+	if (lateness_us == 0) {
+		return (0);
+	}
+
+	bucket = 64 - __builtin_clzll(lateness_us);
+	if (bucket >= LATENESS_HISTOGRAM_BUCKETS) {
+		bucket = LATENESS_HISTOGRAM_BUCKETS - 1;
+	}
+
+	return (bucket);
+}
+
+static void
+lateness_histogram_add(uint64_t lateness_ns)
+{
+
+	lateness_histogram[lateness_histogram_bucket(lateness_ns)]++;
+	lateness_sum += lateness_ns;
+	if (lateness_ns > lateness_max) {
+		lateness_max = lateness_ns;
+	}
+}
+
+static uint64_t
+lateness_histogram_total(const uint64_t *histogram)
+{
+	uint64_t total;
+	unsigned int i;
+
+	total = 0;
+	for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+		total += histogram[i];
+	}
+
+	return (total);
+}
+
+/*
+ * Return upper bound (in us) of bucket containing given percentile. Last bucket
+ * has no upper bound so max_us is returned. Result is also limited by max_us
+ * (if not 0).
+ */
+static uint64_t
+lateness_histogram_percentile(const uint64_t *histogram, double percentile, uint64_t max_us)
+{
+	uint64_t total;
+	uint64_t cumulative;
+	uint64_t rank;
+	unsigned int i;
+
+	total = lateness_histogram_total(histogram);
+	if (total == 0) {
+		return (0);
+	}
+
+	rank = (uint64_t)ceil(total * percentile / 100.0);
+	if (rank == 0) {
+		rank = 1;
+	}
+
+	cumulative = 0;
+	for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS - 1; i++) {
+		cumulative += histogram[i];
+		if (cumulative >= rank) {
+			if (max_us != 0 && max_us < ((uint64_t)1 << i)) {
+				return (max_us);
+			}
+
+			return ((uint64_t)1 << i);
+		}
+	}
+
+	return (max_us);
+}
+
+/*
+ * Print histogram as list of "upper_bound_us:count" pairs (only non-empty buckets
+ * are printed, last bucket has upper bound inf). source (of source_type) is set
+ * for histograms other than main one (probes in target cgroups, wakeup mechanisms).
+ */
+static void
+lateness_histogram_format(const uint64_t *histogram, char *buf, size_t buf_size)
+{
+	size_t pos;
+	unsigned int i;
+	int res;
+
+	pos = 0;
+	buf[0] = '\0';
+
+	for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+		if (histogram[i] == 0) {
+			continue;
+		}
+
+		if (i == LATENESS_HISTOGRAM_BUCKETS - 1) {
+			res = snprintf(buf + pos, buf_size - pos, " inf:%"PRIu64, histogram[i]);
+		} else {
+			res = snprintf(buf + pos, buf_size - pos, " %"PRIu64":%"PRIu64,
+			    (uint64_t)1 << i, histogram[i]);
+		}
+
+		if (res < 0 || (size_t)res >= buf_size - pos) {
+			break;
+		}
+		pos += res;
+	}
+}
+
+static void
+lateness_histogram_print(const char *source_type, const char *source,
+    const uint64_t *histogram)
+{
+	char buf[LATENESS_HISTOGRAM_BUCKETS * 32];
+
+	lateness_histogram_format(histogram, buf, sizeof(buf));
+
+	if (source != NULL) {
+		log_printf(LOG_INFO, "Lateness histogram of %s %s (us):%s", source_type, source,
+		    (buf[0] != '\0' ? buf : " empty"));
+	} else {
+		log_printf(LOG_INFO, "Lateness histogram (us):%s", (buf[0] != '\0' ? buf : " empty"));
+	}
+}
+
+/*
+ * cpuidle
+ */
+static void
+cpuidle_init(void)
+{
+	char fname[PATH_MAX];
+	char buf[sizeof(cpuidle_stats[0].name)];
+	int state;
+
+	for (state = 0; state < CPUIDLE_MAX_STATES; state++) {
+		cpuidle_usage_fds[state] = -1;
+	}
+
+	memset(cpuidle_stats, 0, sizeof(cpuidle_stats));
+	snprintf(cpuidle_stats[0].name, sizeof(cpuidle_stats[0].name), "none");
+
+	/*
+	 * State names and exit latencies are taken from CPU 0
+	 */
+	for (state = 0; state < CPUIDLE_MAX_STATES; state++) {
+		snprintf(fname, sizeof(fname), "/sys/devices/system/cpu/cpu0/cpuidle/state%d/name",
+		    state);
+		utils_file_first_line_get(fname, buf, sizeof(buf));
+		if (buf[0] == '\0') {
+			break;
+		}
+		snprintf(cpuidle_stats[state + 1].name, sizeof(cpuidle_stats[state + 1].name), "%s",
+		    buf);
+
+		snprintf(fname, sizeof(fname), "/sys/devices/system/cpu/cpu0/cpuidle/state%d/latency",
+		    state);
+		utils_file_first_line_get(fname, buf, sizeof(buf));
+		cpuidle_stats[state + 1].exit_latency_us = strtoull(buf, NULL, 10);
+	}
+
+	cpuidle_state_count = state;
+
+	if (cpuidle_state_count == 0) {
+		log_printf(LOG_DEBUG, "cpuidle not available, idle states are not tracked");
+	} else {
+		log_printf(LOG_DEBUG, "Tracking %d cpuidle states", cpuidle_state_count);
+	}
+}
+
+static void
+cpuidle_fini(void)
+{
+	int state;
+
+	for (state = 0; state < cpuidle_state_count; state++) {
+		if (cpuidle_usage_fds[state] != -1) {
+			(void)close(cpuidle_usage_fds[state]);
+			cpuidle_usage_fds[state] = -1;
+		}
+	}
+	cpuidle_usage_cpu = -1;
+}
+
+/*
+ * Get usage counters of all idle states of cpu. Returns -1 if not available.
+ */
+static int
+cpuidle_usage_get(int cpu, uint64_t *usage)
+{
+	char fname[PATH_MAX];
+	char buf[32];
+	int state;
+
+	if (cpuidle_state_count == 0 || cpu < 0) {
+		return (-1);
+	}
+
+	if (cpu != cpuidle_usage_cpu) {
+		cpuidle_fini();
+		cpuidle_usage_cpu = cpu;
+	}
+
+	for (state = 0; state < cpuidle_state_count; state++) {
+		if (cpuidle_usage_fds[state] == -1) {
+			snprintf(fname, sizeof(fname),
+			    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/usage", cpu, state);
+
+			cpuidle_usage_fds[state] = open(fname, O_RDONLY | O_CLOEXEC);
+			if (cpuidle_usage_fds[state] == -1) {
+				return (-1);
+			}
+		}
+
+		if (utils_proc_file_pread(cpuidle_usage_fds[state], buf, sizeof(buf)) <= 0) {
+			return (-1);
+		}
+
+		usage[state] = strtoull(buf, NULL, 10);
+	}
+
+	return (0);
+}
+
+/*
+ * Add lateness of window to deepest idle state entered during window
+ */
+static void
+cpuidle_window_add(const uint64_t *usage_prev, const uint64_t *usage_now, uint64_t lateness)
+{
+	struct cpuidle_state_stats *stats;
+	int state;
+	int deepest;
+
+	deepest = -1;
+	for (state = 0; state < cpuidle_state_count; state++) {
+		if (usage_now[state] > usage_prev[state]) {
+			deepest = state;
+		}
+	}
+
+	stats = &cpuidle_stats[deepest + 1];
+	stats->windows++;
+	stats->lateness_sum += lateness;
+	if (lateness > stats->lateness_max) {
+		stats->lateness_max = lateness;
+	}
+}
+
+static void
+cpuidle_statistics_print(void)
+{
+	const struct cpuidle_state_stats *stats;
+	int i;
+
+	for (i = 0; i <= cpuidle_state_count; i++) {
+		stats = &cpuidle_stats[i];
+
+		if (stats->windows == 0) {
+			continue;
+		}
+
+		log_printf(LOG_INFO, "Idle state %s (exit latency %"PRIu64"us): %"PRIu64" windows, "
+		    "mean lateness %0.1fus, max lateness %0.1fus", stats->name,
+		    stats->exit_latency_us, stats->windows,
+		    (double)stats->lateness_sum / stats->windows / NO_NS_IN_USEC,
+		    (double)stats->lateness_max / NO_NS_IN_USEC);
+	}
+}
+
+/*
+ * Hold PM QoS request for zero CPU wakeup latency (prevents deep idle states)
+ * as long as /dev/cpu_dma_latency is open
+ */
+static void
+pm_qos_hold(void)
+{
+	int32_t latency;
+
+	pm_qos_fd = open("/dev/cpu_dma_latency", O_WRONLY | O_CLOEXEC);
+	if (pm_qos_fd == -1) {
+		log_perror(LOG_WARNING, "Can't open /dev/cpu_dma_latency");
+		return ;
+	}
+
+	latency = 0;
+	if (write(pm_qos_fd, &latency, sizeof(latency)) != sizeof(latency)) {
+		log_perror(LOG_WARNING, "Can't write PM QoS request");
+		(void)close(pm_qos_fd);
+		pm_qos_fd = -1;
+		return ;
+	}
+
+	log_printf(LOG_INFO, "Holding PM QoS CPU latency request of 0us");
+}
+
+static void
+pm_qos_release(void)
+{
+
+	if (pm_qos_fd != -1) {
+		(void)close(pm_qos_fd);
+		pm_qos_fd = -1;
+	}
+}
+
+/*
+ * Probes in target cgroups
+ */
+
+/*
+ * Main loop of probe process. Probe runs with SCHED_OTHER policy, so it is
+ * affected by CPU limits of its cgroup same way as workload.
+ */
+static void
+probe_child_run(struct probe_shared *shared, uint64_t timeout)
+{
+	struct sched_param param;
+	uint64_t tv_prev;
+	uint64_t tv_diff;
+	uint64_t tv_max_allowed_diff;
+	uint64_t tv_requested;
+	uint64_t lateness;
+	uint64_t head;
+	int poll_timeout;
+
+	(void)prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+	memset(&param, 0, sizeof(param));
+	(void)sched_setscheduler(0, SCHED_OTHER, &param);
+
+	tv_max_allowed_diff = timeout * NO_NS_IN_MSEC;
+	poll_timeout = timeout / 3;
+	tv_requested = (uint64_t)poll_timeout * NO_NS_IN_MSEC;
+
+	while (!stop_main_loop) {
+		tv_prev = nano_current_get();
+
+		if (poll(NULL, 0, poll_timeout) == -1 && errno != EINTR) {
+			_exit(2);
+		}
+
+		tv_diff = nano_current_get() - tv_prev;
+		lateness = (tv_diff > tv_requested ? tv_diff - tv_requested : 0);
+
+		__atomic_add_fetch(&shared->lateness_histogram[lateness_histogram_bucket(lateness)], 1,
+		    __ATOMIC_RELAXED);
+		__atomic_add_fetch(&shared->samples, 1, __ATOMIC_RELAXED);
+
+		if (tv_diff > tv_max_allowed_diff) {
+			__atomic_add_fetch(&shared->times_not_scheduled, 1, __ATOMIC_RELAXED);
+
+			head = __atomic_load_n(&shared->events_head, __ATOMIC_RELAXED);
+			if (head - __atomic_load_n(&shared->events_tail, __ATOMIC_ACQUIRE) >=
+			    PROBE_EVENT_RING_SIZE) {
+				__atomic_add_fetch(&shared->events_overflow, 1, __ATOMIC_RELAXED);
+			} else {
+				shared->events[head % PROBE_EVENT_RING_SIZE].start = tv_prev;
+				shared->events[head % PROBE_EVENT_RING_SIZE].duration = tv_diff;
+				__atomic_store_n(&shared->events_head, head + 1, __ATOMIC_RELEASE);
+			}
+		}
+	}
+
+	_exit(0);
+}
+
+/*
+ * Create probe process directly in cgroup using clone3 with CLONE_INTO_CGROUP.
+ * If not supported, process is forked and moved to cgroup. Child reports result
+ * of move through pipe, so parent returns -1 (with errno set) when child
+ * couldn't be moved.
+ */
+static pid_t
+probe_spawn(const char *cgroup_dir)
+{
+	char fname[PATH_MAX];
+	FILE *f;
+	pid_t pid;
+	int pipe_fds[2];
+	int res;
+#ifdef SYS_clone3
+	struct spausedd_clone_args args;
+	int cgroup_fd;
+
+	cgroup_fd = open(cgroup_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cgroup_fd != -1) {
+		memset(&args, 0, sizeof(args));
+		args.flags = SPAUSEDD_CLONE_INTO_CGROUP;
+		args.exit_signal = SIGCHLD;
+		args.cgroup = cgroup_fd;
+
+		pid = syscall(SYS_clone3, &args, sizeof(args));
+		(void)close(cgroup_fd);
+
+		if (pid != -1) {
+			return (pid);
+		}
+
+		log_printf(LOG_DEBUG, "clone3 into cgroup %s failed (%s), using fork", cgroup_dir,
+		    strerror(errno));
+	}
+#endif
+
+	if (cgroup_file_name_get(fname, cgroup_dir, "", 0, "cgroup.procs") == -1) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+
+	if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+		return (-1);
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		res = errno;
+		(void)close(pipe_fds[0]);
+		(void)close(pipe_fds[1]);
+		errno = res;
+
+		return (-1);
+	}
+
+	if (pid > 0) {
+		(void)close(pipe_fds[1]);
+
+		if (read(pipe_fds[0], &res, sizeof(res)) != sizeof(res)) {
+			res = ECHILD;
+		}
+		(void)close(pipe_fds[0]);
+
+		if (res != 0) {
+			(void)waitpid(pid, NULL, 0);
+			errno = res;
+
+			return (-1);
+		}
+
+		return (pid);
+	}
+
+	(void)close(pipe_fds[0]);
+
+	res = 0;
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		res = errno;
+	} else if (fprintf(f, "%jd\n", (intmax_t)getpid()) <= 0) {
+		res = (errno != 0 ? errno : EIO);
+		(void)fclose(f);
+	} else if (fclose(f) != 0) {
+		res = errno;
+	}
+
+	if (write(pipe_fds[1], &res, sizeof(res)) != sizeof(res) || res != 0) {
+		_exit(1);
+	}
+	(void)close(pipe_fds[1]);
+
+	return (0);
+}
+
+static void
+probes_start(uint64_t timeout)
+{
+	struct probe *probe;
+	int i;
+
+	if (probe_cgroups_count == 0) {
+		return ;
+	}
+
+	probe_timeout = timeout;
+
+	if (probes_shared == NULL) {
+		probes_shared = mmap(NULL, sizeof(*probes_shared) * PROBE_MAX,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (probes_shared == MAP_FAILED) {
+			log_perror(LOG_WARNING, "Can't allocate shared memory for probes");
+			probes_shared = NULL;
+			return ;
+		}
+	}
+
+	probe_count = 0;
+
+	for (i = 0; i < probe_cgroups_count; i++) {
+		probe = &probes[probe_count];
+		memset(probe, 0, sizeof(*probe));
+
+		if (cgroup_v2_mount[0] == '\0' ||
+		    cgroup_v2_dir_get(probe_cgroups[i], "cgroup.procs", probe->cgroup_dir) == -1) {
+			log_printf(LOG_WARNING, "Can't find cgroup v2 %s, probe not started",
+			    probe_cgroups[i]);
+			continue;
+		}
+
+		probe->shared = &probes_shared[probe_count];
+		probe->events_overflow_seen = __atomic_load_n(&probe->shared->events_overflow,
+		    __ATOMIC_RELAXED);
+
+		probe->pid = probe_spawn(probe->cgroup_dir);
+		if (probe->pid == -1) {
+			log_perror(LOG_WARNING, "Can't create probe process");
+			continue;
+		}
+
+		if (probe->pid == 0) {
+			probe_child_run(probe->shared, timeout);
+		}
+
+		log_printf(LOG_INFO, "Started probe %jd in cgroup %s", (intmax_t)probe->pid,
+		    probe->cgroup_dir);
+
+		probe_count++;
+	}
+}
+
+/*
+ * Return ring of probe i (PROBE_MAIN is main loop)
+ */
+static struct probe_shared *
+probe_shared_get(int i)
+{
+
+	return (i == PROBE_MAIN ? &probe_main_shared : probes[i].shared);
+}
+
+/*
+ * Add pause of main loop into merge with probe pauses. Main loop is the only
+ * writer and reader of its ring.
+ */
+static void
+probe_main_event_add(uint64_t start, uint64_t duration)
+{
+	struct probe_shared *shared;
+
+	if (probe_count == 0) {
+		return ;
+	}
+
+	shared = &probe_main_shared;
+	if (shared->events_head - shared->events_tail >= PROBE_EVENT_RING_SIZE) {
+		shared->events_overflow++;
+		return ;
+	}
+
+	shared->events[shared->events_head % PROBE_EVENT_RING_SIZE].start = start;
+	shared->events[shared->events_head % PROBE_EVENT_RING_SIZE].duration = duration;
+	shared->events_head++;
+}
+
+/*
+ * Log merged pause of one or more probes. Pause of main loop alone is not logged
+ * again.
+ */
+static void
+probe_event_group_report(const struct probe_event_group *group)
+{
+	struct timespec rt_start;
+	char cgroups[512];
+	size_t pos;
+	int res;
+	int i;
+	int count;
+
+	if (group->probes == (1U << PROBE_MAIN)) {
+		return ;
+	}
+
+	realtime_ago_get(nano_current_get() - group->start, &rt_start);
+
+	pos = 0;
+	cgroups[0] = '\0';
+	count = 0;
+
+	if (group->probes & (1U << PROBE_MAIN)) {
+		count++;
+		res = snprintf(cgroups, sizeof(cgroups), "main (RR)");
+		pos += (res > 0 ? (size_t)res : 0);
+	}
+
+	for (i = 0; i < probe_count; i++) {
+		if (!(group->probes & (1U << i))) {
+			continue;
+		}
+
+		count++;
+
+		if (pos < sizeof(cgroups)) {
+			res = snprintf(cgroups + pos, sizeof(cgroups) - pos, "%s%s",
+			    (pos > 0 ? ", " : ""), probes[i].cgroup_dir);
+			pos += (res > 0 ? (size_t)res : 0);
+		}
+	}
+
+	if (count == 1) {
+		log_printf(LOG_ERR, "Probe in cgroup %s was not scheduled for %0.4fs "
+		    "(threshold is %0.4fs), started at %jd.%06ld", cgroups,
+		    (double)group->duration_max / NO_NS_IN_SEC,
+		    (double)(probe_timeout * NO_NS_IN_MSEC) / NO_NS_IN_SEC,
+		    (intmax_t)rt_start.tv_sec, rt_start.tv_nsec / (long)NO_NS_IN_USEC);
+	} else {
+		log_printf(LOG_ERR, "%s%d of %d probes were not scheduled at the same time for up "
+		    "to %0.4fs (threshold is %0.4fs, %u pauses during %0.4fs), started at "
+		    "%jd.%06ld, cgroups %s%s", (count == probe_count + 1 ? "All " : ""), count,
+		    probe_count + 1, (double)group->duration_max / NO_NS_IN_SEC,
+		    (double)(probe_timeout * NO_NS_IN_MSEC) / NO_NS_IN_SEC, group->events,
+		    (double)(group->end - group->start) / NO_NS_IN_SEC,
+		    (intmax_t)rt_start.tv_sec, rt_start.tv_nsec / (long)NO_NS_IN_USEC,
+		    cgroups, (pos >= sizeof(cgroups) ? " ..." : ""));
+	}
+}
+
+/*
+ * Get index of probe (or PROBE_MAIN) with oldest event in its ring or -1 if all
+ * rings are empty. Events of every ring are ordered so this is one step of k-way
+ * merge.
+ */
+static int
+probes_event_oldest_get(void)
+{
+	struct probe_shared *shared;
+	uint64_t oldest_start;
+	uint64_t tail;
+	int oldest;
+	int i;
+
+	oldest = -1;
+	oldest_start = 0;
+
+	for (i = 0; i <= probe_count; i++) {
+		shared = probe_shared_get(i == probe_count ? PROBE_MAIN : i);
+
+		tail = shared->events_tail;
+		if (tail == __atomic_load_n(&shared->events_head, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+
+		if (oldest == -1 || shared->events[tail % PROBE_EVENT_RING_SIZE].start <
+		    oldest_start) {
+			oldest = (i == probe_count ? PROBE_MAIN : i);
+			oldest_start = shared->events[tail % PROBE_EVENT_RING_SIZE].start;
+		}
+	}
+
+	return (oldest);
+}
+
+/*
+ * Collect pauses detected by probes in timestamp order and merge overlapping ones.
+ * Group is reported only after its end is older than watermark so pauses of other
+ * probes which are still being reported can join it. This bounds reporting latency
+ * to watermark distance plus one main loop iteration.
+ */
+static void
+probes_collect(uint64_t watermark)
+{
+	struct probe_event_group *group;
+	struct probe_shared *shared;
+	const struct probe_event *event;
+	uint64_t overflow;
+	uint64_t end;
+	int i;
+
+	group = &probe_event_group;
+
+	for (i = 0; i < probe_count; i++) {
+		overflow = __atomic_load_n(&probes[i].shared->events_overflow, __ATOMIC_RELAXED);
+		if (overflow != probes[i].events_overflow_seen) {
+			log_printf(LOG_WARNING, "Probe in cgroup %s lost %"PRIu64" pause events "
+			    "because of full event ring", probes[i].cgroup_dir,
+			    overflow - probes[i].events_overflow_seen);
+
+			probes[i].events_overflow_seen = overflow;
+		}
+	}
+
+	while ((i = probes_event_oldest_get()) != -1) {
+		shared = probe_shared_get(i);
+		event = &shared->events[shared->events_tail % PROBE_EVENT_RING_SIZE];
+
+		if (group->events > 0 && event->start > group->end) {
+			if (group->end > watermark) {
+				break;
+			}
+
+			probe_event_group_report(group);
+			group->events = 0;
+		}
+
+		end = event->start + event->duration;
+
+		if (group->events == 0) {
+			memset(group, 0, sizeof(*group));
+			group->start = event->start;
+		}
+		if (end > group->end) {
+			group->end = end;
+		}
+		if (event->duration > group->duration_max) {
+			group->duration_max = event->duration;
+		}
+		group->probes |= 1U << i;
+		group->events++;
+
+		__atomic_store_n(&shared->events_tail, shared->events_tail + 1, __ATOMIC_RELEASE);
+	}
+
+	if (group->events > 0 && group->end <= watermark) {
+		probe_event_group_report(group);
+		group->events = 0;
+	}
+}
+
+/*
+ * Reap probes which exited, their pid is set to 0
+ */
+static void
+probes_reap(void)
+{
+	int status;
+	int i;
+
+	for (i = 0; i < probe_count; i++) {
+		if (probes[i].pid <= 0 || waitpid(probes[i].pid, &status, WNOHANG) <= 0) {
+			continue;
+		}
+
+		if (WIFSIGNALED(status)) {
+			log_printf(LOG_WARNING, "Probe %jd in cgroup %s was killed by signal %d",
+			    (intmax_t)probes[i].pid, probes[i].cgroup_dir, WTERMSIG(status));
+		} else {
+			log_printf(LOG_WARNING, "Probe %jd in cgroup %s exited with status %d",
+			    (intmax_t)probes[i].pid, probes[i].cgroup_dir, WEXITSTATUS(status));
+		}
+
+		probes[i].pid = 0;
+	}
+}
+
+static void
+probes_stop(void)
+{
+	int i;
+
+	for (i = 0; i < probe_count; i++) {
+		if (probes[i].pid > 0) {
+			(void)kill(probes[i].pid, SIGTERM);
+		}
+	}
+
+	for (i = 0; i < probe_count; i++) {
+		if (probes[i].pid > 0) {
+			(void)waitpid(probes[i].pid, NULL, 0);
+		}
+	}
+
+	probes_collect(UINT64_MAX);
+
+	probe_count = 0;
+}
+
+static void
+probes_statistics_print(void)
+{
+	uint64_t histogram[LATENESS_HISTOGRAM_BUCKETS];
+	struct probe *probe;
+	unsigned int j;
+	int i;
+
+	for (i = 0; i < probe_count; i++) {
+		probe = &probes[i];
+
+		for (j = 0; j < LATENESS_HISTOGRAM_BUCKETS; j++) {
+			histogram[j] = __atomic_load_n(&probe->shared->lateness_histogram[j],
+			    __ATOMIC_RELAXED);
+		}
+
+		log_printf(LOG_INFO, "Probe in cgroup %s was %"PRIu64"x not scheduled on time "
+		    "(%"PRIu64" samples, %"PRIu64" pause events lost)", probe->cgroup_dir,
+		    __atomic_load_n(&probe->shared->times_not_scheduled, __ATOMIC_RELAXED),
+		    __atomic_load_n(&probe->shared->samples, __ATOMIC_RELAXED),
+		    __atomic_load_n(&probe->shared->events_overflow, __ATOMIC_RELAXED));
+		lateness_histogram_print("cgroup", probe->cgroup_dir, histogram);
+	}
+}
+
+/*
+ * Pressure stall information
+ */
+static void
+psi_init(void)
+{
+
+	if (risk_enabled) {
+		psi_cpu_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+	}
+
+	if (risk_enabled || memprobe_enabled) {
+		psi_memory_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+	}
+}
+
+static void
+psi_fini(void)
+{
+
+	if (psi_cpu_fd != -1) {
+		(void)close(psi_cpu_fd);
+		psi_cpu_fd = -1;
+	}
+
+	if (psi_memory_fd != -1) {
+		(void)close(psi_memory_fd);
+		psi_memory_fd = -1;
+	}
+}
+
+/*
+ * Get "some" and "full" totals of PSI file in ns. full may be NULL. Totals are 0
+ * and -1 is returned if file is not available.
+ */
+static int
+psi_totals_get(int fd, uint64_t *some, uint64_t *full)
+{
+	char buf[256];
+	char *line;
+	char *value;
+	char *saveptr;
+
+	*some = 0;
+	if (full != NULL) {
+		*full = 0;
+	}
+
+	if (fd == -1 || utils_proc_file_pread(fd, buf, sizeof(buf)) <= 0) {
+		return (-1);
+	}
+
+	for (line = strtok_r(buf, "\n", &saveptr); line != NULL;
+	    line = strtok_r(NULL, "\n", &saveptr)) {
+		value = strstr(line, "total=");
+		if (value == NULL) {
+			continue;
+		}
+
+		if (strncmp(line, "some ", 5) == 0) {
+			*some = strtoull(value + 6, NULL, 10) * NO_NS_IN_USEC;
+		} else if (full != NULL && strncmp(line, "full ", 5) == 0) {
+			*full = strtoull(value + 6, NULL, 10) * NO_NS_IN_USEC;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * RT runtime reservation
+ */
+
+/*
+ * Measure CPU time (in ns) needed by one iteration of main loop (without sleep).
+ * Iteration reads the same window sources as poll_run, so they must be initialized.
+ */
+static uint64_t
+probe_cost_measure(void)
+{
+	struct timespec ts_start, ts_end;
+	uint64_t idle_usage[CPUIDLE_MAX_STATES];
+	uint64_t perf_values[SPAUSEDD_SHM_PERF_EVENTS];
+	uint64_t cost;
+	uint64_t run_delay;
+	uint64_t psi_some;
+	uint64_t psi_full;
+	uint64_t tv;
+	uint64_t counter;
+	int cpu;
+	int i;
+	int j;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts_start);
+
+	for (i = 0; i < PROBE_COST_ITERATIONS; i++) {
+		cpu = sched_getcpu();
+
+		/*
+		 * Window sources are read at both start and end of window
+		 */
+		for (j = 0; j < 2; j++) {
+			(void)cpuidle_usage_get(cpu, idle_usage);
+			(void)nano_stealtime_get();
+			(void)nano_run_delay_get(&run_delay);
+			clock_pair_get(&tv, &counter);
+
+			if (perf_enabled) {
+				(void)perf_group_read(&perf_thread_group, perf_values);
+				if (perf_cpu_active != -1) {
+					(void)perf_group_read(&perf_cpu_groups[perf_cpu_active],
+					    perf_values);
+				}
+			}
+		}
+
+		/*
+		 * Parsing without update only sets values of previous read
+		 */
+		if (schedstat_fd != -1 &&
+		    utils_proc_file_pread(schedstat_fd, schedstat_buf, schedstat_buf_size) > 0) {
+			cpu_schedstat_parse(0);
+		}
+
+		(void)psi_totals_get(psi_cpu_fd, &psi_some, NULL);
+		(void)psi_totals_get(psi_memory_fd, &psi_some, &psi_full);
+		(void)nano_current_get();
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts_end);
+
+	cost = (uint64_t)(ts_end.tv_sec - ts_start.tv_sec) * NO_NS_IN_SEC +
+	    ts_end.tv_nsec - ts_start.tv_nsec;
+
+	return (cost / PROBE_COST_ITERATIONS);
+}
+
+/*
+ * Ratio of RT runtime to RT period computed the same way as kernel does. Unlimited
+ * runtime (-1) is whole period.
+ */
+static uint64_t
+rt_ratio_get(long long int period_us, long long int runtime_us)
+{
+
+	if (runtime_us < 0) {
+		return (1ULL << RT_RATIO_SHIFT);
+	}
+
+	if (period_us <= 0) {
+		return (0);
+	}
+
+	return (((uint64_t)runtime_us << RT_RATIO_SHIFT) / (uint64_t)period_us);
+}
+
+/*
+ * Sum ratios of RT runtime of all children of cgroup given by path_len long prefix
+ * of cgroup_v1_cpu_path except child skip_name (skip_len long). Returns 0 on
+ * success.
+ */
+static int
+rt_children_ratio_get(size_t path_len, const char *skip_name, size_t skip_len,
+    uint64_t *ratio)
+{
+	char dname[PATH_MAX];
+	char fname[PATH_MAX];
+	long long int period_us;
+	long long int runtime_us;
+	struct dirent *de;
+	DIR *dir;
+	int res;
+
+	*ratio = 0;
+
+	res = snprintf(dname, sizeof(dname), "%s%.*s", cgroup_v1_cpu_mount, (int)path_len,
+	    cgroup_v1_cpu_path);
+	if (res < 0 || (size_t)res >= sizeof(dname)) {
+		return (-1);
+	}
+
+	dir = opendir(dname);
+	if (dir == NULL) {
+		return (-1);
+	}
+
+	res = 0;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_type != DT_DIR || strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0 ||
+		    (strlen(de->d_name) == skip_len && strncmp(de->d_name, skip_name, skip_len) == 0)) {
+			continue;
+		}
+
+		if (snprintf(fname, sizeof(fname), "%s/%s/cpu.rt_period_us", dname,
+		    de->d_name) >= (int)sizeof(fname) ||
+		    cgroup_file_read_ll(fname, &period_us) == -1 ||
+		    snprintf(fname, sizeof(fname), "%s/%s/cpu.rt_runtime_us", dname,
+		    de->d_name) >= (int)sizeof(fname) ||
+		    cgroup_file_read_ll(fname, &runtime_us) == -1) {
+			log_printf(LOG_DEBUG, "Can't read RT runtime of cgroup %s/%s", dname,
+			    de->d_name);
+			res = -1;
+			break;
+		}
+
+		*ratio += rt_ratio_get(period_us, runtime_us);
+	}
+
+	(void)closedir(dir);
+
+	return (res);
+}
+
+/*
+ * Restore original cpu.rt_runtime_us of levels from last to first (children
+ * before parents)
+ */
+static void
+rt_runtime_levels_restore(const struct rt_runtime_level *levels, int first, int last)
+{
+	char fname[PATH_MAX];
+	int k;
+
+	for (k = last; k >= first; k--) {
+		if (levels[k].new_runtime_us == levels[k].runtime_us) {
+			continue;
+		}
+
+		if (cgroup_file_name_get(fname, cgroup_v1_cpu_mount, cgroup_v1_cpu_path,
+		    levels[k].path_len, "cpu.rt_runtime_us") == -1 ||
+		    cgroup_file_write_ll(fname, levels[k].runtime_us) == -1) {
+			log_printf(LOG_WARNING, "Can't restore RT runtime of cgroup %.*s to %lldus",
+			    (int)levels[k].path_len, cgroup_v1_cpu_path, levels[k].runtime_us);
+		}
+	}
+}
+
+/*
+ * Reserve cpu.rt_runtime_us in cgroup v1 cpu controller cgroup of this process
+ * (and all its ancestors) so RR scheduler can be set without moving to root
+ * cgroup. Every ancestor must cover sum of runtime ratios of all its children,
+ * so needed runtimes are computed (including siblings) before anything is
+ * written. Original values are restored if a write fails. Returns 0 on success.
+ */
+static int
+utils_reserve_rt_runtime(uint64_t timeout)
+{
+	struct rt_runtime_level *levels;
+	struct rt_runtime_level *level;
+	struct rt_runtime_level *child;
+	char fname[PATH_MAX];
+	long long int rt_period_us;
+	long long int budget_us;
+	long long int need_us;
+	uint64_t ratio;
+	uint64_t cost;
+	uint64_t poll_timeout_ns;
+	size_t path_len;
+	size_t i;
+	int level_count;
+	int k;
+
+	levels = rt_runtime_levels;
+	rt_runtime_level_count = 0;
+
+	if (cgroup_v1_cpu_mount[0] == '\0' || cgroup_v1_cpu_path[0] == '\0') {
+		log_printf(LOG_DEBUG, "Not in non-root cgroup v1 cpu cgroup, can't reserve RT runtime");
+
+		return (-1);
+	}
+
+	path_len = strlen(cgroup_v1_cpu_path);
+
+	if (cgroup_file_name_get(fname, cgroup_v1_cpu_mount, cgroup_v1_cpu_path, path_len,
+	    "cpu.rt_period_us") == -1 ||
+	    cgroup_file_read_ll(fname, &rt_period_us) == -1 || rt_period_us <= 0) {
+		log_printf(LOG_DEBUG, "Can't read cpu.rt_period_us -> "
+		    "kernel with disabled CONFIG_RT_GROUP_SCHED");
+
+		return (-1);
+	}
+
+	cost = probe_cost_measure();
+	poll_timeout_ns = (timeout / 3) * NO_NS_IN_MSEC;
+	if (poll_timeout_ns == 0) {
+		poll_timeout_ns = 1;
+	}
+
+	budget_us = (long long int)((cost * ((rt_period_us * NO_NS_IN_USEC) / poll_timeout_ns + 1) *
+	    RT_RUNTIME_SAFETY_FACTOR) / NO_NS_IN_USEC);
+	if (budget_us < RT_RUNTIME_MIN_US) {
+		budget_us = RT_RUNTIME_MIN_US;
+	}
+	if (budget_us > rt_period_us) {
+		budget_us = rt_period_us;
+	}
+
+	log_printf(LOG_DEBUG, "Probe iteration cost is %"PRIu64"ns, reserving %lldus of "
+	    "%lldus RT period", cost, budget_us, rt_period_us);
+
+	/*
+	 * Read levels from root (path length 0) down to our cgroup
+	 */
+	level_count = 0;
+	for (i = 0; i <= path_len; i++) {
+		if (i != 0 && i != path_len && cgroup_v1_cpu_path[i] != '/') {
+			continue;
+		}
+
+		if (level_count >= RT_RUNTIME_MAX_DEPTH) {
+			log_printf(LOG_DEBUG, "Cgroup %s is too deep to reserve RT runtime",
+			    cgroup_v1_cpu_path);
+
+			return (-1);
+		}
+
+		level = &levels[level_count];
+		level->path_len = i;
+
+		if (cgroup_file_name_get(fname, cgroup_v1_cpu_mount, cgroup_v1_cpu_path, i,
+		    "cpu.rt_period_us") == -1 ||
+		    cgroup_file_read_ll(fname, &level->period_us) == -1 ||
+		    cgroup_file_name_get(fname, cgroup_v1_cpu_mount, cgroup_v1_cpu_path, i,
+		    "cpu.rt_runtime_us") == -1 ||
+		    cgroup_file_read_ll(fname, &level->runtime_us) == -1) {
+			log_printf(LOG_DEBUG, "Can't read %s", fname);
+
+			return (-1);
+		}
+
+		level_count++;
+	}
+
+	/*
+	 * Compute needed runtimes from our cgroup up. Parent must cover ratios of
+	 * siblings plus new ratio of child on our path. Root cgroup is only checked.
+	 */
+	level = &levels[level_count - 1];
+	level->new_runtime_us = level->runtime_us;
+	if (level->runtime_us >= 0 && level->runtime_us < budget_us) {
+		level->new_runtime_us = budget_us;
+	}
+
+	for (k = level_count - 2; k >= 0; k--) {
+		level = &levels[k];
+		child = &levels[k + 1];
+
+		if (rt_children_ratio_get(level->path_len,
+		    cgroup_v1_cpu_path + level->path_len + 1,
+		    child->path_len - level->path_len - 1, &ratio) == -1) {
+			return (-1);
+		}
+		ratio += rt_ratio_get(child->period_us, child->new_runtime_us);
+
+		level->new_runtime_us = level->runtime_us;
+		if (rt_ratio_get(level->period_us, level->runtime_us) >= ratio) {
+			continue;
+		}
+
+		if (level->runtime_us < 0 || level->period_us <= 0) {
+			need_us = level->period_us + 1;
+		} else {
+			need_us = (long long int)((ratio * (uint64_t)level->period_us) >>
+			    RT_RATIO_SHIFT);
+			while (rt_ratio_get(level->period_us, need_us) < ratio) {
+				need_us++;
+			}
+		}
+
+		if (k == 0 || need_us > level->period_us) {
+			log_printf(LOG_DEBUG, "RT runtime of cgroup %.*s can't cover its children "
+			    "with reserved %lldus", (int)(level->path_len == 0 ? 1 : level->path_len),
+			    cgroup_v1_cpu_path, budget_us);
+
+			return (-1);
+		}
+
+		level->new_runtime_us = need_us;
+	}
+
+	/*
+	 * Parent must cover its children, so write from top of hierarchy down to our
+	 * cgroup and restore in opposite order
+	 */
+	for (k = 1; k < level_count; k++) {
+		level = &levels[k];
+		if (level->new_runtime_us == level->runtime_us) {
+			continue;
+		}
+
+		if (cgroup_file_name_get(fname, cgroup_v1_cpu_mount, cgroup_v1_cpu_path,
+		    level->path_len, "cpu.rt_runtime_us") == -1 ||
+		    cgroup_file_write_ll(fname, level->new_runtime_us) == -1) {
+			log_printf(LOG_DEBUG, "Can't set %s to %lld: %s", fname,
+			    level->new_runtime_us, strerror(errno));
+			rt_runtime_levels_restore(levels, 1, k - 1);
+
+			return (-1);
+		}
+	}
+	rt_runtime_level_count = level_count;
+
+	log_printf(LOG_INFO, "Reserved %lldus RT runtime in cgroup %s", budget_us,
+	    cgroup_v1_cpu_path);
+
+	return (0);
+}
+
+/*
+ * Restore RT runtime raised by utils_reserve_rt_runtime
+ */
+static void
+utils_release_rt_runtime(void)
+{
+
+	if (rt_runtime_level_count == 0) {
+		return ;
+	}
+
+	rt_runtime_levels_restore(rt_runtime_levels, 1, rt_runtime_level_count - 1);
+	rt_runtime_level_count = 0;
+
+	log_printf(LOG_DEBUG, "Released reserved RT runtime in cgroup %s", cgroup_v1_cpu_path);
+}
+
+/*
+ * Memory probe
+ */
+static const char *memprobe_op_names[MEMPROBE_OPS] = {
+	"mmap",
+	"anonymous fault",
+	"file fault",
+};
+
+static const char *memprobe_vmstat_names[MEMPROBE_VMSTATS] = {
+	"pgmajfault",
+	"allocstall",
+	"pgscan_direct",
+	"compact_stall",
+	"pswpin",
+};
+
+static void
+memprobe_op_add(struct memprobe_shared *shared, enum memprobe_op op, uint64_t start,
+    uint64_t duration, uint64_t threshold)
+{
+	uint64_t head;
+
+	__atomic_add_fetch(&shared->histogram[op][lateness_histogram_bucket(duration)], 1,
+	    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&shared->samples[op], 1, __ATOMIC_RELAXED);
+
+	if (duration <= threshold) {
+		return ;
+	}
+
+	__atomic_add_fetch(&shared->stalls[op], 1, __ATOMIC_RELAXED);
+
+	head = __atomic_load_n(&shared->events_head, __ATOMIC_RELAXED);
+	if (head - __atomic_load_n(&shared->events_tail, __ATOMIC_ACQUIRE) >= PROBE_EVENT_RING_SIZE) {
+		__atomic_add_fetch(&shared->events_overflow, 1, __ATOMIC_RELAXED);
+	} else {
+		shared->events[head % PROBE_EVENT_RING_SIZE].start = start;
+		shared->events[head % PROBE_EVENT_RING_SIZE].duration = duration;
+		shared->events[head % PROBE_EVENT_RING_SIZE].op = op;
+		__atomic_store_n(&shared->events_head, head + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * Map fresh anonymous pages and touch them, timing mmap and every fault
+ */
+static void
+memprobe_anon_run(struct memprobe_shared *shared, size_t page_size, uint64_t threshold)
+{
+	char *mem;
+	uint64_t tv_start;
+	uint64_t tv_end;
+	int i;
+
+	tv_start = nano_current_get();
+	mem = mmap(NULL, MEMPROBE_ANON_PAGES * page_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	tv_end = nano_current_get();
+	if (mem == MAP_FAILED) {
+		return ;
+	}
+	memprobe_op_add(shared, MEMPROBE_OP_MMAP, tv_start, tv_end - tv_start, threshold);
+
+	for (i = 0; i < MEMPROBE_ANON_PAGES; i++) {
+		tv_start = nano_current_get();
+		*(volatile char *)(mem + i * page_size) = 1;
+		tv_end = nano_current_get();
+
+		memprobe_op_add(shared, MEMPROBE_OP_ANON, tv_start, tv_end - tv_start, threshold);
+	}
+
+	(void)munmap(mem, MEMPROBE_ANON_PAGES * page_size);
+}
+
+/*
+ * Create unlinked file with MEMPROBE_FILE_PAGES pages written to disk. Returns
+ * fd or -1 on error.
+ */
+static int
+memprobe_file_create(size_t page_size)
+{
+	char fname[] = "/var/tmp/" PROGRAM_NAME "-memprobe-XXXXXX";
+	char *buf;
+	int fd;
+	int i;
+
+	buf = malloc(page_size);
+	if (buf == NULL) {
+		return (-1);
+	}
+	memset(buf, 0xa5, page_size);
+
+	fd = mkstemp(fname);
+	if (fd == -1) {
+		free(buf);
+		return (-1);
+	}
+	(void)unlink(fname);
+
+	for (i = 0; i < MEMPROBE_FILE_PAGES; i++) {
+		if (pwrite(fd, buf, page_size, (off_t)i * page_size) != (ssize_t)page_size) {
+			break;
+		}
+	}
+	free(buf);
+
+	if (i < MEMPROBE_FILE_PAGES || fdatasync(fd) == -1) {
+		(void)close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+/*
+ * Drop file from page cache, map it and read every page, so each fault has to
+ * read page back
+ */
+static void
+memprobe_file_run(struct memprobe_shared *shared, int fd, size_t page_size, uint64_t threshold)
+{
+	char *mem;
+	uint64_t tv_start;
+	uint64_t tv_end;
+	int i;
+
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	mem = mmap(NULL, MEMPROBE_FILE_PAGES * page_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		return ;
+	}
+
+	for (i = 0; i < MEMPROBE_FILE_PAGES; i++) {
+		tv_start = nano_current_get();
+		(void)*(volatile char *)(mem + i * page_size);
+		tv_end = nano_current_get();
+
+		memprobe_op_add(shared, MEMPROBE_OP_FILE, tv_start, tv_end - tv_start, threshold);
+	}
+
+	(void)munmap(mem, MEMPROBE_FILE_PAGES * page_size);
+}
+
+/*
+ * Main loop of memory probe process. Probe runs with SCHED_OTHER policy and
+ * without locked memory, so it faults and reclaims same way as unlocked
+ * workloads.
+ */
+static void
+memprobe_child_run(struct memprobe_shared *shared, uint64_t timeout)
+{
+	struct sched_param param;
+	uint64_t threshold;
+	uint64_t cycle;
+	size_t page_size;
+	int poll_timeout;
+	int fd;
+
+	(void)prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+	memset(&param, 0, sizeof(param));
+	(void)sched_setscheduler(0, SCHED_OTHER, &param);
+
+	/*
+	 * Locks are not inherited by fork, just make sure MCL_FUTURE doesn't apply
+	 */
+	(void)munlockall();
+
+	page_size = sysconf(_SC_PAGESIZE);
+	threshold = timeout * NO_NS_IN_MSEC / MEMPROBE_STALL_DIVISOR;
+	poll_timeout = timeout / 3;
+
+	fd = memprobe_file_create(page_size);
+
+	for (cycle = 0; !stop_main_loop; cycle++) {
+		memprobe_anon_run(shared, page_size, threshold);
+
+		if (fd != -1 && cycle % MEMPROBE_FILE_INTERVAL == 0) {
+			memprobe_file_run(shared, fd, page_size, threshold);
+		}
+
+		if (poll(NULL, 0, poll_timeout) == -1 && errno != EINTR) {
+			_exit(2);
+		}
+	}
+
+	_exit(0);
+}
+
+/*
+ * Read memory PSI totals and vmstat counters. Returns -1 if none is available.
+ */
+static int
+memprobe_signals_get(struct memprobe_signals *signals)
+{
+	char *line;
+	char *value;
+	char *saveptr;
+	int res;
+	int i;
+
+	memset(signals, 0, sizeof(*signals));
+	signals->tv = nano_current_get();
+	res = -1;
+
+	if (psi_totals_get(psi_memory_fd, &signals->psi_some, &signals->psi_full) == 0) {
+		signals->psi_valid = 1;
+		res = 0;
+	}
+
+	if (memprobe_vmstat_fd != -1 &&
+	    utils_proc_file_pread(memprobe_vmstat_fd, memprobe_signals_buf,
+	    sizeof(memprobe_signals_buf)) > 0) {
+		for (line = strtok_r(memprobe_signals_buf, "\n", &saveptr); line != NULL;
+		    line = strtok_r(NULL, "\n", &saveptr)) {
+			value = strchr(line, ' ');
+			if (value == NULL) {
+				continue;
+			}
+			*value++ = '\0';
+
+			for (i = 0; i < MEMPROBE_VMSTATS; i++) {
+				/*
+				 * allocstall is split per zone, so prefix is matched
+				 */
+				if ((i == MEMPROBE_VMSTAT_ALLOCSTALL &&
+				    strncmp(line, "allocstall_", 11) == 0) ||
+				    strcmp(line, memprobe_vmstat_names[i]) == 0) {
+					signals->vmstat[i] += strtoull(value, NULL, 10);
+				}
+			}
+		}
+		signals->vmstat_valid = 1;
+		res = 0;
+	}
+
+	return (res);
+}
+
+/*
+ * Log memory signals between prev and now. Returns 1 if there was memory
+ * pressure or direct reclaim.
+ */
+static int
+memprobe_signals_report(const struct memprobe_signals *prev, const struct memprobe_signals *now)
+{
+	char buf[256];
+	size_t pos;
+	int pressure;
+	int res;
+	int i;
+
+	pos = 0;
+	buf[0] = '\0';
+	pressure = 0;
+
+	if (prev->psi_valid && now->psi_valid) {
+		res = snprintf(buf, sizeof(buf), " memory pressure some %0.4fs, full %0.4fs",
+		    (double)(now->psi_some - prev->psi_some) / NO_NS_IN_SEC,
+		    (double)(now->psi_full - prev->psi_full) / NO_NS_IN_SEC);
+		pos += (res > 0 ? (size_t)res : 0);
+
+		if (now->psi_some > prev->psi_some) {
+			pressure = 1;
+		}
+	}
+
+	if (prev->vmstat_valid && now->vmstat_valid) {
+		for (i = 0; i < MEMPROBE_VMSTATS && pos < sizeof(buf); i++) {
+			res = snprintf(buf + pos, sizeof(buf) - pos, "%s %s %"PRIu64,
+			    (pos > 0 ? "," : ""), memprobe_vmstat_names[i],
+			    now->vmstat[i] - prev->vmstat[i]);
+			pos += (res > 0 ? (size_t)res : 0);
+		}
+
+		if (now->vmstat[MEMPROBE_VMSTAT_ALLOCSTALL] > prev->vmstat[MEMPROBE_VMSTAT_ALLOCSTALL] ||
+		    now->vmstat[MEMPROBE_VMSTAT_PGSCAN_DIRECT] >
+		    prev->vmstat[MEMPROBE_VMSTAT_PGSCAN_DIRECT]) {
+			pressure = 1;
+		}
+	}
+
+	if (pos == 0) {
+		return (0);
+	}
+
+	log_printf((pressure ? LOG_WARNING : LOG_INFO), "During last %0.4fs%s",
+	    (double)(now->tv - prev->tv) / NO_NS_IN_SEC, buf);
+
+	return (pressure);
+}
+
+static void
+memprobe_start(uint64_t timeout)
+{
+
+	if (!memprobe_enabled) {
+		return ;
+	}
+
+	memprobe_timeout = timeout;
+
+	if (memprobe_shared == NULL) {
+		memprobe_shared = mmap(NULL, sizeof(*memprobe_shared), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memprobe_shared == MAP_FAILED) {
+			log_perror(LOG_WARNING, "Can't allocate shared memory for memory probe");
+			memprobe_shared = NULL;
+			return ;
+		}
+	}
+
+	if (psi_memory_fd == -1) {
+		log_printf(LOG_DEBUG, "Can't open /proc/pressure/memory -> kernel without PSI, "
+		    "memory pressure is not correlated");
+	}
+
+	memprobe_vmstat_fd = open("/proc/vmstat", O_RDONLY | O_CLOEXEC);
+	if (memprobe_vmstat_fd == -1) {
+		log_printf(LOG_DEBUG, "Can't open /proc/vmstat, reclaim is not correlated");
+	}
+
+	(void)memprobe_signals_get(&memprobe_signals_prev);
+	memprobe_events_overflow_seen = __atomic_load_n(&memprobe_shared->events_overflow,
+	    __ATOMIC_RELAXED);
+
+	memprobe_pid = fork();
+	if (memprobe_pid == -1) {
+		log_perror(LOG_WARNING, "Can't create memory probe process");
+		return ;
+	}
+
+	if (memprobe_pid == 0) {
+		memprobe_child_run(memprobe_shared, timeout);
+	}
+
+	log_printf(LOG_INFO, "Started memory probe %jd with stall threshold %0.4fs",
+	    (intmax_t)memprobe_pid,
+	    (double)(timeout * NO_NS_IN_MSEC / MEMPROBE_STALL_DIVISOR) / NO_NS_IN_SEC);
+}
+
+/*
+ * Log stalls reported by memory probe together with memory signals since
+ * previous sample. Signals are sampled every MEMPROBE_SIGNALS_INTERVAL seconds
+ * when there is no stall.
+ */
+static void
+memprobe_collect(uint64_t tv_now)
+{
+	struct memprobe_signals signals_now;
+	const struct memprobe_event *event;
+	struct timespec rt_start;
+	uint64_t overflow;
+	uint64_t tail;
+	unsigned int events;
+
+	if (memprobe_shared == NULL || memprobe_pid <= 0) {
+		return ;
+	}
+
+	overflow = __atomic_load_n(&memprobe_shared->events_overflow, __ATOMIC_RELAXED);
+	if (overflow != memprobe_events_overflow_seen) {
+		log_printf(LOG_WARNING, "Memory probe lost %"PRIu64" stall events because of full "
+		    "event ring", overflow - memprobe_events_overflow_seen);
+		memprobe_events_overflow_seen = overflow;
+	}
+
+	tail = memprobe_shared->events_tail;
+	if (tail == __atomic_load_n(&memprobe_shared->events_head, __ATOMIC_ACQUIRE)) {
+		if (tv_now - memprobe_signals_prev.tv >= MEMPROBE_SIGNALS_INTERVAL * NO_NS_IN_SEC) {
+			(void)memprobe_signals_get(&memprobe_signals_prev);
+		}
+
+		return ;
+	}
+
+	(void)memprobe_signals_get(&signals_now);
+
+	for (events = 0; tail != __atomic_load_n(&memprobe_shared->events_head, __ATOMIC_ACQUIRE);
+	    tail++, events++) {
+		event = &memprobe_shared->events[tail % PROBE_EVENT_RING_SIZE];
+
+		realtime_ago_get(nano_current_get() - event->start, &rt_start);
+
+		log_printf(LOG_ERR, "Memory probe %s took %0.4fs (threshold is %0.4fs), started at "
+		    "%jd.%06ld", memprobe_op_names[event->op], (double)event->duration / NO_NS_IN_SEC,
+		    (double)(memprobe_timeout * NO_NS_IN_MSEC / MEMPROBE_STALL_DIVISOR) / NO_NS_IN_SEC,
+		    (intmax_t)rt_start.tv_sec, rt_start.tv_nsec / (long)NO_NS_IN_USEC);
+
+		__atomic_store_n(&memprobe_shared->events_tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	if (memprobe_signals_report(&memprobe_signals_prev, &signals_now)) {
+		memprobe_stalls_with_pressure += events;
+	}
+	memprobe_signals_prev = signals_now;
+}
+
+static void
+memprobe_stop(void)
+{
+
+	if (memprobe_pid > 0) {
+		(void)kill(memprobe_pid, SIGTERM);
+		(void)waitpid(memprobe_pid, NULL, 0);
+
+		memprobe_collect(nano_current_get());
+		memprobe_pid = 0;
+	}
+
+	if (memprobe_vmstat_fd != -1) {
+		(void)close(memprobe_vmstat_fd);
+		memprobe_vmstat_fd = -1;
+	}
+}
+
+static void
+memprobe_statistics_print(void)
+{
+	uint64_t histogram[LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t stalls;
+	unsigned int j;
+	int i;
+
+	if (memprobe_shared == NULL) {
+		return ;
+	}
+
+	stalls = 0;
+
+	for (i = 0; i < MEMPROBE_OPS; i++) {
+		for (j = 0; j < LATENESS_HISTOGRAM_BUCKETS; j++) {
+			histogram[j] = __atomic_load_n(&memprobe_shared->histogram[i][j],
+			    __ATOMIC_RELAXED);
+		}
+
+		stalls += __atomic_load_n(&memprobe_shared->stalls[i], __ATOMIC_RELAXED);
+
+		log_printf(LOG_INFO, "Memory probe %s: %"PRIu64" samples, %"PRIu64" stalls",
+		    memprobe_op_names[i], __atomic_load_n(&memprobe_shared->samples[i],
+		    __ATOMIC_RELAXED), __atomic_load_n(&memprobe_shared->stalls[i], __ATOMIC_RELAXED));
+		lateness_histogram_print("memory probe", memprobe_op_names[i], histogram);
+	}
+
+	log_printf(LOG_INFO, "%"PRIu64" of %"PRIu64" memory probe stalls coincided with memory "
+	    "pressure or direct reclaim", memprobe_stalls_with_pressure, stalls);
+}
+
+/*
+ * Statistics snapshot
+ */
+
+/*
+ * Fill snapshot from private accumulators. Only main thread updates them so no
+ * locking is needed.
+ */
+static void
+stats_fill(struct spausedd_stats *stats, uint64_t tv_start)
+{
+
+	memset(stats, 0, sizeof(*stats));
+	stats->version = SPAUSEDD_STATS_VERSION;
+	stats->size = sizeof(*stats);
+	stats->runtime = nano_current_get() - tv_start;
+	stats->samples = lateness_histogram_total(lateness_histogram);
+	stats->times_not_scheduled = times_not_scheduled;
+	stats->times_memory_throttled = times_memory_throttled;
+	stats->times_steal_uncertain = times_steal_uncertain;
+	stats->lateness_sum = lateness_sum;
+	stats->lateness_max = lateness_max;
+	stats->pause_duration_sum = pause_duration_sum;
+	stats->pause_steal_sum = pause_steal_sum;
+	stats->pause_run_delay_sum = pause_run_delay_sum;
+	memcpy(stats->pauses_by_class, pauses_by_class, sizeof(pauses_by_class));
+	memcpy(stats->lateness_histogram, lateness_histogram, sizeof(lateness_histogram));
+	stats->times_clock_backwards = times_clock_backwards;
+	stats->times_clock_jump = times_clock_jump;
+	stats->times_clock_rate = times_clock_rate;
+}
+
+/*
+ * Restore private accumulators from snapshot and return new tv_start
+ */
+static void
+stats_apply(const struct spausedd_stats *stats, uint64_t *tv_start)
+{
+
+	times_not_scheduled = stats->times_not_scheduled;
+	times_memory_throttled = stats->times_memory_throttled;
+	times_steal_uncertain = stats->times_steal_uncertain;
+	lateness_sum = stats->lateness_sum;
+	lateness_max = stats->lateness_max;
+	pause_duration_sum = stats->pause_duration_sum;
+	pause_steal_sum = stats->pause_steal_sum;
+	pause_run_delay_sum = stats->pause_run_delay_sum;
+	memcpy(pauses_by_class, stats->pauses_by_class, sizeof(pauses_by_class));
+	memcpy(lateness_histogram, stats->lateness_histogram, sizeof(lateness_histogram));
+	times_clock_backwards = stats->times_clock_backwards;
+	times_clock_jump = stats->times_clock_jump;
+	times_clock_rate = stats->times_clock_rate;
+	*tv_start = nano_current_get() - stats->runtime;
+}
+
+/*
+ * Shared statistics page
+ */
+static void
+shm_stats_write_begin(void)
+{
+
+	__atomic_store_n(&shm_stats->seq, shm_stats->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+shm_stats_write_end(void)
+{
+
+	__atomic_store_n(&shm_stats->seq, shm_stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Page is always created from scratch (O_EXCL), so page left by previous instance
+ * or pre-created by other user is never written to or mapped
+ */
+static void
+shm_stats_init(uint64_t timeout, uint64_t tv_start)
+{
+	int fd;
+
+	(void)shm_unlink(SPAUSEDD_SHM_NAME);
+
+	fd = shm_open(SPAUSEDD_SHM_NAME, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		log_perror(LOG_WARNING, "Can't create shared statistics page");
+		return ;
+	}
+
+	if (ftruncate(fd, sizeof(*shm_stats)) == -1) {
+		log_perror(LOG_DEBUG, "Can't resize shared statistics page");
+		(void)close(fd);
+		return ;
+	}
+
+	shm_stats = mmap(NULL, sizeof(*shm_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (shm_stats == MAP_FAILED) {
+		log_perror(LOG_DEBUG, "Can't map shared statistics page");
+		shm_stats = NULL;
+		return ;
+	}
+
+	shm_stats_write_begin();
+	shm_stats->magic = SPAUSEDD_SHM_MAGIC;
+	shm_stats->version = SPAUSEDD_SHM_VERSION;
+	shm_stats->size = sizeof(*shm_stats);
+	shm_stats->stats_offset = offsetof(struct spausedd_shm, stats);
+	shm_stats->stats_size = sizeof(shm_stats->stats);
+	shm_stats->pid = getpid();
+	shm_stats->timeout = timeout;
+	shm_stats->steal_threshold = max_steal_threshold;
+	shm_stats->episode_gap = SHM_EPISODE_GAP * NO_NS_IN_SEC;
+	stats_fill(&shm_stats->stats, tv_start);
+	shm_stats->updated = nano_current_get();
+	shm_stats_write_end();
+
+	log_printf(LOG_DEBUG, "Publishing statistics in shared memory %s", SPAUSEDD_SHM_NAME);
+}
+
+static void
+shm_stats_fini(void)
+{
+
+	if (shm_stats != NULL) {
+		(void)munmap(shm_stats, sizeof(*shm_stats));
+		shm_stats = NULL;
+		(void)shm_unlink(SPAUSEDD_SHM_NAME);
+	}
+}
+
+/*
+ * Publish statistics of finished window. Called once per main loop iteration.
+ */
+static void
+shm_stats_update(uint64_t tv_now, uint64_t tv_start, uint64_t window, uint64_t lateness,
+    uint64_t steal, uint64_t run_delay, int cpu)
+{
+	struct spausedd_shm_cpu *shm_cpu;
+	int i;
+
+	if (shm_stats == NULL) {
+		return ;
+	}
+
+	shm_stats_write_begin();
+
+	shm_stats->updated = tv_now;
+	shm_stats->lateness_last = lateness;
+	shm_stats->window = window;
+	shm_stats->window_steal = steal;
+	shm_stats->window_run_delay = run_delay;
+	shm_stats->window_perf_mask = perf_window_mask;
+	shm_stats->window_perf_cpu_mask = perf_window_cpu_mask;
+	shm_stats->window_perf_cpu_id = perf_window_cpu_id;
+	memcpy(shm_stats->window_perf, perf_window, sizeof(shm_stats->window_perf));
+	memcpy(shm_stats->window_perf_cpu, perf_window_cpu, sizeof(shm_stats->window_perf_cpu));
+	if (risk_enabled) {
+		shm_stats->pause_risk = (uint32_t)(risk_score * 1000);
+		shm_stats->pause_risk_state = (risk_warning ? SPAUSEDD_SHM_RISK_WARNING :
+		    SPAUSEDD_SHM_RISK_NORMAL);
+	}
+	stats_fill(&shm_stats->stats, tv_start);
+
+	if (cpu >= 0 && cpu < SPAUSEDD_SHM_MAX_CPUS) {
+		shm_cpu = &shm_stats->cpus[cpu];
+		shm_cpu->samples++;
+		shm_cpu->lateness_sum += lateness;
+		shm_cpu->lateness_last = lateness;
+
+		if ((uint32_t)cpu >= shm_stats->cpu_count) {
+			shm_stats->cpu_count = cpu + 1;
+		}
+	}
+
+	for (i = 0; i < cpu_schedstat_count && i < SPAUSEDD_SHM_MAX_CPUS; i++) {
+		shm_stats->cpus[i].run_delay = cpu_schedstats[i].window_run_delay;
+	}
+	if ((uint32_t)i > shm_stats->cpu_count) {
+		shm_stats->cpu_count = i;
+	}
+
+	shm_stats_write_end();
+}
+
+static void
+shm_stats_pause_add(uint64_t tv_now, uint64_t duration, uint64_t steal, uint64_t run_delay,
+    enum spausedd_shm_class class, int cpu)
+{
+	struct spausedd_shm_pause *pause;
+	struct timespec rt_start;
+
+	if (shm_stats == NULL) {
+		return ;
+	}
+
+	realtime_ago_get(duration, &rt_start);
+
+	shm_stats_write_begin();
+
+	pause = &shm_stats->recent_pauses[shm_stats->pauses_total % SPAUSEDD_SHM_RECENT_PAUSES];
+	pause->rt_start_sec = rt_start.tv_sec;
+	pause->rt_start_nsec = rt_start.tv_nsec;
+	pause->duration = duration;
+	pause->steal = steal;
+	pause->run_delay = run_delay;
+	pause->class = class;
+	pause->cpu = cpu;
+	pause->perf_mask = perf_window_mask;
+	pause->perf_cpu_mask = perf_window_cpu_mask;
+	memcpy(pause->perf, perf_window, sizeof(pause->perf));
+	memcpy(pause->perf_cpu, perf_window_cpu, sizeof(pause->perf_cpu));
+	shm_stats->pauses_total++;
+
+	if (shm_stats->episode_pauses == 0 ||
+	    tv_now - shm_stats->episode_end > shm_stats->episode_gap) {
+		shm_stats->episode_start = tv_now - duration;
+		shm_stats->episode_pauses = 0;
+	}
+	shm_stats->episode_end = tv_now;
+	shm_stats->episode_pauses++;
+	shm_stats->episode_class = class;
+
+	shm_stats_write_end();
+}
+
+/*
+ * Pause risk predictor
+ */
+static const char *risk_feature_names[RISK_FEATURES] = {
+	"lateness",
+	"lateness_trend",
+	"steal",
+	"steal_trend",
+	"run_delay",
+	"psi_cpu",
+	"psi_memory",
+	"psi_trend",
+};
+
+/*
+ * Load model from file with "name value" lines, where name is bias, feature
+ * name, warn_on or warn_off. Empty lines and lines starting with # are ignored.
+ */
+static void
+risk_model_load(const char *fname)
+{
+	char line[256];
+	char name[64];
+	double value;
+	FILE *f;
+	int lineno;
+	int i;
+
+	f = fopen(fname, "r");
+	if (f == NULL) {
+		err(1, "Can't open pause risk model %s", fname);
+	}
+
+	for (lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+		if (line[strspn(line, " \t\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+			continue;
+		}
+
+		if (sscanf(line, "%63s %lf", name, &value) != 2) {
+			errx(1, "Pause risk model %s:%d is invalid", fname, lineno);
+		}
+
+		if (strcmp(name, "bias") == 0) {
+			risk_model.bias = value;
+		} else if (strcmp(name, "warn_on") == 0) {
+			risk_model.warn_on = value;
+		} else if (strcmp(name, "warn_off") == 0) {
+			risk_model.warn_off = value;
+		} else {
+			for (i = 0; i < RISK_FEATURES; i++) {
+				if (strcmp(name, risk_feature_names[i]) == 0) {
+					risk_model.weights[i] = value;
+					break;
+				}
+			}
+
+			if (i == RISK_FEATURES) {
+				errx(1, "Pause risk model %s:%d has unknown name %s", fname, lineno,
+				    name);
+			}
+		}
+	}
+
+	(void)fclose(f);
+
+	if (risk_model.warn_on <= 0 || risk_model.warn_on > 1 || risk_model.warn_off < 0 ||
+	    risk_model.warn_off > risk_model.warn_on) {
+		errx(1, "Pause risk model %s must have 0 <= warn_off <= warn_on <= 1", fname);
+	}
+}
+
+static void
+risk_init(void)
+{
+
+	if (!risk_enabled) {
+		return ;
+	}
+
+	if (psi_cpu_fd == -1 || psi_memory_fd == -1) {
+		log_printf(LOG_DEBUG, "Can't open /proc/pressure -> kernel without PSI, "
+		    "pressure is not used for pause risk");
+	}
+
+	log_printf(LOG_DEBUG, "Predicting pause risk, warning above %0.2f, cleared below %0.2f",
+	    risk_model.warn_on, risk_model.warn_off);
+}
+
+/*
+ * Fraction of window limited to 0 - 1 so a single pause doesn't dominate averages
+ */
+static double
+risk_fraction(uint64_t part, uint64_t whole)
+{
+
+	if (whole == 0) {
+		return (0);
+	}
+
+	return (part >= whole ? 1.0 : (double)part / whole);
+}
+
+static double
+risk_score_get(const double *features)
+{
+	double z;
+	int i;
+
+	z = risk_model.bias;
+	for (i = 0; i < RISK_FEATURES; i++) {
+		z += risk_model.weights[i] * features[i];
+	}
+
+	return (1.0 / (1.0 + exp(-z)));
+}
+
+/*
+ * Update averages with finished window and compute pause risk. Warning is
+ * raised when risk gets to warn_on and cleared when it drops under warn_off.
+ */
+static void
+risk_update(uint64_t tv_now, uint64_t window, uint64_t lateness, uint64_t steal,
+    uint64_t run_delay, uint64_t timeout)
+{
+	double signals[RISK_SIGNALS];
+	double features[RISK_FEATURES];
+	uint64_t psi_cpu;
+	uint64_t psi_memory;
+	int i;
+
+	if (!risk_enabled) {
+		return ;
+	}
+
+	(void)psi_totals_get(psi_cpu_fd, &psi_cpu, NULL);
+	(void)psi_totals_get(psi_memory_fd, &psi_memory, NULL);
+
+	signals[RISK_SIGNAL_LATENESS] = risk_fraction(lateness, timeout * NO_NS_IN_MSEC);
+	signals[RISK_SIGNAL_STEAL] = risk_fraction(steal, window);
+	signals[RISK_SIGNAL_RUN_DELAY] = risk_fraction(run_delay, window);
+	signals[RISK_SIGNAL_PSI_CPU] = (risk_samples > 0 && psi_cpu >= risk_psi_cpu_prev ?
+	    risk_fraction(psi_cpu - risk_psi_cpu_prev, window) : 0);
+	signals[RISK_SIGNAL_PSI_MEMORY] = (risk_samples > 0 && psi_memory >= risk_psi_memory_prev ?
+	    risk_fraction(psi_memory - risk_psi_memory_prev, window) : 0);
+	risk_psi_cpu_prev = psi_cpu;
+	risk_psi_memory_prev = psi_memory;
+
+	for (i = 0; i < RISK_SIGNALS; i++) {
+		if (risk_samples == 0) {
+			risk_fast[i] = risk_slow[i] = signals[i];
+		} else {
+			risk_fast[i] += (signals[i] - risk_fast[i]) * RISK_ALPHA_FAST;
+			risk_slow[i] += (signals[i] - risk_slow[i]) * RISK_ALPHA_SLOW;
+		}
+	}
+	risk_samples++;
+
+	features[RISK_FEATURE_LATENESS] = risk_fast[RISK_SIGNAL_LATENESS];
+	features[RISK_FEATURE_LATENESS_TREND] = risk_fast[RISK_SIGNAL_LATENESS] -
+	    risk_slow[RISK_SIGNAL_LATENESS];
+	features[RISK_FEATURE_STEAL] = risk_fast[RISK_SIGNAL_STEAL];
+	features[RISK_FEATURE_STEAL_TREND] = risk_fast[RISK_SIGNAL_STEAL] -
+	    risk_slow[RISK_SIGNAL_STEAL];
+	features[RISK_FEATURE_RUN_DELAY] = risk_fast[RISK_SIGNAL_RUN_DELAY];
+	features[RISK_FEATURE_PSI_CPU] = risk_fast[RISK_SIGNAL_PSI_CPU];
+	features[RISK_FEATURE_PSI_MEMORY] = risk_fast[RISK_SIGNAL_PSI_MEMORY];
+	features[RISK_FEATURE_PSI_TREND] = risk_fast[RISK_SIGNAL_PSI_CPU] +
+	    risk_fast[RISK_SIGNAL_PSI_MEMORY] - risk_slow[RISK_SIGNAL_PSI_CPU] -
+	    risk_slow[RISK_SIGNAL_PSI_MEMORY];
+
+	risk_score = risk_score_get(features);
+
+	/*
+	 * Features in model file format, so recorded trace can be used to fit model
+	 */
+	log_printf(LOG_TRACE, "Pause risk %0.4f: lateness %0.4f lateness_trend %0.4f steal %0.4f "
+	    "steal_trend %0.4f run_delay %0.4f psi_cpu %0.4f psi_memory %0.4f psi_trend %0.4f",
+	    risk_score, features[RISK_FEATURE_LATENESS], features[RISK_FEATURE_LATENESS_TREND],
+	    features[RISK_FEATURE_STEAL], features[RISK_FEATURE_STEAL_TREND],
+	    features[RISK_FEATURE_RUN_DELAY], features[RISK_FEATURE_PSI_CPU],
+	    features[RISK_FEATURE_PSI_MEMORY], features[RISK_FEATURE_PSI_TREND]);
+
+	if (risk_samples < RISK_WARMUP_SAMPLES) {
+		return ;
+	}
+
+	if (!risk_warning && risk_score >= risk_model.warn_on) {
+		risk_warning = 1;
+		risk_warning_start = tv_now;
+		times_risk_warning++;
+
+		log_printf(LOG_WARNING, "Pause risk is %0.2f (threshold %0.2f): lateness %0.1f%% of "
+		    "timeout, steal %0.1f%%, runqueue wait %0.1f%%, CPU pressure %0.1f%%, memory "
+		    "pressure %0.1f%%", risk_score, risk_model.warn_on,
+		    risk_fast[RISK_SIGNAL_LATENESS] * 100, risk_fast[RISK_SIGNAL_STEAL] * 100,
+		    risk_fast[RISK_SIGNAL_RUN_DELAY] * 100, risk_fast[RISK_SIGNAL_PSI_CPU] * 100,
+		    risk_fast[RISK_SIGNAL_PSI_MEMORY] * 100);
+	} else if (risk_warning && risk_score < risk_model.warn_off) {
+		risk_warning = 0;
+
+		log_printf(LOG_INFO, "Pause risk dropped to %0.2f after %0.4fs", risk_score,
+		    (double)(tv_now - risk_warning_start) / NO_NS_IN_SEC);
+	}
+}
+
+static void
+risk_statistics_print(void)
+{
+
+	if (!risk_enabled) {
+		return ;
+	}
+
+	log_printf(LOG_INFO, "Pause risk warned %"PRIu64"x, %"PRIu64" of %"PRIu64" pauses "
+	    "happened during warning", times_risk_warning, times_risk_warned_pause,
+	    times_risk_pause);
+}
+
+/*
+ * Wakeup mechanisms
+ */
+static const char *wakeup_mechanism_names[WAKEUP_MECHANISMS] = {
+	"poll",
+	"ppoll",
+	"nanosleep",
+	"timerfd",
+	"futex",
+	"timer",
+};
+
+static int
+wakeup_mechanism_parse(const char *str, enum wakeup_mechanism *mechanism)
+{
+	int i;
+
+	for (i = 0; i < WAKEUP_MECHANISMS; i++) {
+		if (strcasecmp(str, wakeup_mechanism_names[i]) == 0) {
+			*mechanism = i;
+
+			return (0);
+		}
+	}
+
+	return (-1);
+}
+
+static int
+wakeup_mechanism_init(enum wakeup_mechanism mechanism)
+{
+	struct epoll_event ev;
+	struct sigevent sev;
+
+	switch (mechanism) {
+	case WAKEUP_TIMERFD:
+		wakeup_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (wakeup_timer_fd == -1) {
+			return (-1);
+		}
+
+		wakeup_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (wakeup_epoll_fd == -1) {
+			return (-1);
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		if (epoll_ctl(wakeup_epoll_fd, EPOLL_CTL_ADD, wakeup_timer_fd, &ev) == -1) {
+			return (-1);
+		}
+		break;
+	case WAKEUP_TIMER:
+		/*
+		 * Signal is blocked and only accepted by sigwaitinfo
+		 */
+		sigemptyset(&wakeup_sigset);
+		sigaddset(&wakeup_sigset, WAKEUP_TIMER_SIGNAL);
+		if (sigprocmask(SIG_BLOCK, &wakeup_sigset, NULL) == -1) {
+			return (-1);
+		}
+
+		memset(&sev, 0, sizeof(sev));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = WAKEUP_TIMER_SIGNAL;
+		sev.sigev_notify_thread_id = syscall(SYS_gettid);
+		if (timer_create(CLOCK_MONOTONIC, &sev, &wakeup_timer_id) == -1) {
+			return (-1);
+		}
+		wakeup_timer_created = 1;
+		break;
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+/*
+ * Prepare mechanism set by -w (or all of them for rotation). Mechanism which
+ * can't be set up is fatal unless rotating.
+ */
+static void
+wakeup_init(void)
+{
+	char msg[128];
+	int i;
+
+	for (i = 0; i < WAKEUP_MECHANISMS; i++) {
+		wakeup_available[i] = 0;
+
+		if (!wakeup_rotate && i != (int)wakeup_mechanism) {
+			continue;
+		}
+
+		if (wakeup_mechanism_init(i) == -1) {
+			snprintf(msg, sizeof(msg), "Can't set up %s wakeup mechanism",
+			    wakeup_mechanism_names[i]);
+
+			if (!wakeup_rotate) {
+				log_perror(LOG_ERR, msg);
+				exit(1);
+			}
+
+			log_perror(LOG_WARNING, msg);
+			continue;
+		}
+
+		wakeup_available[i] = 1;
+	}
+
+	if (wakeup_rotate) {
+		log_printf(LOG_DEBUG, "Rotating wakeup mechanisms every window");
+	} else if (wakeup_mechanism != WAKEUP_POLL) {
+		log_printf(LOG_DEBUG, "Using %s wakeup mechanism",
+		    wakeup_mechanism_names[wakeup_mechanism]);
+	}
+}
+
+static void
+wakeup_fini(void)
+{
+
+	if (wakeup_timer_created) {
+		(void)timer_delete(wakeup_timer_id);
+		wakeup_timer_created = 0;
+	}
+
+	if (wakeup_epoll_fd != -1) {
+		(void)close(wakeup_epoll_fd);
+		wakeup_epoll_fd = -1;
+	}
+
+	if (wakeup_timer_fd != -1) {
+		(void)close(wakeup_timer_fd);
+		wakeup_timer_fd = -1;
+	}
+}
+
+/*
+ * Return mechanism used for next window
+ */
+static enum wakeup_mechanism
+wakeup_mechanism_next(void)
+{
+	int i;
+
+	if (!wakeup_rotate) {
+		return (wakeup_mechanism);
+	}
+
+	for (i = 0; i < WAKEUP_MECHANISMS; i++) {
+		wakeup_mechanism = (wakeup_mechanism + 1) % WAKEUP_MECHANISMS;
+
+		if (wakeup_available[wakeup_mechanism]) {
+			break;
+		}
+	}
+
+	return (wakeup_mechanism);
+}
+
+/*
+ * Discard timer armed for interrupted sleep so it doesn't end next sleep early
+ */
+static void
+wakeup_timer_cancel(enum wakeup_mechanism mechanism)
+{
+	struct itimerspec its;
+	struct timespec ts;
+
+	memset(&its, 0, sizeof(its));
+
+	if (mechanism == WAKEUP_TIMERFD) {
+		(void)timerfd_settime(wakeup_timer_fd, 0, &its, NULL);
+	} else if (mechanism == WAKEUP_TIMER) {
+		(void)timer_settime(wakeup_timer_id, 0, &its, NULL);
+
+		memset(&ts, 0, sizeof(ts));
+		(void)sigtimedwait(&wakeup_sigset, NULL, &ts);
+	}
+}
+
+/*
+ * Sleep for requested ns (poll_timeout ms for poll) ending at deadline
+ * (CLOCK_MONOTONIC ns) using mechanism. Returns -1 on error (with errno set),
+ * otherwise 0.
+ */
+static int
+wakeup_sleep(enum wakeup_mechanism mechanism, uint64_t deadline, uint64_t requested,
+    int poll_timeout)
+{
+	struct itimerspec its;
+	struct epoll_event ev;
+	struct timespec ts_rel;
+	struct timespec ts_abs;
+	siginfo_t info;
+	int stored_errno;
+	int res;
+
+	ts_rel.tv_sec = requested / NO_NS_IN_SEC;
+	ts_rel.tv_nsec = requested % NO_NS_IN_SEC;
+	ts_abs.tv_sec = deadline / NO_NS_IN_SEC;
+	ts_abs.tv_nsec = deadline % NO_NS_IN_SEC;
+
+	switch (mechanism) {
+	case WAKEUP_POLL:
+		if (memory_inotify_fd != -1) {
+			return (memory_watch_poll(deadline));
+		}
+
+		res = poll(NULL, 0, poll_timeout);
+		break;
+	case WAKEUP_PPOLL:
+		res = ppoll(NULL, 0, &ts_rel, NULL);
+		break;
+	case WAKEUP_NANOSLEEP:
+		res = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts_abs, NULL);
+		if (res != 0) {
+			errno = res;
+			res = -1;
+		}
+		break;
+	case WAKEUP_TIMERFD:
+		/*
+		 * Setting timer resets expiration count, so timerfd doesn't have to be
+		 * read after wakeup
+		 */
+		memset(&its, 0, sizeof(its));
+		its.it_value = ts_abs;
+		if (timerfd_settime(wakeup_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+			return (-1);
+		}
+
+		res = epoll_wait(wakeup_epoll_fd, &ev, 1, -1);
+		break;
+	case WAKEUP_FUTEX:
+		/*
+		 * Same absolute monotonic wait as used by pthread_cond_timedwait
+		 */
+		res = syscall(SYS_futex, &wakeup_futex_word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+		    0, &ts_abs, NULL, FUTEX_BITSET_MATCH_ANY);
+		if (res == -1 && errno == ETIMEDOUT) {
+			res = 0;
+		}
+		break;
+	case WAKEUP_TIMER:
+		memset(&its, 0, sizeof(its));
+		its.it_value = ts_abs;
+		if (timer_settime(wakeup_timer_id, TIMER_ABSTIME, &its, NULL) == -1) {
+			return (-1);
+		}
+
+		res = sigwaitinfo(&wakeup_sigset, &info);
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (res == -1) {
+		stored_errno = errno;
+		if (stored_errno == EINTR) {
+			wakeup_timer_cancel(mechanism);
+		}
+		errno = stored_errno;
+
+		return (-1);
+	}
+
+	/*
+	 * memory.events notifications are handled while sleeping only by poll
+	 */
+	if (mechanism != WAKEUP_POLL && memory_inotify_fd != -1) {
+		(void)memory_watch_poll(0);
+	}
+
+	return (0);
+}
+
+static void
+wakeup_window_add(enum wakeup_mechanism mechanism, uint64_t lateness)
+{
+	struct wakeup_stats *stats;
+
+	stats = &wakeup_stats[mechanism];
+	stats->histogram[lateness_histogram_bucket(lateness)]++;
+	stats->lateness_sum += lateness;
+	if (lateness > stats->lateness_max) {
+		stats->lateness_max = lateness;
+	}
+}
+
+/*
+ * Per mechanism statistics are shown only when mechanisms are rotated or
+ * mechanism other than poll is used
+ */
+static void
+wakeup_statistics_print(void)
+{
+	const struct wakeup_stats *stats;
+	uint64_t samples;
+	int i;
+
+	if (!wakeup_rotate && wakeup_mechanism == WAKEUP_POLL) {
+		return ;
+	}
+
+	for (i = 0; i < WAKEUP_MECHANISMS; i++) {
+		stats = &wakeup_stats[i];
+		samples = lateness_histogram_total(stats->histogram);
+		if (samples == 0) {
+			continue;
+		}
+
+		log_printf(LOG_INFO, "Wakeup mechanism %s: %"PRIu64" samples, mean lateness "
+		    "%0.1fus, max lateness %0.1fus, p99 %"PRIu64"us", wakeup_mechanism_names[i],
+		    samples, (double)stats->lateness_sum / samples / NO_NS_IN_USEC,
+		    (double)stats->lateness_max / NO_NS_IN_USEC,
+		    lateness_histogram_percentile(stats->histogram, 99,
+		    stats->lateness_max / NO_NS_IN_USEC));
+
+		lateness_histogram_print("wakeup mechanism", wakeup_mechanism_names[i],
+		    stats->histogram);
+	}
+}
+
+/*
+ * MAIN FUNCTIONALITY
+ */
+static void
+print_statistics(uint64_t tv_start)
+{
+	struct steal_estimate steal_est;
+	uint64_t tv_diff;
+	uint64_t tv_now;
+
+	tv_now = nano_current_get();
+	tv_diff = tv_now - tv_start;
+	log_printf(LOG_INFO, "During %0.4fs runtime %s was %"PRIu64"x not scheduled on time",
+	    (double)tv_diff / NO_NS_IN_SEC, PROGRAM_NAME, times_not_scheduled);
+	if (memory_watch_count > 0) {
+		log_printf(LOG_INFO, "%"PRIu64" pauses coincided with memory throttling",
+		    times_memory_throttled);
+	}
+	if (steal_span_estimate_get(&steal_est) == 0) {
+		log_printf(LOG_INFO, "Steal time during last %0.4fs is %0.2f%% (95%% CI %0.2f-%0.2f%%, "
+		    "resolution %0.4fs), %"PRIu64" pause steal decisions were uncertain",
+		    (double)steal_est.elapsed / NO_NS_IN_SEC, steal_est.perc, steal_est.perc_low,
+		    steal_est.perc_high, (double)steal_resolution / NO_NS_IN_SEC,
+		    times_steal_uncertain);
+	}
+	lateness_histogram_print(NULL, NULL, lateness_histogram);
+	cpuidle_statistics_print();
+	cpu_schedstat_statistics_print();
+	runq_waiters_statistics_print();
+	clock_check_statistics_print();
+	perf_statistics_print();
+	wakeup_statistics_print();
+	risk_statistics_print();
+	probes_statistics_print();
+	memprobe_statistics_print();
+}
+
+/*
+ * Get CLOCK_REALTIME time of event which happened ago_ns nanoseconds ago.
+ * Used to make pause records alignable between nodes.
+ */
+static void
+realtime_ago_get(uint64_t ago_ns, struct timespec *res)
+{
+	uint64_t rt_ns;
+
+	clock_gettime(CLOCK_REALTIME, res);
+
+	rt_ns = (uint64_t)res->tv_sec * NO_NS_IN_SEC + (uint64_t)res->tv_nsec;
+	rt_ns -= ago_ns;
+
+	res->tv_sec = rt_ns / NO_NS_IN_SEC;
+	res->tv_nsec = rt_ns % NO_NS_IN_SEC;
+}
+
+/*
+ * State passed to re-executed image or stored in state file is wire encoded
+ * statistics snapshot. Runtime is stored instead of start time so it stays valid
+ * after reboot.
+ */
+static int
+state_write_fd(int fd, const uint8_t *buf, size_t len)
+{
+	size_t pos;
+	ssize_t res;
+
+	for (pos = 0; pos < len; pos += res) {
+		res = write(fd, buf + pos, len - pos);
+		if (res == -1) {
+			if (errno == EINTR) {
+				res = 0;
+				continue;
+			}
+
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Read up to buf_size bytes (until EOF). Returns number of bytes read or -1 on error.
+ */
+static ssize_t
+state_read_fd(int fd, uint8_t *buf, size_t buf_size)
+{
+	size_t pos;
+	ssize_t res;
+
+	for (pos = 0; pos < buf_size; pos += res) {
+		res = read(fd, buf + pos, buf_size - pos);
+		if (res == -1) {
+			if (errno == EINTR) {
+				res = 0;
+				continue;
+			}
+
+			return (-1);
+		}
+
+		if (res == 0) {
+			break;
+		}
+	}
+
+	return (pos);
+}
+
+/*
+ * Encode current statistics into buf (SPAUSEDD_STATS_WIRE_MAX_SIZE bytes)
+ */
+static size_t
+state_encode(uint8_t *buf, uint64_t tv_start)
+{
+	struct spausedd_stats stats;
+
+	stats_fill(&stats, tv_start);
+
+	return (spausedd_stats_encode(&stats, buf));
+}
+
+/*
+ * Decode state and apply it. Returns -1 if state is invalid.
+ */
+static int
+state_decode(const uint8_t *buf, size_t len, uint64_t *tv_start)
+{
+	struct spausedd_stats stats;
+
+	if (spausedd_stats_decode(buf, len, &stats) == -1) {
+		return (-1);
+	}
+
+	stats_apply(&stats, tv_start);
+
+	return (0);
+}
+
+/*
+ * Serialize state into memfd and execve ourself. Function returns only if
+ * re-exec failed.
+ */
+static void
+state_reexec(uint64_t tv_start)
+{
+	uint8_t buf[SPAUSEDD_STATS_WIRE_MAX_SIZE];
+	char fd_str[16];
+	sigset_t reload_sigset;
+	int fd;
+
+	if (exe_path[0] == '\0' || access(exe_path, X_OK) == -1) {
+		log_printf(LOG_ERR, "Can't re-execute, executable %s is missing (%s)",
+		    (exe_path[0] == '\0' ? "path" : exe_path), strerror(errno));
+		return ;
+	}
+
+	log_printf(LOG_INFO, "Re-executing %s", exe_path);
+
+	/*
+	 * fd is intentionally not CLOEXEC so it survives execve
+	 */
+	fd = memfd_create(PROGRAM_NAME "-state", 0);
+	if (fd == -1) {
+		log_perror(LOG_ERR, "Can't create memfd for state");
+		return ;
+	}
+
+	if (state_write_fd(fd, buf, state_encode(buf, tv_start)) == -1 ||
+	    lseek(fd, 0, SEEK_SET) == -1) {
+		log_perror(LOG_ERR, "Can't write state into memfd");
+		goto err_close;
+	}
+
+	snprintf(fd_str, sizeof(fd_str), "%d", fd);
+	if (setenv(STATE_FD_ENV, fd_str, 1) == -1) {
+		log_perror(LOG_ERR, "Can't set " STATE_FD_ENV);
+		goto err_close;
+	}
+
+	/*
+	 * New image starts its own probes
+	 */
+	probes_stop();
+	memprobe_stop();
+
+	/*
+	 * Default action of SIGHUP and SIGUSR1 is to terminate, so keep them blocked
+	 * (mask survives execve) until new image registers its handlers
+	 */
+	sigemptyset(&reload_sigset);
+	sigaddset(&reload_sigset, SIGHUP);
+	sigaddset(&reload_sigset, SIGUSR1);
+	(void)sigprocmask(SIG_BLOCK, &reload_sigset, NULL);
+
+	execv(exe_path, saved_argv);
+
+	log_perror(LOG_ERR, "Can't re-execute");
+	(void)sigprocmask(SIG_UNBLOCK, &reload_sigset, NULL);
+	(void)unsetenv(STATE_FD_ENV);
+
+	probes_start(probe_timeout);
+	memprobe_start(memprobe_timeout);
+
+err_close:
+	(void)close(fd);
+}
+
+/*
+ * Return fd with state passed by previous image or -1
+ */
+static int
+state_handoff_fd_get(void)
+{
+	const char *fd_str;
+	long long int tmpll;
+
+	fd_str = getenv(STATE_FD_ENV);
+	if (fd_str == NULL) {
+		return (-1);
+	}
+
+	if (util_strtonum(fd_str, 0, INT_MAX, &tmpll) != 0) {
+		return (-1);
+	}
+
+	return ((int)tmpll);
+}
+
+/*
+ * Load state passed by previous image. Returns 0 on success.
+ */
+static int
+state_handoff_load(int fd, uint64_t *tv_start)
+{
+	uint8_t buf[SPAUSEDD_STATS_WIRE_MAX_SIZE];
+	ssize_t len;
+	int res;
+
+	res = -1;
+	(void)unsetenv(STATE_FD_ENV);
+
+	if ((len = state_read_fd(fd, buf, sizeof(buf))) == -1) {
+		log_perror(LOG_WARNING, "Can't read state passed by previous image");
+	} else if (state_decode(buf, len, tv_start) == -1) {
+		log_printf(LOG_WARNING, "State passed by previous image is incompatible");
+	} else {
+		log_printf(LOG_INFO, "Restored state passed by previous image");
+		res = 0;
+	}
+
+	(void)close(fd);
+
+	return (res);
+}
+
+static void
+state_file_save(uint64_t tv_start)
+{
+	uint8_t buf[SPAUSEDD_STATS_WIRE_MAX_SIZE];
+	char tmp_fname[PATH_MAX];
+	int fd;
+
+	if (snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", state_file) >= (int)sizeof(tmp_fname)) {
+		log_printf(LOG_WARNING, "State file name is too long");
+		return ;
+	}
+
+	fd = open(tmp_fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		log_perror(LOG_WARNING, "Can't open state file for writing");
+		return ;
+	}
+
+	if (state_write_fd(fd, buf, state_encode(buf, tv_start)) == -1) {
+		log_perror(LOG_WARNING, "Can't write state file");
+		(void)close(fd);
+		(void)unlink(tmp_fname);
+		return ;
+	}
+
+	(void)close(fd);
+
+	if (rename(tmp_fname, state_file) == -1) {
+		log_perror(LOG_WARNING, "Can't rename state file");
+		(void)unlink(tmp_fname);
+	}
+}
+
+static void
+state_file_load(uint64_t *tv_start)
+{
+	uint8_t buf[SPAUSEDD_STATS_WIRE_MAX_SIZE];
+	ssize_t len;
+	int fd;
+
+	fd = open(state_file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			log_perror(LOG_WARNING, "Can't open state file");
+		}
+		return ;
+	}
+
+	if ((len = state_read_fd(fd, buf, sizeof(buf))) == -1) {
+		log_perror(LOG_WARNING, "Can't read state file");
+	} else if (state_decode(buf, len, tv_start) == -1) {
+		log_printf(LOG_WARNING, "State file is incompatible, ignoring");
+	} else {
+		log_printf(LOG_INFO, "Restored state from state file %s", state_file);
+	}
+
+	(void)close(fd);
+}
+
+static void
+poll_run(uint64_t timeout, uint64_t tv_start)
+{
+	uint64_t tv_now;
+	uint64_t tv_prev;	// Time before poll syscall
+	uint64_t tv_diff;
+	uint64_t tv_max_allowed_diff;
+	uint64_t tv_state_saved;
+	uint64_t tv_loop_start;
+	uint64_t samples;
+	uint64_t steal_now;
+	uint64_t steal_prev;
+	uint64_t steal_diff;
+	uint64_t tv_requested;
+	uint64_t run_delay_now;
+	uint64_t run_delay_prev;
+	uint64_t run_delay_diff;
+	int run_delay_valid;
+	uint64_t lateness;
+	uint64_t counter_prev;
+	uint64_t counter_now;
+	uint64_t idle_usage_prev[CPUIDLE_MAX_STATES];
+	uint64_t idle_usage_now[CPUIDLE_MAX_STATES];
+	int idle_cpu;
+	int idle_valid;
+	int memory_throttled;
+	int poll_res;
+	enum wakeup_mechanism mechanism;
+	enum clock_anomaly clock_anomaly;
+	enum spausedd_shm_class class;
+	int poll_timeout;
+	double steal_perc;
+	struct steal_estimate steal_est;
+	int steal_exceeded;
+	int steal_uncertain;
+	struct timespec rt_start;
+
+        /* チェック差分、pollタイマー時間、開始nano時間の取得 */
+	tv_max_allowed_diff = timeout * NO_NS_IN_MSEC;
+	poll_timeout = timeout / 3;
+	tv_loop_start = tv_state_saved = nano_current_get();
+	samples = 0;
+
+	log_printf(LOG_INFO, "Running main poll loop with maximum timeout %"PRIu64
+	    " and steal threshold %0.0f%%", timeout, max_steal_threshold);
+
+	while (!stop_main_loop) {
+		/*
+		 * Fetching stealtime can block so get it before monotonic time
+		 */
+		idle_cpu = sched_getcpu();
+		idle_valid = (cpuidle_usage_get(idle_cpu, idle_usage_prev) == 0);
+
+                /* 開始時のsteal,nano時間の取得 */
+		steal_prev = steal_now = nano_stealtime_get();
+		run_delay_valid = (nano_run_delay_get(&run_delay_prev) == 0);
+		clock_pair_get(&tv_prev, &counter_prev);
+		tv_now = tv_prev;
+
+		if (display_statistics) {
+			print_statistics(tv_start);
+
+			display_statistics = 0;
+		}
+
+		if (reexec_requested) {
+			reexec_requested = 0;
+
+			if (state_file != NULL) {
+				state_file_save(tv_start);
+			}
+
+			state_reexec(tv_start);
+		}
+
+		if (state_file != NULL &&
+		    tv_now - tv_state_saved >= STATE_FILE_SAVE_INTERVAL * NO_NS_IN_SEC) {
+			state_file_save(tv_start);
+			tv_state_saved = tv_now;
+		}
+
+		log_printf(LOG_DEBUG, "now = %0.4fs, max_diff = %0.4fs, poll_timeout = %0.4fs, "
+		    "steal_time = %0.4fs",
+		    (double)tv_now / NO_NS_IN_SEC, (double)tv_max_allowed_diff / NO_NS_IN_SEC,
+		    (double)poll_timeout / NO_MSEC_IN_SEC, (double)steal_now / NO_NS_IN_SEC);
+
+		if (poll_timeout < 0) {
+			poll_timeout = 0;
+		}
+		tv_requested = (uint64_t)poll_timeout * NO_NS_IN_MSEC;
+		mechanism = wakeup_mechanism_next();
+		if (memory_inotify_fd != -1) {
+			memory_watch_window_reset();
+		}
+		perf_window_begin(idle_cpu);
+		/* デフォルト200ms/3=66msのタイマーの実行 */
+		poll_res = wakeup_sleep(mechanism, tv_prev + tv_requested, tv_requested,
+		    poll_timeout);
+		if (poll_res == -1) {
+			if (errno != EINTR) {
+				log_perror(LOG_ERR, "Poll error");
+				exit(2);
+			}
+		}
+
+		/*
+		 * Fetching stealtime can block so first get monotonic and then steal time
+		 */
+                /* タイマー完了nano時間の取得と、差分の計算 */
+		clock_pair_get(&tv_now, &counter_now);
+		clock_anomaly = clock_check_window(tv_prev, tv_now, counter_prev, counter_now, &tv_diff);
+		perf_window_end(tv_diff > tv_max_allowed_diff);
+		/* タイマー完了stealの取得　*/
+		steal_now = nano_stealtime_get();
+		steal_diff = steal_now - steal_prev;
+		/*
+		 * Window with failed read has no run_delay
+		 */
+		run_delay_valid = (run_delay_valid && nano_run_delay_get(&run_delay_now) == 0 &&
+		    run_delay_now >= run_delay_prev);
+		run_delay_diff = (run_delay_valid ? run_delay_now - run_delay_prev : 0);
+		cpu_schedstat_update();
+                /* steal差分/nano差分 */
+		steal_estimate_get(steal_diff, tv_diff, &steal_est);
+		steal_perc = steal_est.perc;
+		steal_reading_add(tv_now, steal_now);
+		steal_sustained_check();
+
+		lateness = (tv_diff > tv_requested ? tv_diff - tv_requested : 0);
+		lateness_histogram_add(lateness);
+		wakeup_window_add(mechanism, lateness);
+
+		if (idle_valid && cpuidle_usage_get(idle_cpu, idle_usage_now) == 0) {
+			cpuidle_window_add(idle_usage_prev, idle_usage_now, lateness);
+		}
+		samples++;
+
+		if ((benchmark_samples != 0 && samples >= benchmark_samples) ||
+		    (benchmark_duration != 0 && tv_now - tv_loop_start >= benchmark_duration)) {
+			stop_main_loop = 1;
+		}
+
+//log_printf(LOG_INFO, "max_steal_threshold : %0.1f%%", max_steal_threshold);
+		if (tv_diff > tv_max_allowed_diff) {
+			/* タイマーの経過時間が200msを超えた場合 */
+			realtime_ago_get(tv_diff, &rt_start);
+
+			log_printf(LOG_ERR, "Not scheduled for %0.4fs (threshold is %0.4fs), "
+			    "steal time is %0.4fs (%0.2f%%, 95%% CI %0.2f-%0.2f%%), started at %jd.%06ld",
+			    (double)tv_diff / NO_NS_IN_SEC,
+			    (double)tv_max_allowed_diff / NO_NS_IN_SEC,
+			    (double)steal_diff / NO_NS_IN_SEC,
+			    steal_perc, steal_est.perc_low, steal_est.perc_high,
+			    (intmax_t)rt_start.tv_sec, rt_start.tv_nsec / (long)NO_NS_IN_USEC);
+
+			if (clock_anomaly == CLOCK_ANOMALY_RATE) {
+				log_printf(LOG_WARNING, "Clock rate anomaly during pause, its duration "
+				    "is measured by clock");
+			} else if (clock_anomaly != CLOCK_ANOMALY_NONE) {
+				log_printf(LOG_WARNING, "Clock anomaly during pause, its duration is "
+				    "measured by counter");
+			}
+
+			steal_exceeded = steal_threshold_exceeded(&steal_est, &steal_uncertain);
+			if (steal_uncertain) {
+				times_steal_uncertain++;
+			}
+
+			if (steal_exceeded) {
+                                /* nano単位でのsteal差分が閾値を超えた場合は、steal差分も出力 */
+				log_printf(LOG_WARNING, "Steal time is > %0.1f%%%s, this is usually because "
+				    "of overloaded host machine", max_steal_threshold,
+				    (steal_uncertain ? " (uncertain because of steal counter resolution)" :
+				    ""));
+			}
+
+			if (run_delay_valid) {
+				log_printf(LOG_INFO, "Runqueue wait time is %0.4fs (%0.2f%%)",
+				    (double)run_delay_diff / NO_NS_IN_SEC,
+				    ((double)run_delay_diff / tv_diff) * (double)100);
+
+				if (run_delay_diff * 100 > tv_diff * RUN_DELAY_THRESHOLD) {
+					log_printf(LOG_WARNING, "Runqueue wait time is > %u%%, this is "
+					    "usually because of CPU contention inside of the machine",
+					    RUN_DELAY_THRESHOLD);
+				}
+			}
+
+			cpu_schedstat_pause_report(idle_cpu);
+			runq_waiters_pause_report();
+			perf_pause_report();
+
+			if (risk_enabled) {
+				if (risk_warning) {
+					log_printf(LOG_INFO, "Pause risk warning was active for %0.4fs "
+					    "before pause",
+					    (double)(tv_now - tv_diff - risk_warning_start) / NO_NS_IN_SEC);
+					times_risk_warned_pause++;
+				}
+				times_risk_pause++;
+			}
+
+			memory_throttled = (memory_watch_count > 0 && memory_watch_pause_report());
+			if (memory_throttled) {
+				times_memory_throttled++;
+			}
+			times_not_scheduled++;
+
+			/*
+			 * run_delay has ns resolution so it is preferred when steal
+			 * decision is uncertain
+			 */
+			if (steal_exceeded && !(steal_uncertain && run_delay_valid &&
+			    run_delay_diff * 100 > tv_diff * RUN_DELAY_THRESHOLD)) {
+				class = SPAUSEDD_SHM_CLASS_STEAL;
+			} else if (run_delay_valid &&
+			    run_delay_diff * 100 > tv_diff * RUN_DELAY_THRESHOLD) {
+				class = SPAUSEDD_SHM_CLASS_RUNQUEUE;
+			} else if (memory_throttled) {
+				class = SPAUSEDD_SHM_CLASS_MEMORY;
+			} else {
+				class = SPAUSEDD_SHM_CLASS_UNKNOWN;
+			}
+			pauses_by_class[class]++;
+			pause_duration_sum += tv_diff;
+			pause_steal_sum += steal_diff;
+			pause_run_delay_sum += run_delay_diff;
+			probe_main_event_add(tv_prev, tv_diff);
+			shm_stats_pause_add(tv_now, tv_diff, steal_diff, run_delay_diff, class, idle_cpu);
+		}
+
+		risk_update(tv_now, tv_diff, lateness, steal_diff, run_delay_diff, timeout);
+
+		shm_stats_update(tv_now, tv_start, tv_diff, lateness, steal_diff, run_delay_diff,
+		    idle_cpu);
+
+		if (probe_count > 0) {
+			probes_reap();
+			probes_collect(tv_now - probe_timeout * NO_NS_IN_MSEC);
+		}
+
+		memprobe_collect(tv_now);
+		runq_waiters_update(tv_now);
+	}
+
+	log_printf(LOG_INFO, "Main poll loop stopped");
+	print_statistics(tv_start);
+
+	if (state_file != NULL) {
+		state_file_save(tv_start);
+	}
+}
+
+/*
+ * Benchmark
+ */
+static void
+bench_load_worker_cpu(void)
+{
+
+	for (;;) {
+	}
+}
+
+static void
+bench_load_worker_mem(void)
+{
+	char *mem;
+
+	for (;;) {
+		mem = mmap(NULL, BENCH_MEM_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) {
+			_exit(1);
+		}
+
+		memset(mem, 0xa5, BENCH_MEM_CHUNK_SIZE);
+		(void)munmap(mem, BENCH_MEM_CHUNK_SIZE);
+	}
+}
+
+static void
+bench_load_worker_fork(void)
+{
+	pid_t pid;
+
+	for (;;) {
+		pid = fork();
+		if (pid == 0) {
+			_exit(0);
+		}
+
+		if (pid > 0) {
+			(void)waitpid(pid, NULL, 0);
+		}
+	}
+}
+
+static void
+bench_load_worker_io(void)
+{
+	char fname[] = "/var/tmp/" PROGRAM_NAME "-bench-XXXXXX";
+	char buf[BENCH_IO_CHUNK_SIZE];
+	int fd;
+	int i;
+
+	fd = mkstemp(fname);
+	if (fd == -1) {
+		_exit(1);
+	}
+	(void)unlink(fname);
+
+	memset(buf, 0xa5, sizeof(buf));
+
+	for (;;) {
+		for (i = 0; i < BENCH_IO_FILE_CHUNKS; i++) {
+			if (pwrite(fd, buf, sizeof(buf), (off_t)i * sizeof(buf)) == -1) {
+				_exit(1);
+			}
+		}
+
+		(void)fdatasync(fd);
+	}
+}
+
+/*
+ * Start background load described by spec "type:count[,type:count...]", where
+ * type is one of cpu, mem, fork or io. Workers are started before RR
+ * scheduler is set and memory is locked, so they run as normal processes.
+ */
+static void
+bench_load_start(const char *spec)
+{
+	char buf[256];
+	char *type;
+	char *count_str;
+	char *saveptr;
+	void (*worker_fn)(void);
+	long long int count;
+	pid_t pid;
+	int i;
+
+	if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf)) {
+		errx(1, "Benchmark load %s is too long", spec);
+	}
+
+	for (type = strtok_r(buf, ",", &saveptr); type != NULL;
+	    type = strtok_r(NULL, ",", &saveptr)) {
+		count = 1;
+
+		count_str = strchr(type, ':');
+		if (count_str != NULL) {
+			*count_str++ = '\0';
+
+			if (util_strtonum(count_str, 0, BENCH_MAX_LOAD_WORKERS, &count) != 0) {
+				errx(1, "Benchmark load count %s is invalid", count_str);
+			}
+		}
+
+		if (strcmp(type, "cpu") == 0) {
+			worker_fn = bench_load_worker_cpu;
+		} else if (strcmp(type, "mem") == 0) {
+			worker_fn = bench_load_worker_mem;
+		} else if (strcmp(type, "fork") == 0) {
+			worker_fn = bench_load_worker_fork;
+		} else if (strcmp(type, "io") == 0) {
+			worker_fn = bench_load_worker_io;
+		} else {
+			errx(1, "Benchmark load type %s is invalid", type);
+		}
+
+		for (i = 0; i < count; i++) {
+			if (benchmark_load_workers >= BENCH_MAX_LOAD_WORKERS) {
+				errx(1, "Too many benchmark load workers");
+			}
+
+			pid = fork();
+			if (pid == -1) {
+				err(1, "Can't create benchmark load worker");
+			}
+
+			if (pid == 0) {
+				(void)prctl(PR_SET_PDEATHSIG, SIGKILL);
+				worker_fn();
+				_exit(0);
+			}
+
+			benchmark_load_pids[benchmark_load_workers++] = pid;
+		}
+	}
+}
+
+static void
+bench_load_stop(void)
+{
+	int i;
+
+	for (i = 0; i < benchmark_load_workers; i++) {
+		(void)kill(benchmark_load_pids[i], SIGKILL);
+	}
+
+	for (i = 0; i < benchmark_load_workers; i++) {
+		(void)waitpid(benchmark_load_pids[i], NULL, 0);
+	}
+
+	benchmark_load_workers = 0;
+}
+
+static void
+bench_cpu_model_get(char *buf, size_t buf_size)
+{
+	FILE *f;
+	char line[512];
+	char *value;
+
+	buf[0] = '\0';
+
+	f = fopen("/proc/cpuinfo", "rt");
+	if (f == NULL) {
+		return ;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "model name", strlen("model name")) != 0 &&
+		    strncmp(line, "Hardware", strlen("Hardware")) != 0) {
+			continue;
+		}
+
+		value = strchr(line, ':');
+		if (value == NULL) {
+			continue;
+		}
+
+		value += strspn(value + 1, " \t") + 1;
+		value[strcspn(value, "\n")] = '\0';
+		snprintf(buf, buf_size, "%s", value);
+		break;
+	}
+
+	fclose(f);
+}
+
+static void
+bench_json_string_print(const char *str)
+{
+
+	putchar('"');
+
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			printf("\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			printf("\\u%04x", (unsigned char)*str);
+		} else {
+			putchar(*str);
+		}
+	}
+
+	putchar('"');
+}
+
+/*
+ * Print benchmark result as single JSON object on stdout
+ */
+static void
+bench_result_print(uint64_t timeout, uint64_t tv_start)
+{
+	struct utsname uts;
+	char clocksource[64];
+	char cpu_model[256];
+	struct timespec cpu_time;
+	const char *steal_backend;
+	const char *policy;
+	uint64_t samples;
+	uint64_t samples_total;
+	uint64_t cpu_time_ns;
+	uint64_t max_us;
+	unsigned int i;
+	int j;
+	int k;
+
+	if (uname(&uts) == -1) {
+		memset(&uts, 0, sizeof(uts));
+	}
+
+	utils_file_first_line_get("/sys/devices/system/clocksource/clocksource0/current_clocksource",
+	    clocksource, sizeof(clocksource));
+	bench_cpu_model_get(cpu_model, sizeof(cpu_model));
+
+	steal_backend = "kernel";
+#ifdef HAVE_VMGUESTLIB
+	if (use_vmguestlib_stealtime) {
+		steal_backend = "vmguestlib";
+	}
+#endif
+
+	switch (sched_getscheduler(0)) {
+	case SCHED_RR:
+		policy = "rr";
+		break;
+	case SCHED_FIFO:
+		policy = "fifo";
+		break;
+	default:
+		policy = "other";
+		break;
+	}
+
+	samples = samples_total = lateness_histogram_total(lateness_histogram);
+	max_us = lateness_max / NO_NS_IN_USEC;
+
+	printf("{\"version\": %u, \"environment\": {\"kernel\": ", BENCH_RESULT_VERSION);
+	bench_json_string_print(uts.release);
+	printf(", \"kernel_version\": ");
+	bench_json_string_print(uts.version);
+	printf(", \"machine\": ");
+	bench_json_string_print(uts.machine);
+	printf(", \"clocksource\": ");
+	bench_json_string_print(clocksource);
+	printf(", \"cpu_model\": ");
+	bench_json_string_print(cpu_model);
+	printf(", \"cpus\": %ld, \"steal_backend\": \"%s\", \"policy\": \"%s\"}, ",
+	    sysconf(_SC_NPROCESSORS_ONLN), steal_backend, policy);
+
+	printf("\"config\": {\"timeout_ms\": %"PRIu64", \"poll_timeout_ms\": %"PRIu64
+	    ", \"load\": ", timeout, timeout / 3);
+	bench_json_string_print(benchmark_load != NULL ? benchmark_load : "");
+	printf(", \"pm_qos\": %s, \"wakeup\": \"%s\", \"runq_waiters_interval_s\": %"PRIu64"}, ",
+	    (pm_qos_fd != -1 ? "true" : "false"),
+	    (wakeup_rotate ? "rotate" : wakeup_mechanism_names[wakeup_mechanism]),
+	    runq_waiters_interval);
+
+	printf("\"duration_s\": %0.4f, \"samples\": %"PRIu64", \"times_not_scheduled\": %"PRIu64
+	    ", ", (double)(nano_current_get() - tv_start) / NO_NS_IN_SEC, samples,
+	    times_not_scheduled);
+
+	printf("\"lateness_us\": {\"mean\": %0.1f, \"max\": %"PRIu64", \"p50\": %"PRIu64
+	    ", \"p90\": %"PRIu64", \"p99\": %"PRIu64", \"p999\": %"PRIu64"}, ",
+	    (samples > 0 ? (double)lateness_sum / samples / NO_NS_IN_USEC : 0.0), max_us,
+	    lateness_histogram_percentile(lateness_histogram, 50, max_us),
+	    lateness_histogram_percentile(lateness_histogram, 90, max_us),
+	    lateness_histogram_percentile(lateness_histogram, 99, max_us),
+	    lateness_histogram_percentile(lateness_histogram, 99.9, max_us));
+
+	printf("\"histogram\": [");
+	for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+		printf("%s%"PRIu64, (i > 0 ? ", " : ""), lateness_histogram[i]);
+	}
+	printf("], ");
+
+	printf("\"idle_states\": [");
+	for (j = 0; j <= cpuidle_state_count; j++) {
+		printf("%s{\"name\": ", (j > 0 ? ", " : ""));
+		bench_json_string_print(cpuidle_stats[j].name);
+		printf(", \"exit_latency_us\": %"PRIu64", \"windows\": %"PRIu64
+		    ", \"mean_lateness_us\": %0.1f, \"max_lateness_us\": %0.1f}",
+		    cpuidle_stats[j].exit_latency_us, cpuidle_stats[j].windows,
+		    (cpuidle_stats[j].windows > 0 ? (double)cpuidle_stats[j].lateness_sum /
+		    cpuidle_stats[j].windows / NO_NS_IN_USEC : 0.0),
+		    (double)cpuidle_stats[j].lateness_max / NO_NS_IN_USEC);
+	}
+	printf("], ");
+
+	printf("\"wakeup_mechanisms\": [");
+	for (j = 0, k = 0; j < WAKEUP_MECHANISMS; j++) {
+		samples = lateness_histogram_total(wakeup_stats[j].histogram);
+		if (samples == 0) {
+			continue;
+		}
+
+		max_us = wakeup_stats[j].lateness_max / NO_NS_IN_USEC;
+		printf("%s{\"name\": \"%s\", \"samples\": %"PRIu64", \"mean_us\": %0.1f, \"max_us\": %"
+		    PRIu64", \"p99_us\": %"PRIu64", \"histogram\": [", (k++ > 0 ? ", " : ""),
+		    wakeup_mechanism_names[j], samples,
+		    (double)wakeup_stats[j].lateness_sum / samples / NO_NS_IN_USEC, max_us,
+		    lateness_histogram_percentile(wakeup_stats[j].histogram, 99, max_us));
+		for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+			printf("%s%"PRIu64, (i > 0 ? ", " : ""), wakeup_stats[j].histogram[i]);
+		}
+		printf("]}");
 	}
-#else
-	log_printf(LOG_WARNING, "Platform without sched_get_priority_min");
-#endif
+	printf("], ");
 
-	return (0);
+	printf("\"hot_cpus\": [");
+	for (j = 0, k = 0; j < cpu_schedstat_count; j++) {
+		if (cpu_schedstats[j].hot_windows == 0) {
+			continue;
+		}
+
+		printf("%s{\"cpu\": %d, \"hot_windows\": %"PRIu64", \"max_run_delay_perc\": %0.1f}",
+		    (k++ > 0 ? ", " : ""), j, cpu_schedstats[j].hot_windows,
+		    cpu_schedstats[j].run_delay_perc_max);
+	}
+	printf("], ");
+
+	/*
+	 * CPU time of spausedd process (probes and load workers are other processes)
+	 */
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+	cpu_time_ns = (uint64_t)cpu_time.tv_sec * NO_NS_IN_SEC + cpu_time.tv_nsec;
+	printf("\"overhead\": {\"cpu_time_us\": %"PRIu64", \"cpu_time_us_per_sample\": %0.2f, "
+	    "\"runq_scans\": %"PRIu64", \"runq_scan_tasks_mean\": %"PRIu64", "
+	    "\"runq_scan_cpu_us_mean\": %0.1f, \"runq_scan_cpu_us_max\": %0.1f}}\n",
+	    (uint64_t)(cpu_time_ns / NO_NS_IN_USEC),
+	    (samples_total > 0 ? (double)cpu_time_ns / samples_total / NO_NS_IN_USEC : 0.0),
+	    runq_scans, (runq_scans > 0 ? runq_scan_tasks_sum / runq_scans : 0),
+	    (runq_scans > 0 ? (double)runq_scan_cost_sum / runq_scans / NO_NS_IN_USEC : 0.0),
+	    (double)runq_scan_cost_max / NO_NS_IN_USEC);
+
+	fflush(stdout);
 }
 
-static void
-utils_move_to_root_cgroup(void)
+/*
+ * Find "key": in top-level JSON object and return pointer to value. Keys of
+ * nested objects (like per wakeup mechanism histogram) are skipped.
+ */
+static const char *
+bench_json_value_find(const char *json, const char *key)
+{
+	const char *res;
+	const char *str_start;
+	size_t key_len;
+	int depth;
+
+	key_len = strlen(key);
+	depth = 0;
+
+	for (res = json; *res != '\0'; res++) {
+		switch (*res) {
+		case '{':
+		case '[':
+			depth++;
+			break;
+		case '}':
+		case ']':
+			depth--;
+			break;
+		case '"':
+			str_start = ++res;
+			while (*res != '\0' && *res != '"') {
+				if (*res == '\\' && res[1] != '\0') {
+					res++;
+				}
+				res++;
+			}
+
+			if (*res == '\0') {
+				return (NULL);
+			}
+
+			if (depth == 1 && (size_t)(res - str_start) == key_len &&
+			    strncmp(str_start, key, key_len) == 0 &&
+			    res[1 + strspn(res + 1, " \t\n")] == ':') {
+				res++;
+				res += strspn(res, " \t\n") + 1;
+				res += strspn(res, " \t\n");
+
+				return (res);
+			}
+			break;
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Load benchmark result. cpu_per_sample is -1 for result without overhead.
+ */
+static int
+bench_result_load(const char *fname, uint64_t *histogram, uint64_t *samples,
+    uint64_t *not_scheduled, double *cpu_per_sample)
 {
 	FILE *f;
-	const char *cgroup_task_fname = NULL;
+	char buf[BENCH_RESULT_MAX_SIZE];
+	size_t len;
+	const char *value;
+	char *ep;
+	unsigned int i;
 
-	/*
-	 * /sys/fs/cgroup is hardcoded, because most of Linux distributions are now
-	 * using systemd and systemd uses hardcoded path of cgroup mount point.
-	 *
-	 * This feature is expected to be removed as soon as systemd gets support
-	 * for managing RT configuration.
-	 */
-	f = fopen("/sys/fs/cgroup/cpu/cpu.rt_runtime_us", "rt");
+	f = fopen(fname, "rt");
 	if (f == NULL) {
-		/*
-		 * Try cgroup v2
-		 */
-		f = fopen("/sys/fs/cgroup/cgroup.procs", "rt");
-		if (f == NULL) {
-			log_printf(LOG_DEBUG, "cpu.rt_runtime_us or cgroup.procs doesn't exist -> "
-			    "system without cgroup or with disabled CONFIG_RT_GROUP_SCHED");
+		warn("Can't open %s", fname);
+		return (-1);
+	}
 
-			return ;
-		} else {
-			log_printf(LOG_DEBUG, "Moving main pid to cgroup v2 root cgroup");
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[len] = '\0';
+	fclose(f);
 
-			cgroup_task_fname = "/sys/fs/cgroup/cgroup.procs";
-		}
-	} else {
-		log_printf(LOG_DEBUG, "Moving main pid to cgroup v1 root cgroup");
+	value = bench_json_value_find(buf, "samples");
+	if (value == NULL) {
+		goto err_invalid;
+	}
+	*samples = strtoull(value, NULL, 10);
 
-		cgroup_task_fname = "/sys/fs/cgroup/cpu/tasks";
+	value = bench_json_value_find(buf, "times_not_scheduled");
+	if (value == NULL) {
+		goto err_invalid;
 	}
-	(void)fclose(f);
+	*not_scheduled = strtoull(value, NULL, 10);
 
-	f = fopen(cgroup_task_fname, "w");
-	if (f == NULL) {
-		log_printf(LOG_WARNING, "Can't open cgroups tasks file for writing");
-		return ;
+	value = bench_json_value_find(buf, "histogram");
+	if (value == NULL || *value != '[') {
+		goto err_invalid;
 	}
+	value++;
 
-	if (fprintf(f, "%jd\n", (intmax_t)getpid()) <= 0) {
-		log_printf(LOG_WARNING, "Can't write spausedd pid into cgroups tasks file");
+	for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+		histogram[i] = strtoull(value, &ep, 10);
+		if (ep == value) {
+			goto err_invalid;
+		}
+
+		value = ep + strspn(ep, ", \t\n");
 	}
 
-	if (fclose(f) != 0) {
-		log_printf(LOG_WARNING, "Can't close cgroups tasks file");
-		return ;
+	*cpu_per_sample = -1;
+	value = bench_json_value_find(buf, "overhead");
+	if (value != NULL && *value == '{' &&
+	    (value = bench_json_value_find(value, "cpu_time_us_per_sample")) != NULL) {
+		*cpu_per_sample = strtod(value, NULL);
 	}
+
+	return (0);
+
+err_invalid:
+	warnx("%s is not valid %s benchmark result", fname, PROGRAM_NAME);
+	return (-1);
 }
 
 /*
- * Signal handlers
+ * Two-sample Kolmogorov-Smirnov test on histograms. Returns p-value and stores
+ * D statistic.
  */
-static void
-signal_int_handler(int sig)
+static double
+bench_ks_test(const uint64_t *histogram1, uint64_t n1, const uint64_t *histogram2, uint64_t n2,
+    double *d_stat)
 {
+	double cdf1, cdf2;
+	double d;
+	double n_eff;
+	double lambda;
+	double p_value;
+	double term;
+	unsigned int i;
+	int k;
+
+	cdf1 = cdf2 = d = 0;
+
+	for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+		cdf1 += (double)histogram1[i] / n1;
+		cdf2 += (double)histogram2[i] / n2;
+
+		if (fabs(cdf1 - cdf2) > d) {
+			d = fabs(cdf1 - cdf2);
+		}
+	}
 
-	stop_main_loop = 1;
-}
+	*d_stat = d;
 
-static void
-signal_usr1_handler(int sig)
-{
+	n_eff = sqrt((double)n1 * n2 / (n1 + n2));
+	lambda = (n_eff + 0.12 + 0.11 / n_eff) * d;
 
-	display_statistics = 1;
-}
+	if (lambda < 0.2) {
+		return (1.0);
+	}
 
-static void
-signal_handlers_register(void)
-{
-	struct sigaction act;
+	p_value = 0;
+	for (k = 1; k <= 100; k++) {
+		term = 2 * ((k % 2) ? 1 : -1) * exp(-2.0 * k * k * lambda * lambda);
+		p_value += term;
 
-	act.sa_handler = signal_int_handler;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = 0;
+		if (fabs(term) < 1e-10) {
+			break;
+		}
+	}
 
-	sigaction(SIGINT, &act, NULL);
+	if (p_value < 0) {
+		p_value = 0;
+	}
+	if (p_value > 1) {
+		p_value = 1;
+	}
 
-	act.sa_handler = signal_int_handler;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = 0;
+	return (p_value);
+}
 
-	sigaction(SIGTERM, &act, NULL);
+/*
+ * Two-proportion z-test of pause rates. Returns p-value.
+ */
+static double
+bench_proportion_test(uint64_t x1, uint64_t n1, uint64_t x2, uint64_t n2)
+{
+	double p1, p2, p;
+	double se;
 
-	act.sa_handler = signal_usr1_handler;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = 0;
+	p1 = (double)x1 / n1;
+	p2 = (double)x2 / n2;
+	p = (double)(x1 + x2) / (n1 + n2);
 
-	sigaction(SIGUSR1, &act, NULL);
+	se = sqrt(p * (1 - p) * (1.0 / n1 + 1.0 / n2));
+	if (se == 0) {
+		return (1.0);
+	}
+
+	return (erfc(fabs(p1 - p2) / se / sqrt(2)));
 }
 
 /*
- * Function to get current CLOCK_MONOTONIC in nanoseconds
+ * Compare two benchmark results. Returns exit code.
  */
-static uint64_t
-nano_current_get(void)
+static int
+bench_compare(const char *fname1, const char *fname2)
 {
-	uint64_t res;
-	struct timespec ts;
+	uint64_t histogram1[LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t histogram2[LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t samples1, samples2;
+	uint64_t not_scheduled1, not_scheduled2;
+	double cpu_per_sample1, cpu_per_sample2;
+	double ks_p, ks_d;
+	double rate_p;
+
+	if (bench_result_load(fname1, histogram1, &samples1, &not_scheduled1,
+	    &cpu_per_sample1) == -1 ||
+	    bench_result_load(fname2, histogram2, &samples2, &not_scheduled2,
+	    &cpu_per_sample2) == -1) {
+		return (1);
+	}
 
-	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (samples1 == 0 || samples2 == 0) {
+		warnx("Benchmark result without samples");
+		return (1);
+	}
 
-	res = (uint64_t)(ts.tv_sec * NO_NS_IN_SEC) + (uint64_t)ts.tv_nsec;
-	return (res);
+	ks_p = bench_ks_test(histogram1, samples1, histogram2, samples2, &ks_d);
+	rate_p = bench_proportion_test(not_scheduled1, samples1, not_scheduled2, samples2);
+
+	printf("%-24s %16s %16s\n", "", "A", "B");
+	printf("%-24s %16"PRIu64" %16"PRIu64"\n", "samples", samples1, samples2);
+	printf("%-24s %16"PRIu64" %16"PRIu64"\n", "times_not_scheduled", not_scheduled1,
+	    not_scheduled2);
+	printf("%-24s %16"PRIu64" %16"PRIu64"\n", "p50_us (upper bound)",
+	    lateness_histogram_percentile(histogram1, 50, 0),
+	    lateness_histogram_percentile(histogram2, 50, 0));
+	printf("%-24s %16"PRIu64" %16"PRIu64"\n", "p99_us (upper bound)",
+	    lateness_histogram_percentile(histogram1, 99, 0),
+	    lateness_histogram_percentile(histogram2, 99, 0));
+	if (cpu_per_sample1 >= 0 && cpu_per_sample2 >= 0) {
+		printf("%-24s %16.2f %16.2f\n", "cpu_us_per_sample", cpu_per_sample1,
+		    cpu_per_sample2);
+	}
+	printf("\n");
+	printf("Lateness distribution: KS D = %0.4f, p = %0.4g (%s)\n", ks_d, ks_p,
+	    (ks_p < BENCH_SIGNIFICANCE_LEVEL ? "significant" : "not significant"));
+	printf("Pause rate: p = %0.4g (%s)\n", rate_p,
+	    (rate_p < BENCH_SIGNIFICANCE_LEVEL ? "significant" : "not significant"));
+
+	return (0);
 }
 
 /*
- * Get steal time provided by kernel
+ * Fleet
  */
-static uint64_t
-nano_stealtime_kernel_get(void)
+
+/*
+ * Add node (or find existing one with the same name). Returns index of node or -1
+ * if there are too many nodes.
+ */
+static int
+fleet_node_get(struct fleet *fleet, const char *name)
 {
-	FILE *f;
-	char buf[4096];
-	uint64_t s_user, s_nice, s_system, s_idle, s_iowait, s_irq, s_softirq, s_steal;
-	uint64_t res_steal;
-	long int clock_tick;
-	uint64_t factor;
+	struct fleet_node *node;
+	int i;
 
-	res_steal = 0;
+	for (i = 0; i < fleet->node_count; i++) {
+		if (strcmp(fleet->nodes[i].name, name) == 0) {
+			return (i);
+		}
+	}
 
-	f = fopen("/proc/stat", "rt");
-	if (f == NULL) {
-		return (res_steal);
+	if (fleet->node_count >= FLEET_MAX_NODES) {
+		return (-1);
 	}
 
-	while (fgets(buf, sizeof(buf), f) != NULL) {
-		s_user = s_nice = s_system = s_idle = s_iowait = s_irq = s_softirq = s_steal = 0;
-		if (sscanf(buf, "cpu %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64
-		    " %"PRIu64" %"PRIu64,
-		    &s_user, &s_nice, &s_system, &s_idle, &s_iowait, &s_irq, &s_softirq,
-		    &s_steal) > 4) {
-			/*
-			 * Got valid line
-			 */
-			clock_tick = sysconf(_SC_CLK_TCK);
-			if (clock_tick == -1) {
-				log_printf(LOG_TRACE, "Can't get _SC_CLK_TCK, using 100");
-				clock_tick = 100;
-			}
+	node = &fleet->nodes[fleet->node_count];
+	memset(node, 0, sizeof(*node));
+	snprintf(node->name, sizeof(node->name), "%s", name);
 
-			factor = NO_NS_IN_SEC / clock_tick;
-			res_steal = s_steal * factor;
+	return (fleet->node_count++);
+}
 
-			log_printf(LOG_TRACE, "nano_stealtime_get kernel stats: "
-			    "user = %"PRIu64", nice = %"PRIu64"s, system = %"PRIu64
-			    ", idle = %"PRIu64", iowait = %"PRIu64", irq = %"PRIu64
-			    ", softirq = %"PRIu64", steal = %"PRIu64", factor = %"PRIu64
-			    ", result steal = %"PRIu64,
-			    s_user, s_nice, s_system, s_idle, s_iowait, s_irq, s_softirq, s_steal,
-			    factor, res_steal);
+static int
+fleet_pause_add(struct fleet *fleet, int node, int64_t start_us, uint64_t duration_us)
+{
+	struct fleet_pause *pauses;
+	size_t size;
 
-			break;
+	if (fleet->pause_count == fleet->pause_size) {
+		size = (fleet->pause_size == 0 ? FLEET_PAUSES_INIT_SIZE : fleet->pause_size * 2);
+
+		pauses = realloc(fleet->pauses, size * sizeof(*pauses));
+		if (pauses == NULL) {
+			return (-1);
 		}
+
+		fleet->pauses = pauses;
+		fleet->pause_size = size;
 	}
 
-	fclose(f);
+	fleet->pauses[fleet->pause_count].start_us = start_us;
+	fleet->pauses[fleet->pause_count].duration_us = duration_us;
+	fleet->pauses[fleet->pause_count].node = node;
+	fleet->pause_count++;
+	fleet->nodes[node].pauses++;
 
-	return (res_steal);
+	return (0);
 }
 
 /*
- * Get steal time provided by vmguestlib
+ * Parse pause logged by spausedd ("Not scheduled for D.DDDDs ... started at
+ * S.UUUUUU"). Returns 0 on success or -1 if line is not pause record.
  */
-#ifdef HAVE_VMGUESTLIB
-/* vSphere SDKの場合 */
-static uint64_t
-nano_stealtime_vmguestlib_get(void)
+static int
+fleet_log_line_parse(const char *line, int64_t *start_us, uint64_t *duration_us)
 {
-	VMGuestLibError gl_err;
-	uint64_t stolen_ms;
-	uint64_t res_steal;
-	uint64_t used_ms, elapsed_ms;
-	static uint64_t prev_stolen_ms, prev_used_ms, prev_elapsed_ms;
+	const char *str;
+	char *ep;
+	double duration;
+	long long int sec;
+	long int usec;
 
-	/*
-          仮想マシンに関する情報を更新します。この情報はVMGuestLibHandleに関連付けられています。
-          VMGuestLib_UpdateInfoは、システムコールと同様のCPUリソースを必要とするため、パフォーマンスに影響を与える可能性があります。パフォーマンスが心配な場合は、VMGuestLib_UpdateInfoへの呼び出しの数を最小限に抑えてください。
+	str = strstr(line, FLEET_PAUSE_PREFIX);
+	if (str == NULL) {
+		return (-1);
+	}
 
-          プログラムが複数のスレッドを使用する場合、各スレッドは異なるハンドルを使用する必要があります。それ以外の場合は、更新呼び出しの周りにロックスキームを実装する必要があります。vSphere Guest APIは、ハンドルを使用したアクセスに関する内部ロックを実装していません。
-	*/
-	gl_err = VMGuestLib_UpdateInfo(guestlib_handle);
-	if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
-		log_printf(LOG_WARNING, "Can't update stolen time from guestlib: %s",
-		    VMGuestLib_GetErrorText(gl_err));
+	duration = strtod(str + strlen(FLEET_PAUSE_PREFIX), &ep);
+	if (ep == str + strlen(FLEET_PAUSE_PREFIX) || duration < 0) {
+		return (-1);
+	}
 
-		return (0);
+	str = strstr(ep, FLEET_PAUSE_START);
+	if (str == NULL ||
+	    sscanf(str + strlen(FLEET_PAUSE_START), "%lld.%6ld", &sec, &usec) != 2) {
+		return (-1);
 	}
-        /* 仮想マシンが準備完了状態（実行状態に移行可能）であったが、実行がスケジュールされていなかったミリ秒数を取得 */
-	gl_err = VMGuestLib_GetCpuStolenMs(guestlib_handle, &stolen_ms);
-	if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
-		log_printf(LOG_WARNING, "Can't get stolen time from guestlib: %s",
-		    VMGuestLib_GetErrorText(gl_err));
 
-		return (0);
+	*start_us = (int64_t)sec * (int64_t)NO_USEC_IN_SEC + usec;
+	*duration_us = (uint64_t)(duration * NO_USEC_IN_SEC);
+
+	return (0);
+}
+
+/*
+ * Load file of node. File is either state file (binary statistics snapshot,
+ * merged into node statistics) or log with pause records. Returns 0 on success or
+ * -1 on error.
+ */
+static int
+fleet_file_load(struct fleet *fleet, int node, const char *fname)
+{
+	uint8_t buf[SPAUSEDD_STATS_WIRE_MAX_SIZE];
+	struct spausedd_stats stats;
+	struct fleet_node *fnode;
+	int64_t start_us;
+	uint64_t duration_us;
+	char *line;
+	size_t line_size;
+	size_t len;
+	FILE *f;
+	int res;
+	int i;
+
+	f = fopen(fname, "r");
+	if (f == NULL) {
+		warn("Can't open %s", fname);
+		return (-1);
 	}
 
-	/*
-	 * For debug purpose, returned errors ignored
-	 */
-	used_ms = elapsed_ms = 0;
-        /*
-        仮想マシンがCPUを使用したミリ秒数を取得します。この値には、ゲストオペレーティングシステムによって使用された時間と、この仮想マシンのタスクの仮想化コードによって使用された時間が含まれます。この値を経過時間（VMGuestLib_GetElapsedMs）と組み合わせて、仮想マシンの実効CPU速度を見積もることができます。この値はelapsedMsのサブセットです。 
-        */
-	(void)VMGuestLib_GetCpuUsedMs(guestlib_handle, &used_ms);
-        /* 
-        仮想マシンがサーバー上で最後に実行を開始してから経過したミリ秒数を取得します。経過時間のカウントは、仮想マシンの電源がオンになるか、再開されるか、VMotionを使用して移行されるたびに再開されます。この値は、仮想マシンがその時間中に処理能力を使用しているかどうかに関係なく、ミリ秒をカウントします。この値を仮想マシンが使用するCPU時間（VMGuestLib_GetCpuUsedMs）と組み合わせて、仮想マシンの実効CPU速度を見積もることができます。cpuUsedMSは、この値のサブセットです
-        */
-	(void)VMGuestLib_GetElapsedMs(guestlib_handle, &elapsed_ms);
+	fnode = &fleet->nodes[node];
+	res = 0;
+	len = fread(buf, 1, sizeof(buf), f);
 
-	log_printf(LOG_TRACE, "nano_stealtime_vmguestlib_get stats: "
-	    "stolen = %"PRIu64" (%"PRIu64"), used = %"PRIu64" (%"PRIu64"), "
-	    "elapsed = %"PRIu64" (%"PRIu64")",
-	    stolen_ms, stolen_ms - prev_stolen_ms, used_ms, used_ms - prev_used_ms,
-	    elapsed_ms, elapsed_ms - prev_elapsed_ms);
+	if (len >= SPAUSEDD_STATS_WIRE_MAGIC_LEN &&
+	    memcmp(buf, SPAUSEDD_STATS_WIRE_MAGIC, SPAUSEDD_STATS_WIRE_MAGIC_LEN) == 0) {
+		if (spausedd_stats_decode(buf, len, &stats) == -1) {
+			warnx("%s is not valid %s state file", fname, PROGRAM_NAME);
+			res = -1;
+		} else {
+			/*
+			 * Histograms have fixed buckets so they merge by adding counts
+			 */
+			fnode->snapshots++;
+			fnode->runtime += stats.runtime;
+			fnode->samples += stats.samples;
+			fnode->times_not_scheduled += stats.times_not_scheduled;
+			if (stats.lateness_max > fnode->lateness_max) {
+				fnode->lateness_max = stats.lateness_max;
+			}
+			for (i = 0; i < LATENESS_HISTOGRAM_BUCKETS; i++) {
+				fnode->histogram[i] += stats.lateness_histogram[i];
+			}
+		}
+	} else {
+		rewind(f);
+		line = NULL;
+		line_size = 0;
+
+		while (getline(&line, &line_size, f) != -1) {
+			if (fleet_log_line_parse(line, &start_us, &duration_us) == 0 &&
+			    fleet_pause_add(fleet, node, start_us, duration_us) == -1) {
+				warn("Can't allocate memory");
+				res = -1;
+				break;
+			}
+		}
+
+		free(line);
+	}
+
+	(void)fclose(f);
+
+	return (res);
+}
+
+static int
+fleet_pause_cmp(const void *a, const void *b)
+{
+	const struct fleet_pause *pa = a;
+	const struct fleet_pause *pb = b;
+
+	if (pa->start_us != pb->start_us) {
+		return (pa->start_us < pb->start_us ? -1 : 1);
+	}
 
-	prev_stolen_ms = stolen_ms;
-	prev_used_ms = used_ms;
-	prev_elapsed_ms = elapsed_ms;
+	return ((pa->node > pb->node) - (pa->node < pb->node));
+}
 
-	res_steal = NO_NS_IN_MSEC * stolen_ms;
+static void
+fleet_time_format(int64_t time_us, char *buf, size_t buf_size)
+{
+	struct tm tm;
+	time_t sec;
+	size_t len;
+
+	sec = (time_t)(time_us / (int64_t)NO_USEC_IN_SEC);
+	len = 0;
+	if (gmtime_r(&sec, &tm) != NULL) {
+		len = strftime(buf, buf_size, "%Y-%m-%d %H:%M:%S", &tm);
+	}
 
-	return (res_steal);
+	snprintf(buf + len, buf_size - len, ".%06ld%s", (long)(time_us % (int64_t)NO_USEC_IN_SEC),
+	    (len > 0 ? " UTC" : ""));
 }
-#endif
 
 /*
- * Get steal time
+ * Likelihood (0 - 1) that cluster is caused by shared event rather than by
+ * chance. With independent nodes pausing as Poisson processes, node i pauses
+ * within window of width w with probability p_i = 1 - exp(-rate_i * w). Expected
+ * number of chance coincidences of all cluster nodes during observed span is
+ * (span / w) * product of p_i and likelihood is probability that there was none.
  */
-static uint64_t
-nano_stealtime_get(void)
+static double
+fleet_shared_cause_likelihood(const struct fleet *fleet, const int *cluster_nodes,
+    int count, double window_s, double span_s)
 {
-	uint64_t res;
+	const struct fleet_node *node;
+	double expected;
+	double observed_s;
+	int i;
 
-#ifdef HAVE_VMGUESTLIB
-	if (use_vmguestlib_stealtime) {
-		res = nano_stealtime_vmguestlib_get();
-	} else {
-		res = nano_stealtime_kernel_get();
+	expected = span_s / window_s;
+
+	for (i = 0; i < count; i++) {
+		node = &fleet->nodes[cluster_nodes[i]];
+
+		observed_s = (node->runtime > 0 ? (double)node->runtime / NO_NS_IN_SEC : span_s);
+		if (observed_s < span_s) {
+			observed_s = span_s;
+		}
+
+		expected *= 1.0 - exp(-(double)node->pauses / observed_s * window_s);
 	}
-#else
-	res = nano_stealtime_kernel_get();
-#endif
 
-	return (res);
+	return (exp(-expected));
 }
 
+static void
+fleet_cluster_report(const struct fleet *fleet, const struct fleet_cluster *cluster,
+    const int *cluster_nodes, int64_t skew_us, double span_s)
+{
+	char names[1024];
+	char time_str[64];
+	size_t pos;
+	double window_s;
+	int res;
+	int i;
+
+	pos = 0;
+	names[0] = '\0';
+	for (i = 0; i < cluster->node_count && pos < sizeof(names); i++) {
+		res = snprintf(names + pos, sizeof(names) - pos, "%s%s", (i > 0 ? ", " : ""),
+		    fleet->nodes[cluster_nodes[i]].name);
+		pos += (res > 0 ? (size_t)res : 0);
+	}
+
+	window_s = (double)(cluster->end - cluster->start + 2 * skew_us) / NO_USEC_IN_SEC;
+
+	fleet_time_format(cluster->start, time_str, sizeof(time_str));
+
+	printf("%s: %d of %d nodes paused (%u pauses during %0.4fs, up to %0.4fs), shared "
+	    "cause likelihood %0.1f%%, nodes %s%s\n", time_str, cluster->node_count,
+	    fleet->node_count, cluster->pauses,
+	    (double)(cluster->end - cluster->start) / NO_USEC_IN_SEC,
+	    (double)cluster->duration_max / NO_USEC_IN_SEC,
+	    fleet_shared_cause_likelihood(fleet, cluster_nodes, cluster->node_count, window_s,
+	    span_s) * 100, names, (pos >= sizeof(names) ? " ..." : ""));
+}
 
 /*
- * VMGuestlib
+ * Sort pauses of all nodes by realtime start and sweep them: pause starting
+ * before end of cluster (plus skew) overlaps it and joins cluster. Clusters with
+ * at least min_nodes nodes are reported. Returns number of reported clusters.
  */
-static void
-guestlib_init(void)
+static uint64_t
+fleet_correlate(struct fleet *fleet, int64_t skew_us, int min_nodes)
 {
-#ifdef HAVE_VMGUESTLIB
-/* vSphere SDKの場合 */
-	VMGuestLibError gl_err;
+	struct fleet_cluster cluster;
+	const struct fleet_pause *pause;
+	uint8_t node_seen[FLEET_MAX_NODES];
+	int cluster_nodes[FLEET_MAX_NODES];
+	uint64_t reported;
+	double span_s;
+	size_t i;
+	int j;
+
+	if (fleet->pause_count == 0) {
+		return (0);
+	}
 
-	/*
-他のvSphereGuestAPI関数で使用するためのハンドルを取得します。ゲストライブラリハンドルは、仮想マシンに関する情報にアクセスするためのコンテキストを提供します。仮想マシンの統計と状態データは特定のゲストライブラリハンドルに関連付けられているため、1つのハンドルを使用しても、別のハンドルに関連付けられているデータには影響しません。
-	*/
-	gl_err = VMGuestLib_OpenHandle(&guestlib_handle);
-	if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
-		log_printf(LOG_DEBUG, "Can't open guestlib handle: %s", VMGuestLib_GetErrorText(gl_err));
-		return ;
+	qsort(fleet->pauses, fleet->pause_count, sizeof(*fleet->pauses), fleet_pause_cmp);
+
+	span_s = (double)(fleet->pauses[fleet->pause_count - 1].start_us -
+	    fleet->pauses[0].start_us) / NO_USEC_IN_SEC;
+	if (span_s < 1) {
+		span_s = 1;
 	}
 
-	log_printf(LOG_INFO, "Using VMGuestLib");
+	memset(node_seen, 0, sizeof(node_seen));
+	memset(&cluster, 0, sizeof(cluster));
+	reported = 0;
 
-	use_vmguestlib_stealtime = 1;
+	for (i = 0; i <= fleet->pause_count; i++) {
+		pause = (i < fleet->pause_count ? &fleet->pauses[i] : NULL);
 
-	if (!max_steal_threshold_user_set) {
-//オプションなし時のデフォルト閾値:100
-		max_steal_threshold = DEFAULT_MAX_STEAL_THRESHOLD_GL;
-	}
-#endif
-}
+		if (cluster.pauses > 0 &&
+		    (pause == NULL || pause->start_us > cluster.end + skew_us)) {
+			if (cluster.node_count >= min_nodes) {
+				fleet_cluster_report(fleet, &cluster, cluster_nodes, skew_us, span_s);
+				reported++;
+			}
 
-static void
-guestlib_fini(void)
-{
-#ifdef HAVE_VMGUESTLIB
-	VMGuestLibError gl_err;
+			for (j = 0; j < cluster.node_count; j++) {
+				node_seen[cluster_nodes[j]] = 0;
+			}
+			memset(&cluster, 0, sizeof(cluster));
+		}
 
-	if (use_vmguestlib_stealtime) {
-		/*
-			VMGuestLib_OpenHandleで取得したハンドルを解放します。
-		*/
-		gl_err = VMGuestLib_CloseHandle(guestlib_handle);
+		if (pause == NULL) {
+			break;
+		}
 
-		if (gl_err != VMGUESTLIB_ERROR_SUCCESS) {
-			log_printf(LOG_DEBUG, "Can't close guestlib handle: %s", VMGuestLib_GetErrorText(gl_err));
+		if (cluster.pauses == 0) {
+			cluster.start = pause->start_us;
+		}
+
+		if (pause->start_us + (int64_t)pause->duration_us > cluster.end) {
+			cluster.end = pause->start_us + pause->duration_us;
+		}
+		if (pause->duration_us > cluster.duration_max) {
+			cluster.duration_max = pause->duration_us;
+		}
+		cluster.pauses++;
+
+		if (!node_seen[pause->node]) {
+			node_seen[pause->node] = 1;
+			cluster_nodes[cluster.node_count++] = pause->node;
 		}
 	}
-#endif
+
+	return (reported);
 }
 
 /*
- * MAIN FUNCTIONALITY
+ * Merge statistics of nodes and correlate their pauses. Arguments are
+ * [-k skew_ms] [-m min_nodes] [name=]file... Returns exit code.
  */
-static void
-print_statistics(uint64_t tv_start)
+static int
+fleet_run(int argc, char **argv)
 {
-	uint64_t tv_diff;
-	uint64_t tv_now;
+	struct fleet fleet;
+	uint64_t histogram[LATENESS_HISTOGRAM_BUCKETS];
+	uint64_t samples;
+	uint64_t not_scheduled;
+	uint64_t merged_lateness_max;
+	uint64_t clusters;
+	long long int tmpll;
+	int64_t skew_us;
+	int min_nodes;
+	char buf[LATENESS_HISTOGRAM_BUCKETS * 32];
+	char *name;
+	char *fname;
+	const char *base;
+	int node;
+	int res;
+	int ch;
+	int i;
+	int j;
 
-	tv_now = nano_current_get();
-	tv_diff = tv_now - tv_start;
-	log_printf(LOG_INFO, "During %0.4fs runtime %s was %"PRIu64"x not scheduled on time",
-	    (double)tv_diff / NO_NS_IN_SEC, PROGRAM_NAME, times_not_scheduled);
-}
+	skew_us = FLEET_DEFAULT_SKEW * (int64_t)NO_USEC_IN_MSEC;
+	min_nodes = FLEET_DEFAULT_MIN_NODES;
 
-static void
-poll_run(uint64_t timeout)
-{
-	uint64_t tv_now;
-	uint64_t tv_prev;	// Time before poll syscall
-	uint64_t tv_diff;
-	uint64_t tv_max_allowed_diff;
-	uint64_t tv_start;
-	uint64_t steal_now;
-	uint64_t steal_prev;
-	uint64_t steal_diff;
-	int poll_res;
-	int poll_timeout;
-	double steal_perc;
+	while ((ch = getopt(argc, argv, "k:m:")) != -1) {
+		switch (ch) {
+		case 'k':
+			if (util_strtonum(optarg, 0, FLEET_MAX_SKEW, &tmpll) != 0) {
+				errx(1, "Skew tolerance %s is invalid", optarg);
+			}
+			skew_us = tmpll * (int64_t)NO_USEC_IN_MSEC;
+			break;
+		case 'm':
+			if (util_strtonum(optarg, 2, FLEET_MAX_NODES, &tmpll) != 0) {
+				errx(1, "Minimum number of nodes %s is invalid", optarg);
+			}
+			min_nodes = (int)tmpll;
+			break;
+		default:
+			usage();
+			return (1);
+		}
+	}
 
-        /* チェック差分、pollタイマー時間、開始nano時間の取得 */
-	tv_max_allowed_diff = timeout * NO_NS_IN_MSEC;
-	poll_timeout = timeout / 3;
-	tv_start = nano_current_get();
+	if (optind >= argc) {
+		usage();
+		return (1);
+	}
 
-	log_printf(LOG_INFO, "Running main poll loop with maximum timeout %"PRIu64
-	    " and steal threshold %0.0f%%", timeout, max_steal_threshold);
+	memset(&fleet, 0, sizeof(fleet));
+	fleet.nodes = calloc(FLEET_MAX_NODES, sizeof(*fleet.nodes));
+	if (fleet.nodes == NULL) {
+		err(1, "Can't allocate memory");
+	}
 
-	while (!stop_main_loop) {
+	res = 0;
+	for (i = optind; i < argc; i++) {
 		/*
-		 * Fetching stealtime can block so get it before monotonic time
+		 * Node is named by name= prefix or by base name of file
 		 */
-                /* 開始時のsteal,nano時間の取得 */
-		steal_prev = steal_now = nano_stealtime_get();
-		tv_prev = tv_now = nano_current_get();
+		fname = strchr(argv[i], '=');
+		if (fname != NULL) {
+			name = argv[i];
+			*fname++ = '\0';
+		} else {
+			fname = argv[i];
+			base = strrchr(fname, '/');
+			name = (char *)(base != NULL ? base + 1 : fname);
+		}
 
-		if (display_statistics) {
-			print_statistics(tv_start);
+		node = fleet_node_get(&fleet, name);
+		if (node == -1) {
+			errx(1, "Too many nodes (maximum is %u)", FLEET_MAX_NODES);
+		}
 
-			display_statistics = 0;
+		if (fleet_file_load(&fleet, node, fname) == -1) {
+			res = 1;
 		}
+	}
 
-		log_printf(LOG_DEBUG, "now = %0.4fs, max_diff = %0.4fs, poll_timeout = %0.4fs, "
-		    "steal_time = %0.4fs",
-		    (double)tv_now / NO_NS_IN_SEC, (double)tv_max_allowed_diff / NO_NS_IN_SEC,
-		    (double)poll_timeout / NO_MSEC_IN_SEC, (double)steal_now / NO_NS_IN_SEC);
+	memset(histogram, 0, sizeof(histogram));
+	samples = not_scheduled = merged_lateness_max = 0;
 
-		if (poll_timeout < 0) {
-			poll_timeout = 0;
+	printf("%-32s %12s %12s %16s %14s\n", "node", "pauses", "snapshots", "samples",
+	    "not_scheduled");
+	for (i = 0; i < fleet.node_count; i++) {
+		printf("%-32s %12"PRIu64" %12"PRIu64" %16"PRIu64" %14"PRIu64"\n",
+		    fleet.nodes[i].name, fleet.nodes[i].pauses, fleet.nodes[i].snapshots,
+		    fleet.nodes[i].samples, fleet.nodes[i].times_not_scheduled);
+
+		samples += fleet.nodes[i].samples;
+		not_scheduled += fleet.nodes[i].times_not_scheduled;
+		if (fleet.nodes[i].lateness_max > merged_lateness_max) {
+			merged_lateness_max = fleet.nodes[i].lateness_max;
 		}
-		/* デフォルト200ms/3=66msのタイマーの実行 */
-		poll_res = poll(NULL, 0, poll_timeout);
-		if (poll_res == -1) {
-			if (errno != EINTR) {
-				log_perror(LOG_ERR, "Poll error");
-				exit(2);
-			}
+		for (j = 0; j < LATENESS_HISTOGRAM_BUCKETS; j++) {
+			histogram[j] += fleet.nodes[i].histogram[j];
 		}
+	}
+	printf("\n");
 
-		/*
-		 * Fetching stealtime can block so first get monotonic and then steal time
-		 */
-                /* タイマー完了nano時間の取得と、差分の計算 */
-		tv_now = nano_current_get();
-		tv_diff = tv_now - tv_prev;
-		/* タイマー完了stealの取得　*/
-		steal_now = nano_stealtime_get();
-		steal_diff = steal_now - steal_prev;
-                /* steal差分/nano差分 */
-		steal_perc = ((double)steal_diff / tv_diff) * (double)100;
+	if (samples > 0) {
+		lateness_histogram_format(histogram, buf, sizeof(buf));
+		printf("Merged: %"PRIu64" samples, %"PRIu64" not scheduled, lateness p50 %"PRIu64
+		    "us, p99 %"PRIu64"us, max %"PRIu64"us\n", samples, not_scheduled,
+		    lateness_histogram_percentile(histogram, 50, merged_lateness_max / NO_NS_IN_USEC),
+		    lateness_histogram_percentile(histogram, 99, merged_lateness_max / NO_NS_IN_USEC),
+		    (uint64_t)(merged_lateness_max / NO_NS_IN_USEC));
+		printf("Merged lateness histogram (us):%s\n\n", (buf[0] != '\0' ? buf : " empty"));
+	}
 
-//log_printf(LOG_INFO, "max_steal_threshold : %0.1f%%", max_steal_threshold);
-		if (tv_diff > tv_max_allowed_diff) {
-			/* タイマーの経過時間が200msを超えた場合 */
-			log_printf(LOG_ERR, "Not scheduled for %0.4fs (threshold is %0.4fs), "
-			    "steal time is %0.4fs (%0.2f%%)",
-			    (double)tv_diff / NO_NS_IN_SEC,
-			    (double)tv_max_allowed_diff / NO_NS_IN_SEC,
-			    (double)steal_diff / NO_NS_IN_SEC,
-			    steal_perc);
+	clusters = fleet_correlate(&fleet, skew_us, min_nodes);
+	printf("%"PRIu64" clusters of pauses on at least %d nodes (skew tolerance %0.3fs) in %zu "
+	    "pauses\n", clusters, min_nodes, (double)skew_us / NO_USEC_IN_SEC, fleet.pause_count);
 
-			if (steal_perc > max_steal_threshold) {
-                                /* nano単位でのsteal差分が閾値を超えた場合は、steal差分も出力 */
-				log_printf(LOG_WARNING, "Steal time is > %0.1f%%, this is usually because "
-				    "of overloaded host machine", max_steal_threshold);
-			}
-			times_not_scheduled++;
-		}
-	}
+	free(fleet.pauses);
+	free(fleet.nodes);
 
-	log_printf(LOG_INFO, "Main poll loop stopped");
-	print_statistics(tv_start);
+	return (res);
 }
 
 /*
@@ -702,16 +7892,35 @@ poll_run(uint64_t timeout)
 static void
 usage(void)
 {
-	printf("usage: %s [-dDfhp] [-m steal_th] [-P mode] [-t timeout]\n", PROGRAM_NAME);
+	printf("usage: %s [-cdDefFhpq] [-b duration] [-C cgroup] [-l load] [-m steal_th] [-M cgroup]\n"
+	    "                [-n samples] [-P mode] [-R model] [-s state_file] [-t timeout]\n"
+	    "                [-u uclamp] [-w wakeup] [-W interval]\n",
+	    PROGRAM_NAME);
+	printf("       %s compare result_a result_b\n", PROGRAM_NAME);
+	printf("       %s fleet [-k skew_ms] [-m min_nodes] [name=]file ...\n", PROGRAM_NAME);
 	printf("\n");
+	printf("  -b duration   Benchmark mode - run for duration seconds and print JSON result\n");
+	printf("  -c            Run only on CPUs with highest capacity\n");
+	printf("  -C cgroup     Run additional probe in cgroup (can be used multiple times)\n");
 	printf("  -d            Display debug messages\n");
 	printf("  -D            Run on background - daemonize\n");
+	printf("  -e            Count hardware performance events of probe and its CPU\n");
 	printf("  -f            Run foreground - do not daemonize (default)\n");
+	printf("  -F            Run memory probe measuring page fault latency without locked memory\n");
 	printf("  -h            Show help\n");
+	printf("  -l load       Benchmark background load (cpu:N,mem:N,fork:N,io:N)\n");
 	printf("  -p            Do not set RR scheduler\n");
+	printf("  -q            Hold PM QoS request for zero CPU wakeup latency\n");
 	printf("  -m steal_th   Steal percent threshold\n");
+	printf("  -M cgroup     Watch memory throttling of cgroup (can be used multiple times)\n");
+	printf("  -n samples    Benchmark mode - run for given number of samples and print JSON result\n");
 	printf("  -P mode       Move process to root cgroup only when needed (auto), always (on) or never (off)\n");
+	printf("  -R model      Predict pause risk using model file (or built-in model with default)\n");
+	printf("  -s state_file Periodically save statistics to state_file and restore them on start\n");
 	printf("  -t timeout    Set timeout value (default: %u)\n", DEFAULT_TIMEOUT);
+	printf("  -u min[:max]  Set utilization clamp (0-%u)\n", UCLAMP_MAX_VALUE);
+	printf("  -w wakeup     Sleep by poll (default), ppoll, nanosleep, timerfd, futex, timer or rotate\n");
+	printf("  -W interval   Scan runqueue wait of all tasks every interval seconds and log longest waiters on pause\n");
 }
 
 int
@@ -722,27 +7931,86 @@ main(int argc, char **argv)
 	long long int tmpll;
 	uint64_t timeout;
 	int set_prio;
+	int set_capacity_affinity;
+	int hold_pm_qos;
+	int set_uclamp;
+	uint32_t uclamp_min;
+	uint32_t uclamp_max;
+	char uclamp_buf[32];
+	char *uclamp_max_str;
 	enum move_to_root_cgroup_mode move_to_root_cgroup;
 	int silent;
+	int state_fd;
+	uint64_t tv_start;
+	ssize_t exe_path_len;
+
+	if (argc == 4 && strcmp(argv[1], "compare") == 0) {
+		return (bench_compare(argv[2], argv[3]));
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "fleet") == 0) {
+		return (fleet_run(argc - 1, argv + 1));
+	}
 
 	foreground = 1;
 	timeout = DEFAULT_TIMEOUT;
 	set_prio = 1;
+	set_capacity_affinity = 0;
+	hold_pm_qos = 0;
+	set_uclamp = 0;
+	uclamp_min = 0;
+	uclamp_max = UCLAMP_MAX_VALUE;
 	move_to_root_cgroup = MOVE_TO_ROOT_CGROUP_MODE_AUTO;
 	max_steal_threshold = DEFAULT_MAX_STEAL_THRESHOLD;
 	max_steal_threshold_user_set = 0;
 
-	while ((ch = getopt(argc, argv, "dDfhpm:P:t:")) != -1) {
+	while ((ch = getopt(argc, argv, "cdDefFhpqb:C:l:m:M:n:P:R:s:t:u:w:W:")) != -1) {
 		switch (ch) {
+		case 'b':
+			if (util_strtonum(optarg, 1, UINT32_MAX, &tmpll) != 0) {
+				errx(1, "Benchmark duration %s is invalid", optarg);
+			}
+			benchmark_duration = (uint64_t)tmpll * NO_NS_IN_SEC;
+			break;
+		case 'c':
+			set_capacity_affinity = 1;
+			break;
+		case 'C':
+			if (probe_cgroups_count >= PROBE_MAX) {
+				errx(1, "Too many probe cgroups");
+			}
+			probe_cgroups[probe_cgroups_count++] = optarg;
+			break;
 		case 'D':
 			foreground = 0;
 			break;
 		case 'd':
 			log_debug++;
 			break;
+		case 'e':
+			perf_enabled = 1;
+			break;
 		case 'f':
 			foreground = 1;
 			break;
+		case 'F':
+			memprobe_enabled = 1;
+			break;
+		case 'l':
+			benchmark_load = optarg;
+			break;
+		case 'M':
+			if (memory_watch_dirs_count >= MEMORY_WATCH_MAX - 1) {
+				errx(1, "Too many watched cgroups");
+			}
+			memory_watch_dirs[memory_watch_dirs_count++] = optarg;
+			break;
+		case 'n':
+			if (util_strtonum(optarg, 1, LLONG_MAX, &tmpll) != 0) {
+				errx(1, "Benchmark sample count %s is invalid", optarg);
+			}
+			benchmark_samples = (uint64_t)tmpll;
+			break;
 		case 'm':
 			if (util_strtonum(optarg, 1, UINT32_MAX, &tmpll) != 0) {
 				errx(1, "Steal percent threshold %s is invalid", optarg);
@@ -750,6 +8018,12 @@ main(int argc, char **argv)
 			max_steal_threshold_user_set = 1;
 			max_steal_threshold = tmpll;
 			break;
+		case 'R':
+			risk_enabled = 1;
+			if (strcmp(optarg, "default") != 0) {
+				risk_model_load(optarg);
+			}
+			break;
 		case 't':
 			if (util_strtonum(optarg, 1, MAX_TIMEOUT, &tmpll) != 0) {
 				errx(1, "Timeout %s is invalid", optarg);
@@ -776,21 +8050,143 @@ main(int argc, char **argv)
 		case 'p':
 			set_prio = 0;
 			break;
+		case 'q':
+			hold_pm_qos = 1;
+			break;
+		case 's':
+			state_file = optarg;
+			break;
+		case 'u':
+			/*
+			 * argv is reused by re-exec so it must stay unmodified
+			 */
+			if (snprintf(uclamp_buf, sizeof(uclamp_buf), "%s", optarg) >=
+			    (int)sizeof(uclamp_buf)) {
+				errx(1, "Utilization clamp %s is invalid", optarg);
+			}
+
+			uclamp_max_str = strchr(uclamp_buf, ':');
+			if (uclamp_max_str != NULL) {
+				*uclamp_max_str++ = '\0';
+
+				if (util_strtonum(uclamp_max_str, 0, UCLAMP_MAX_VALUE, &tmpll) != 0) {
+					errx(1, "Utilization clamp max %s is invalid", uclamp_max_str);
+				}
+				uclamp_max = (uint32_t)tmpll;
+			}
+
+			if (util_strtonum(uclamp_buf, 0, uclamp_max, &tmpll) != 0) {
+				errx(1, "Utilization clamp min %s is invalid", uclamp_buf);
+			}
+			uclamp_min = (uint32_t)tmpll;
+			set_uclamp = 1;
+			break;
+		case 'w':
+			if (strcasecmp(optarg, "rotate") == 0) {
+				wakeup_rotate = 1;
+			} else if (wakeup_mechanism_parse(optarg, &wakeup_mechanism) != 0) {
+				errx(1, "Wakeup mechanism %s is invalid", optarg);
+			}
+			break;
+		case 'W':
+			if (util_strtonum(optarg, 1, RUNQ_WAITERS_MAX_INTERVAL, &tmpll) != 0) {
+				errx(1, "Runqueue waiters scan interval %s is invalid", optarg);
+			}
+			runq_waiters_interval = (uint64_t)tmpll;
+			break;
 		default:
 			errx(1, "Unhandled option %c", ch);
 		}
 	}
 
+	if (benchmark_load != NULL && benchmark_duration == 0 && benchmark_samples == 0) {
+		errx(1, "Benchmark load can be used only in benchmark mode");
+	}
+
+	if (benchmark_duration != 0 || benchmark_samples != 0) {
+		/*
+		 * Benchmark result is printed on stdout and must not be mixed with
+		 * previous statistics
+		 */
+		foreground = 1;
+		state_file = NULL;
+	}
+
+	saved_argv = argv;
+	exe_path_len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+	if (exe_path_len == -1) {
+		exe_path_len = 0;
+	}
+	exe_path[exe_path_len] = '\0';
+	if ((size_t)exe_path_len > strlen(EXE_PATH_DELETED_SUFFIX) &&
+	    strcmp(exe_path + exe_path_len - strlen(EXE_PATH_DELETED_SUFFIX),
+	    EXE_PATH_DELETED_SUFFIX) == 0) {
+		exe_path[exe_path_len - strlen(EXE_PATH_DELETED_SUFFIX)] = '\0';
+	}
+
+	/*
+	 * Re-executed image is already detached
+	 */
+	state_fd = state_handoff_fd_get();
+
 	if (foreground) {
 		log_to_stderr = 1;
 	} else {
 		log_to_syslog = 1;
-		utils_tty_detach();
+		if (state_fd == -1) {
+			utils_tty_detach();
+		}
 		openlog(PROGRAM_NAME, LOG_PID, LOG_DAEMON);
 	}
 
+	tv_start = nano_current_get();
+	if (state_fd != -1) {
+		if (state_handoff_load(state_fd, &tv_start) == -1 && state_file != NULL) {
+			state_file_load(&tv_start);
+		}
+	} else if (state_file != NULL) {
+		state_file_load(&tv_start);
+	}
+
+	if (benchmark_load != NULL) {
+		/*
+		 * Start load before memory is locked and RR scheduler is set so workers
+		 * don't inherit them
+		 */
+		bench_load_start(benchmark_load);
+	}
+
 	utils_mlockall();
 
+	cgroup_discover();
+	guestlib_init();
+	steal_estimator_init();
+	clock_check_init();
+	schedstat_init();
+	cpu_schedstat_init();
+	runq_waiters_init();
+
+	if (set_uclamp) {
+		(void)utils_set_uclamp(uclamp_min, uclamp_max);
+	}
+
+	if (set_capacity_affinity) {
+		(void)utils_set_capacity_affinity();
+	}
+
+	signal_handlers_register();
+
+	memory_watch_init();
+	cpuidle_init();
+	perf_init();
+	wakeup_init();
+	psi_init();
+	risk_init();
+
+	/*
+	 * RT runtime reservation measures main loop iteration, so window sources
+	 * must be initialized first
+	 */
 	if (move_to_root_cgroup == MOVE_TO_ROOT_CGROUP_MODE_ON) {
 		utils_move_to_root_cgroup();
 	}
@@ -801,20 +8197,52 @@ main(int argc, char **argv)
 		if (utils_set_rr_scheduler(silent) == -1 &&
 		    move_to_root_cgroup == MOVE_TO_ROOT_CGROUP_MODE_AUTO) {
 			/*
-			 * Try to move process to root cgroup and try set priority again
+			 * Try to reserve RT runtime in our own cgroup first and only if it
+			 * fails move process to root cgroup and try set priority again
 			 */
-			utils_move_to_root_cgroup();
+			if (utils_reserve_rt_runtime(timeout) == -1 ||
+			    utils_set_rr_scheduler(1) == -1) {
+				utils_release_rt_runtime();
+				utils_move_to_root_cgroup();
 
-			(void)utils_set_rr_scheduler(0);
+				(void)utils_set_rr_scheduler(0);
+			}
 		}
 	}
 
-	signal_handlers_register();
+	if (hold_pm_qos) {
+		pm_qos_hold();
+	}
 
-	guestlib_init();
+	/*
+	 * Benchmark run must not replace page of running daemon
+	 */
+	if (benchmark_duration == 0 && benchmark_samples == 0) {
+		shm_stats_init(timeout, tv_start);
+	}
+	probes_start(timeout);
+	memprobe_start(timeout);
 	/* タイマー実行ループ */
-	poll_run(timeout);
+	poll_run(timeout, tv_start);
+
+	probes_stop();
+	memprobe_stop();
+
+	if (benchmark_duration != 0 || benchmark_samples != 0) {
+		bench_load_stop();
+		bench_result_print(timeout, tv_start);
+	}
 
+	shm_stats_fini();
+	pm_qos_release();
+	psi_fini();
+	wakeup_fini();
+	perf_fini();
+	cpuidle_fini();
+	memory_watch_fini();
+	runq_waiters_fini();
+	cpu_schedstat_fini();
+	schedstat_fini();
 	guestlib_fini();
 
 	if (!foreground) {
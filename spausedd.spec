@@ -63,6 +63,7 @@ install -m 755 -p init/%{name} %{buildroot}/%{_initrddir}
 %doc AUTHORS
 %license COPYING
 %{_bindir}/%{name}
+%{_bindir}/spausedtop
 %{_mandir}/man8/*
 %if %{with systemd}
 %{_unitdir}/spausedd.service
@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2018-2021, Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND RED HAT, INC. DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL RED HAT, INC. BE LIABLE
+ * FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Author: Jan Friesse <jfriesse@redhat.com>
+ */
+
+/*
+ * Binary interface of spausedd statistics: versioned statistics snapshot, its
+ * wire encoding and layout of shared statistics page read by spausedtop
+ */
+
+#ifndef _SPAUSEDD_SHM_H_
+#define _SPAUSEDD_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SPAUSEDD_SHM_NAME		"/spausedd"
+
+#define SPAUSEDD_SHM_MAGIC		0x53505348	/* "SPSH" */
+#define SPAUSEDD_SHM_VERSION		5
+
+#define SPAUSEDD_SHM_MAX_CPUS		1024
+#define SPAUSEDD_SHM_RECENT_PAUSES	16
+
+/*
+ * Maximum number of attempts to get consistent copy of data protected by seqlock
+ */
+#define SPAUSEDD_SEQLOCK_RETRIES	1000
+
+#define SPAUSEDD_STATS_VERSION		2
+
+/*
+ * Bucket 0 holds lateness < 1us, bucket i holds lateness in [2^(i-1), 2^i) us
+ * and last bucket holds everything larger
+ */
+#define SPAUSEDD_STATS_HISTOGRAM_BUCKETS	24
+
+/*
+ * Number of pause classes (enum spausedd_shm_class)
+ */
+#define SPAUSEDD_STATS_CLASSES		5
+
+/*
+ * Number of hardware performance events (enum spausedd_shm_perf_event)
+ */
+#define SPAUSEDD_SHM_PERF_EVENTS	4
+
+#define SPAUSEDD_STATS_WIRE_MAGIC	"SPST"
+#define SPAUSEDD_STATS_WIRE_MAGIC_LEN	4
+
+/*
+ * Most likely cause of pause
+ */
+enum spausedd_shm_class {
+	SPAUSEDD_SHM_CLASS_NONE = 0,
+	SPAUSEDD_SHM_CLASS_UNKNOWN = 1,
+	SPAUSEDD_SHM_CLASS_STEAL = 2,
+	SPAUSEDD_SHM_CLASS_RUNQUEUE = 3,
+	SPAUSEDD_SHM_CLASS_MEMORY = 4,
+};
+
+/*
+ * Hardware performance events counted by -e. Bit (1 << event) of perf masks is set
+ * when event is counted.
+ */
+enum spausedd_shm_perf_event {
+	SPAUSEDD_SHM_PERF_CYCLES = 0,
+	SPAUSEDD_SHM_PERF_INSTRUCTIONS = 1,
+	SPAUSEDD_SHM_PERF_LLC_MISSES = 2,
+	SPAUSEDD_SHM_PERF_STALLED_CYCLES = 3,
+};
+
+/*
+ * State of pause risk predictor (-R)
+ */
+enum spausedd_shm_risk_state {
+	SPAUSEDD_SHM_RISK_DISABLED = 0,
+	SPAUSEDD_SHM_RISK_NORMAL = 1,
+	SPAUSEDD_SHM_RISK_WARNING = 2,
+};
+
+/*
+ * Statistics snapshot. Layout is fixed: version and size are followed only by
+ * uint64_t fields. New fields are appended (and version increased) so older
+ * consumers keep working. Times are in ns.
+ */
+struct spausedd_stats {
+	uint32_t version;
+	uint32_t size;
+	uint64_t runtime;
+	uint64_t samples;
+	uint64_t times_not_scheduled;
+	uint64_t times_memory_throttled;
+	uint64_t times_steal_uncertain;
+	uint64_t lateness_sum;
+	uint64_t lateness_max;
+	uint64_t pause_duration_sum;
+	uint64_t pause_steal_sum;
+	uint64_t pause_run_delay_sum;
+	uint64_t pauses_by_class[SPAUSEDD_STATS_CLASSES];
+	uint64_t lateness_histogram[SPAUSEDD_STATS_HISTOGRAM_BUCKETS];
+	uint64_t times_clock_backwards;
+	uint64_t times_clock_jump;
+	uint64_t times_clock_rate;
+};
+
+#define SPAUSEDD_STATS_FIELDS_OFFSET	offsetof(struct spausedd_stats, runtime)
+#define SPAUSEDD_STATS_FIELDS		((sizeof(struct spausedd_stats) - \
+    SPAUSEDD_STATS_FIELDS_OFFSET) / sizeof(uint64_t))
+
+_Static_assert(offsetof(struct spausedd_stats, runtime) == 2 * sizeof(uint32_t) &&
+    sizeof(struct spausedd_stats) % sizeof(uint64_t) == 0,
+    "struct spausedd_stats must contain only uint64_t fields after header");
+
+/*
+ * Maximum size of wire encoded snapshot (magic, version, number of fields and
+ * fields, every number takes at most 10 bytes)
+ */
+#define SPAUSEDD_STATS_WIRE_MAX_SIZE	(SPAUSEDD_STATS_WIRE_MAGIC_LEN + \
+    10 * (2 + SPAUSEDD_STATS_FIELDS))
+
+struct spausedd_shm_pause {
+	int64_t rt_start_sec;
+	int64_t rt_start_nsec;
+	uint64_t duration;
+	uint64_t steal;
+	uint64_t run_delay;
+	uint32_t class;
+	int32_t cpu;
+	uint32_t perf_mask;
+	uint32_t perf_cpu_mask;
+	uint64_t perf[SPAUSEDD_SHM_PERF_EVENTS];
+	uint64_t perf_cpu[SPAUSEDD_SHM_PERF_EVENTS];
+};
+
+/*
+ * Lateness of samples taken on CPU and runqueue wait of CPU during last window
+ * (both in ns)
+ */
+struct spausedd_shm_cpu {
+	uint64_t samples;
+	uint64_t lateness_sum;
+	uint64_t lateness_last;
+	uint64_t run_delay;
+};
+
+/*
+ * Page is updated once per main loop iteration. seq is odd while page is being
+ * updated, reader has to copy page (or its part) and retry if seq changed during
+ * copy. Times are in ns, updated and episode_start are CLOCK_MONOTONIC. Episode is
+ * sequence of pauses with less than episode_gap between them. recent_pauses is
+ * ring indexed by pauses_total % SPAUSEDD_SHM_RECENT_PAUSES. window_perf are
+ * hardware counters of spausedd thread and window_perf_cpu of CPU it started last
+ * window on (window_perf_cpu_id). pause_risk is risk computed by predictor after
+ * last window in per mille.
+ *
+ * New fields are appended before stats (and version increased), layout of
+ * spausedd_shm_pause and spausedd_shm_cpu is fixed. Snapshot is always last and
+ * it is found at stats_offset, so consumer built with older header reads known
+ * prefix of page and of snapshot (see spausedd_shm_copy).
+ */
+struct spausedd_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t seq;
+	uint32_t stats_offset;
+	uint32_t stats_size;
+	int64_t pid;
+	uint64_t timeout;
+	uint64_t updated;
+	uint64_t lateness_last;
+	uint64_t window;
+	uint64_t window_steal;
+	uint64_t window_run_delay;
+	uint64_t steal_threshold;
+	uint64_t episode_gap;
+	uint64_t episode_start;
+	uint64_t episode_end;
+	uint64_t episode_pauses;
+	uint32_t episode_class;
+	uint32_t cpu_count;
+	uint64_t pauses_total;
+	uint32_t window_perf_mask;
+	uint32_t window_perf_cpu_mask;
+	int32_t window_perf_cpu_id;
+	uint32_t reserved;
+	uint64_t window_perf[SPAUSEDD_SHM_PERF_EVENTS];
+	uint64_t window_perf_cpu[SPAUSEDD_SHM_PERF_EVENTS];
+	uint32_t pause_risk;
+	uint32_t pause_risk_state;
+	struct spausedd_shm_pause recent_pauses[SPAUSEDD_SHM_RECENT_PAUSES];
+	struct spausedd_shm_cpu cpus[SPAUSEDD_SHM_MAX_CPUS];
+	struct spausedd_stats stats;
+};
+
+#define SPAUSEDD_SHM_FIELDS_SIZE	offsetof(struct spausedd_shm, stats)
+
+static inline const char *
+spausedd_shm_class_str(uint32_t class)
+{
+
+	switch (class) {
+	case SPAUSEDD_SHM_CLASS_NONE:
+		return ("none");
+	case SPAUSEDD_SHM_CLASS_UNKNOWN:
+		return ("unknown");
+	case SPAUSEDD_SHM_CLASS_STEAL:
+		return ("steal");
+	case SPAUSEDD_SHM_CLASS_RUNQUEUE:
+		return ("runqueue");
+	case SPAUSEDD_SHM_CLASS_MEMORY:
+		return ("memory");
+	}
+
+	return ("invalid");
+}
+
+/*
+ * Copy size bytes from src protected by seqlock seq into dst. Writer is never
+ * blocked, copy is retried if data was updated in the meantime. Returns 0 on
+ * success or -1 if consistent copy was not obtained.
+ */
+static inline int
+spausedd_seqlock_copy(const uint32_t *seq, void *dst, const void *src, size_t size)
+{
+	uint32_t seq_start;
+	int i;
+
+	for (i = 0; i < SPAUSEDD_SEQLOCK_RETRIES; i++) {
+		seq_start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (seq_start & 1) {
+			continue;
+		}
+
+		memcpy(dst, src, size);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(seq, __ATOMIC_RELAXED) == seq_start) {
+			return (0);
+		}
+	}
+
+	return (-1);
+}
+
+/*
+ * Check header of shared page mapped with mapped_size bytes. Page written by
+ * newer spausedd is accepted, its unknown fields are ignored. Returns 0 if page
+ * is valid or -1 otherwise.
+ */
+static inline int
+spausedd_shm_check(const struct spausedd_shm *shm, size_t mapped_size)
+{
+
+	if (shm->magic != SPAUSEDD_SHM_MAGIC || shm->version < SPAUSEDD_SHM_VERSION ||
+	    shm->size > mapped_size || shm->stats_offset < SPAUSEDD_SHM_FIELDS_SIZE ||
+	    shm->stats_size < sizeof(struct spausedd_stats) ||
+	    (size_t)shm->stats_offset + shm->stats_size > shm->size) {
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Make snapshot copied from page of newer spausedd look as snapshot of this
+ * version. Returns 0 on success or -1 if snapshot is not valid.
+ */
+static inline int
+spausedd_stats_known_prefix(struct spausedd_stats *stats)
+{
+
+	if (stats->version < SPAUSEDD_STATS_VERSION || stats->size < sizeof(*stats)) {
+		return (-1);
+	}
+
+	stats->version = SPAUSEDD_STATS_VERSION;
+	stats->size = sizeof(*stats);
+
+	return (0);
+}
+
+/*
+ * Consistently copy statistics snapshot out of shared page mapped with
+ * mapped_size bytes
+ */
+static inline int
+spausedd_stats_copy(const struct spausedd_shm *shm, size_t mapped_size,
+    struct spausedd_stats *dst)
+{
+
+	if (spausedd_shm_check(shm, mapped_size) == -1) {
+		return (-1);
+	}
+
+	if (spausedd_seqlock_copy(&shm->seq, dst, (const char *)shm + shm->stats_offset,
+	    sizeof(*dst)) == -1) {
+		return (-1);
+	}
+
+	return (spausedd_stats_known_prefix(dst));
+}
+
+/*
+ * Consistently copy known prefix of shared page mapped with mapped_size bytes into
+ * dst. buf must have at least mapped_size bytes. Returns 0 on success, -1 if page
+ * is not valid or consistent copy was not obtained.
+ */
+static inline int
+spausedd_shm_copy(const struct spausedd_shm *shm, size_t mapped_size, void *buf,
+    struct spausedd_shm *dst)
+{
+	const struct spausedd_shm *copy;
+
+	if (spausedd_shm_check(shm, mapped_size) == -1) {
+		return (-1);
+	}
+
+	if (spausedd_seqlock_copy(&shm->seq, buf, shm, shm->size) == -1) {
+		return (-1);
+	}
+
+	/*
+	 * Header is never changed after page is created, but check copy anyway
+	 */
+	copy = buf;
+	if (spausedd_shm_check(copy, mapped_size) == -1) {
+		return (-1);
+	}
+
+	memcpy(dst, copy, SPAUSEDD_SHM_FIELDS_SIZE);
+	memcpy(&dst->stats, (const char *)copy + copy->stats_offset, sizeof(dst->stats));
+	dst->size = sizeof(*dst);
+	dst->stats_offset = SPAUSEDD_SHM_FIELDS_SIZE;
+	dst->stats_size = sizeof(dst->stats);
+
+	return (spausedd_stats_known_prefix(&dst->stats));
+}
+
+static inline size_t
+spausedd_wire_varint_put(uint8_t *buf, uint64_t val)
+{
+	size_t len;
+
+	for (len = 0; val >= 0x80; len++) {
+		buf[len] = (uint8_t)(val | 0x80);
+		val >>= 7;
+	}
+	buf[len++] = (uint8_t)val;
+
+	return (len);
+}
+
+/*
+ * Returns number of bytes used or 0 on error
+ */
+static inline size_t
+spausedd_wire_varint_get(const uint8_t *buf, size_t buf_len, uint64_t *val)
+{
+	size_t len;
+	unsigned int shift;
+
+	*val = 0;
+
+	for (len = 0, shift = 0; len < buf_len && shift < 64; len++, shift += 7) {
+		*val |= (uint64_t)(buf[len] & 0x7f) << shift;
+
+		if (!(buf[len] & 0x80)) {
+			return (len + 1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Encode snapshot as magic followed by LEB128 varints: version, number of fields
+ * and fields in structure order. Mostly zero histograms and small counters take
+ * one byte each. buf must have at least SPAUSEDD_STATS_WIRE_MAX_SIZE bytes.
+ * Returns length of encoded data.
+ */
+static inline size_t
+spausedd_stats_encode(const struct spausedd_stats *stats, uint8_t *buf)
+{
+	const uint64_t *fields;
+	size_t pos;
+	size_t i;
+
+	fields = (const uint64_t *)((const char *)stats + SPAUSEDD_STATS_FIELDS_OFFSET);
+
+	memcpy(buf, SPAUSEDD_STATS_WIRE_MAGIC, SPAUSEDD_STATS_WIRE_MAGIC_LEN);
+	pos = SPAUSEDD_STATS_WIRE_MAGIC_LEN;
+
+	pos += spausedd_wire_varint_put(buf + pos, SPAUSEDD_STATS_VERSION);
+	pos += spausedd_wire_varint_put(buf + pos, SPAUSEDD_STATS_FIELDS);
+
+	for (i = 0; i < SPAUSEDD_STATS_FIELDS; i++) {
+		pos += spausedd_wire_varint_put(buf + pos, fields[i]);
+	}
+
+	return (pos);
+}
+
+/*
+ * Decode snapshot encoded by spausedd_stats_encode. Fields unknown to this
+ * version are ignored, fields missing in encoded data are zero. Returns 0 on
+ * success or -1 if data is invalid.
+ */
+static inline int
+spausedd_stats_decode(const uint8_t *buf, size_t buf_len, struct spausedd_stats *stats)
+{
+	uint64_t *fields;
+	uint64_t version;
+	uint64_t count;
+	uint64_t val;
+	size_t pos;
+	size_t len;
+	uint64_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->version = SPAUSEDD_STATS_VERSION;
+	stats->size = sizeof(*stats);
+	fields = (uint64_t *)((char *)stats + SPAUSEDD_STATS_FIELDS_OFFSET);
+
+	if (buf_len < SPAUSEDD_STATS_WIRE_MAGIC_LEN ||
+	    memcmp(buf, SPAUSEDD_STATS_WIRE_MAGIC, SPAUSEDD_STATS_WIRE_MAGIC_LEN) != 0) {
+		return (-1);
+	}
+	pos = SPAUSEDD_STATS_WIRE_MAGIC_LEN;
+
+	if ((len = spausedd_wire_varint_get(buf + pos, buf_len - pos, &version)) == 0 ||
+	    version == 0) {
+		return (-1);
+	}
+	pos += len;
+
+	if ((len = spausedd_wire_varint_get(buf + pos, buf_len - pos, &count)) == 0) {
+		return (-1);
+	}
+	pos += len;
+
+	for (i = 0; i < count; i++) {
+		if ((len = spausedd_wire_varint_get(buf + pos, buf_len - pos, &val)) == 0) {
+			return (-1);
+		}
+		pos += len;
+
+		if (i < SPAUSEDD_STATS_FIELDS) {
+			fields[i] = val;
+		}
+	}
+
+	return (0);
+}
+
+#endif /* _SPAUSEDD_SHM_H_ */
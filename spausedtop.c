@@ -0,0 +1,778 @@
+/*
+ * Copyright (c) 2018-2021, Red Hat, Inc.
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND RED HAT, INC. DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL RED HAT, INC. BE LIABLE
+ * FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Author: Jan Friesse <jfriesse@redhat.com>
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spausedd_shm.h"
+
+#define PROGRAM_NAME			"spausedtop"
+
+#define DEFAULT_DELAY			250
+#define MAX_DELAY			(1000 * 60)
+
+#define NO_NS_IN_SEC			1000000000ULL
+#define NO_NS_IN_MSEC			1000000ULL
+#define NO_NS_IN_USEC			1000ULL
+
+/*
+ * Histogram and per CPU lateness are computed from snapshots taken during last
+ * ROLLING_WINDOW seconds. At most ROLLING_SNAPSHOTS_MAX snapshots are kept.
+ */
+#define ROLLING_WINDOW			10
+#define ROLLING_SNAPSHOTS_MAX		64
+
+#define DEFAULT_ROWS			24
+#define DEFAULT_COLS			80
+
+struct snapshot {
+	int64_t pid;
+	uint64_t updated;
+	uint64_t lateness_histogram[SPAUSEDD_STATS_HISTOGRAM_BUCKETS];
+	uint64_t cpu_samples[SPAUSEDD_SHM_MAX_CPUS];
+	uint64_t cpu_lateness_sum[SPAUSEDD_SHM_MAX_CPUS];
+};
+
+static volatile sig_atomic_t stop_main_loop = 0;
+
+/*
+ * Consistent copy of shared page
+ */
+static struct spausedd_shm page;
+
+/*
+ * Buffer for raw copy of mapped page (which may be larger than page when written
+ * by newer spausedd)
+ */
+static char *page_buf;
+static size_t page_buf_size;
+
+static struct snapshot *snapshots;
+static unsigned int snapshots_size;
+static unsigned int snapshots_count;
+static unsigned int snapshots_next;
+
+/*
+ * UTILS
+ */
+static int
+util_strtonum(const char *str, long long int min_val, long long int max_val, long long int *res)
+{
+	long long int tmp_ll;
+	char *ep;
+
+	if (min_val > max_val) {
+		return (-1);
+	}
+
+	errno = 0;
+
+	tmp_ll = strtoll(str, &ep, 10);
+	if (ep == str || *ep != '\0' || errno != 0) {
+		return (-1);
+	}
+
+	if (tmp_ll < min_val || tmp_ll > max_val) {
+		return (-1);
+	}
+
+	*res = tmp_ll;
+
+	return (0);
+}
+
+static uint64_t
+nano_current_get(void)
+{
+	uint64_t res;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	res = (uint64_t)(ts.tv_sec) * NO_NS_IN_SEC + (uint64_t)ts.tv_nsec;
+	return (res);
+}
+
+/*
+ * Format time in ns with unit suitable for its size
+ */
+static const char *
+utils_ns_format(uint64_t ns, char *buf, size_t buf_size)
+{
+
+	if (ns < NO_NS_IN_MSEC) {
+		snprintf(buf, buf_size, "%"PRIu64"us", (uint64_t)(ns / NO_NS_IN_USEC));
+	} else if (ns < NO_NS_IN_SEC) {
+		snprintf(buf, buf_size, "%0.1fms", (double)ns / NO_NS_IN_MSEC);
+	} else {
+		snprintf(buf, buf_size, "%0.2fs", (double)ns / NO_NS_IN_SEC);
+	}
+
+	return (buf);
+}
+
+static void
+utils_bar_print(uint64_t value, uint64_t max_value, int width)
+{
+	int len;
+	int i;
+
+	if (width < 1) {
+		width = 1;
+	}
+
+	len = (max_value > 0 ? (int)((double)value / max_value * width + 0.5) : 0);
+	if (value > 0 && len == 0) {
+		len = 1;
+	}
+	if (len > width) {
+		len = width;
+	}
+
+	putchar('[');
+	for (i = 0; i < width; i++) {
+		putchar(i < len ? '#' : ' ');
+	}
+	putchar(']');
+}
+
+static void
+utils_term_size_get(int *rows, int *cols)
+{
+	struct winsize ws;
+
+	*rows = DEFAULT_ROWS;
+	*cols = DEFAULT_COLS;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+		*rows = ws.ws_row;
+		*cols = ws.ws_col;
+	}
+}
+
+/*
+ * SIGNAL HANDLERS
+ */
+static void
+signal_int_handler(int sig)
+{
+
+	stop_main_loop = 1;
+}
+
+static void
+signal_handlers_register(void)
+{
+	struct sigaction act;
+
+	act.sa_handler = signal_int_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_RESTART;
+
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+}
+
+/*
+ * SHARED PAGE
+ */
+
+/*
+ * Map whole shared statistics page read-only and store its size into
+ * mapped_size. Returns NULL (with errno set) on error.
+ */
+static const struct spausedd_shm *
+shm_map(size_t *mapped_size)
+{
+	const struct spausedd_shm *shm;
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = shm_open(SPAUSEDD_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1) {
+		return (NULL);
+	}
+
+	if (fstat(fd, &st) == -1) {
+		(void)close(fd);
+		return (NULL);
+	}
+
+	if ((size_t)st.st_size < sizeof(*shm)) {
+		(void)close(fd);
+		errno = EPROTO;
+		return (NULL);
+	}
+
+	shm = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (shm == MAP_FAILED) {
+		return (NULL);
+	}
+
+	if ((size_t)st.st_size > page_buf_size) {
+		buf = malloc(st.st_size);
+		if (buf == NULL) {
+			(void)munmap((void *)shm, st.st_size);
+			return (NULL);
+		}
+
+		free(page_buf);
+		page_buf = buf;
+		page_buf_size = st.st_size;
+	}
+
+	*mapped_size = st.st_size;
+
+	return (shm);
+}
+
+/*
+ * Copy known part of page into dst. Returns 0 on success, -1 if page is not valid
+ * or consistent copy was not obtained.
+ */
+static int
+shm_copy(const struct spausedd_shm *shm, size_t mapped_size, struct spausedd_shm *dst)
+{
+
+	return (spausedd_shm_copy(shm, mapped_size, page_buf, dst));
+}
+
+/*
+ * SNAPSHOTS
+ */
+
+/*
+ * Store current page as snapshot. History is dropped when daemon was restarted.
+ */
+static void
+snapshot_add(const struct spausedd_shm *shm)
+{
+	struct snapshot *snapshot;
+	const struct snapshot *prev;
+	uint32_t cpu;
+
+	if (snapshots_count > 0) {
+		prev = &snapshots[(snapshots_next + snapshots_size - 1) % snapshots_size];
+
+		if (prev->pid != shm->pid || prev->updated > shm->updated) {
+			snapshots_count = 0;
+		}
+	}
+
+	snapshot = &snapshots[snapshots_next];
+	snapshot->pid = shm->pid;
+	snapshot->updated = shm->updated;
+	memcpy(snapshot->lateness_histogram, shm->stats.lateness_histogram,
+	    sizeof(snapshot->lateness_histogram));
+	for (cpu = 0; cpu < shm->cpu_count && cpu < SPAUSEDD_SHM_MAX_CPUS; cpu++) {
+		snapshot->cpu_samples[cpu] = shm->cpus[cpu].samples;
+		snapshot->cpu_lateness_sum[cpu] = shm->cpus[cpu].lateness_sum;
+	}
+	for (; cpu < SPAUSEDD_SHM_MAX_CPUS; cpu++) {
+		snapshot->cpu_samples[cpu] = 0;
+		snapshot->cpu_lateness_sum[cpu] = 0;
+	}
+
+	snapshots_next = (snapshots_next + 1) % snapshots_size;
+	if (snapshots_count < snapshots_size) {
+		snapshots_count++;
+	}
+}
+
+/*
+ * Get oldest snapshot not older than ROLLING_WINDOW seconds before newest one
+ */
+static const struct snapshot *
+snapshot_rolling_base_get(void)
+{
+	const struct snapshot *newest;
+	const struct snapshot *snapshot;
+	unsigned int i;
+
+	newest = &snapshots[(snapshots_next + snapshots_size - 1) % snapshots_size];
+
+	for (i = snapshots_count; i > 1; i--) {
+		snapshot = &snapshots[(snapshots_next + snapshots_size - i) % snapshots_size];
+
+		if (newest->updated - snapshot->updated <= ROLLING_WINDOW * NO_NS_IN_SEC) {
+			return (snapshot);
+		}
+	}
+
+	return (newest);
+}
+
+/*
+ * DISPLAY
+ */
+static double
+display_ipc(const uint64_t *perf, uint32_t mask)
+{
+	uint32_t needed;
+
+	needed = (1U << SPAUSEDD_SHM_PERF_CYCLES) | (1U << SPAUSEDD_SHM_PERF_INSTRUCTIONS);
+
+	if ((mask & needed) != needed || perf[SPAUSEDD_SHM_PERF_CYCLES] == 0) {
+		return (0.0);
+	}
+
+	return ((double)perf[SPAUSEDD_SHM_PERF_INSTRUCTIONS] / perf[SPAUSEDD_SHM_PERF_CYCLES]);
+}
+
+/*
+ * Print hardware counters of last window. Returns number of printed lines.
+ */
+static int
+display_perf(const struct spausedd_shm *shm)
+{
+
+	if (shm->window_perf_mask == 0) {
+		return (0);
+	}
+
+	printf("Last window counters: spausedd %"PRIu64" cycles, IPC %0.2f, %"PRIu64" LLC misses",
+	    shm->window_perf[SPAUSEDD_SHM_PERF_CYCLES],
+	    display_ipc(shm->window_perf, shm->window_perf_mask),
+	    shm->window_perf[SPAUSEDD_SHM_PERF_LLC_MISSES]);
+
+	if (shm->window_perf_cpu_mask != 0) {
+		printf("; CPU %"PRId32" %"PRIu64" cycles, IPC %0.2f, %"PRIu64" LLC misses",
+		    shm->window_perf_cpu_id, shm->window_perf_cpu[SPAUSEDD_SHM_PERF_CYCLES],
+		    display_ipc(shm->window_perf_cpu, shm->window_perf_cpu_mask),
+		    shm->window_perf_cpu[SPAUSEDD_SHM_PERF_LLC_MISSES]);
+	}
+	printf("\n");
+
+	return (1);
+}
+
+static void
+display_header(const struct spausedd_shm *shm, int stale)
+{
+	char buf1[32];
+	char buf2[32];
+	char buf3[32];
+	uint64_t runtime_s;
+	uint64_t now;
+
+	runtime_s = shm->stats.runtime / NO_NS_IN_SEC;
+
+	printf("%s - spausedd pid %jd, runtime %"PRIu64":%02"PRIu64":%02"PRIu64
+	    ", timeout %"PRIu64"ms%s\n", PROGRAM_NAME, (intmax_t)shm->pid, runtime_s / 3600,
+	    (runtime_s / 60) % 60, runtime_s % 60, shm->timeout,
+	    (stale ? " [NOT UPDATED]" : ""));
+
+	printf("Samples %"PRIu64", not scheduled %"PRIu64"x, lateness last %s, mean %s, max %s\n",
+	    shm->stats.samples, shm->stats.times_not_scheduled,
+	    utils_ns_format(shm->lateness_last, buf1, sizeof(buf1)),
+	    utils_ns_format((shm->stats.samples > 0 ?
+	    shm->stats.lateness_sum / shm->stats.samples : 0), buf2, sizeof(buf2)),
+	    utils_ns_format(shm->stats.lateness_max, buf3, sizeof(buf3)));
+
+	printf("Last window %s: steal %0.2f%% (threshold %"PRIu64"%%), runqueue wait %0.2f%%",
+	    utils_ns_format(shm->window, buf1, sizeof(buf1)),
+	    (shm->window > 0 ? (double)shm->window_steal / shm->window * 100 : 0.0),
+	    shm->steal_threshold,
+	    (shm->window > 0 ? (double)shm->window_run_delay / shm->window * 100 : 0.0));
+	if (shm->pause_risk_state != SPAUSEDD_SHM_RISK_DISABLED) {
+		printf(", pause risk %0.1f%%%s", (double)shm->pause_risk / 10,
+		    (shm->pause_risk_state == SPAUSEDD_SHM_RISK_WARNING ? " WARNING" : ""));
+	}
+	printf("\n");
+
+	printf("Pauses by cause: steal %"PRIu64", runqueue %"PRIu64", memory %"PRIu64
+	    ", unknown %"PRIu64", mean %s\n",
+	    shm->stats.pauses_by_class[SPAUSEDD_SHM_CLASS_STEAL],
+	    shm->stats.pauses_by_class[SPAUSEDD_SHM_CLASS_RUNQUEUE],
+	    shm->stats.pauses_by_class[SPAUSEDD_SHM_CLASS_MEMORY],
+	    shm->stats.pauses_by_class[SPAUSEDD_SHM_CLASS_UNKNOWN],
+	    utils_ns_format((shm->stats.times_not_scheduled > 0 ?
+	    shm->stats.pause_duration_sum / shm->stats.times_not_scheduled : 0), buf1, sizeof(buf1)));
+
+	now = shm->updated;
+	if (shm->episode_pauses == 0) {
+		printf("Episode: none\n");
+	} else if (now - shm->episode_end <= shm->episode_gap) {
+		printf("Episode: ACTIVE for %s, %"PRIu64" pauses, class %s\n",
+		    utils_ns_format(now - shm->episode_start, buf1, sizeof(buf1)),
+		    shm->episode_pauses, spausedd_shm_class_str(shm->episode_class));
+	} else {
+		printf("Episode: last ended %s ago, lasted %s, %"PRIu64" pauses, class %s\n",
+		    utils_ns_format(now - shm->episode_end, buf1, sizeof(buf1)),
+		    utils_ns_format(shm->episode_end - shm->episode_start, buf2, sizeof(buf2)),
+		    shm->episode_pauses, spausedd_shm_class_str(shm->episode_class));
+	}
+}
+
+static int
+display_histogram(const struct spausedd_shm *shm, const struct snapshot *base, int cols)
+{
+	uint64_t rolling[SPAUSEDD_STATS_HISTOGRAM_BUCKETS];
+	uint64_t max_count;
+	char label[32];
+	int first;
+	int last;
+	int lines;
+	int i;
+
+	max_count = 0;
+	first = -1;
+	last = -1;
+
+	for (i = 0; i < SPAUSEDD_STATS_HISTOGRAM_BUCKETS; i++) {
+		rolling[i] = shm->stats.lateness_histogram[i] - base->lateness_histogram[i];
+
+		if (rolling[i] > max_count) {
+			max_count = rolling[i];
+		}
+
+		if (shm->stats.lateness_histogram[i] > 0) {
+			if (first == -1) {
+				first = i;
+			}
+			last = i;
+		}
+	}
+
+	printf("\nLateness histogram, last %ds (total):\n", ROLLING_WINDOW);
+	lines = 2;
+
+	if (first == -1) {
+		printf("  empty\n");
+		return (lines + 1);
+	}
+
+	for (i = first; i <= last; i++) {
+		if (i == SPAUSEDD_STATS_HISTOGRAM_BUCKETS - 1) {
+			snprintf(label, sizeof(label), ">=");
+			utils_ns_format(((uint64_t)1 << (i - 1)) * NO_NS_IN_USEC, label + 2,
+			    sizeof(label) - 2);
+		} else {
+			snprintf(label, sizeof(label), "<");
+			utils_ns_format(((uint64_t)1 << i) * NO_NS_IN_USEC, label + 1,
+			    sizeof(label) - 1);
+		}
+
+		printf("  %9s ", label);
+		utils_bar_print(rolling[i], max_count, cols - 40);
+		printf(" %8"PRIu64" (%"PRIu64")\n", rolling[i], shm->stats.lateness_histogram[i]);
+		lines++;
+	}
+
+	return (lines);
+}
+
+static int
+display_cpus(const struct spausedd_shm *shm, const struct snapshot *base, int cols,
+    int max_lines)
+{
+	uint64_t samples;
+	uint64_t mean;
+	uint64_t threshold;
+	char buf[32];
+	uint32_t cpu;
+	int lines;
+
+	printf("\nCPU lateness, last %ds (full bar is timeout) and runqueue wait in last "
+	    "window:\n", ROLLING_WINDOW);
+	lines = 2;
+
+	threshold = shm->timeout * NO_NS_IN_MSEC;
+
+	for (cpu = 0; cpu < shm->cpu_count && cpu < SPAUSEDD_SHM_MAX_CPUS; cpu++) {
+		samples = shm->cpus[cpu].samples - base->cpu_samples[cpu];
+
+		if (samples == 0 && shm->cpus[cpu].run_delay == 0) {
+			continue;
+		}
+
+		if (max_lines > 0 && lines >= max_lines) {
+			printf("  ...\n");
+			lines++;
+			break;
+		}
+
+		mean = (samples > 0 ?
+		    (shm->cpus[cpu].lateness_sum - base->cpu_lateness_sum[cpu]) / samples : 0);
+
+		printf("  cpu%-4"PRIu32" ", cpu);
+		if (samples > 0) {
+			utils_bar_print(mean, threshold, cols - 50);
+			printf(" %9s", utils_ns_format(mean, buf, sizeof(buf)));
+		} else {
+			printf("%*s", (cols - 50 > 1 ? cols - 50 : 1) + 2 + 10, "");
+		}
+		printf("  rq %7.1f%%\n", (shm->window > 0 ?
+		    (double)shm->cpus[cpu].run_delay / shm->window * 100 : 0.0));
+		lines++;
+	}
+
+	return (lines);
+}
+
+static void
+display_pauses(const struct spausedd_shm *shm, int max_lines)
+{
+	const struct spausedd_shm_pause *pause;
+	struct tm tm;
+	time_t t;
+	char buf[64];
+	uint64_t i;
+	uint64_t count;
+
+	printf("\nRecent pauses (%"PRIu64" total):\n", shm->pauses_total);
+
+	count = shm->pauses_total;
+	if (count > SPAUSEDD_SHM_RECENT_PAUSES) {
+		count = SPAUSEDD_SHM_RECENT_PAUSES;
+	}
+	if (max_lines > 0 && count > (uint64_t)max_lines) {
+		count = max_lines;
+	}
+
+	for (i = 0; i < count; i++) {
+		pause = &shm->recent_pauses[(shm->pauses_total - 1 - i) % SPAUSEDD_SHM_RECENT_PAUSES];
+
+		t = pause->rt_start_sec;
+		if (localtime_r(&t, &tm) == NULL ||
+		    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm) == 0) {
+			buf[0] = '\0';
+		}
+
+		printf("  %s.%06ld %9.4fs steal %6.2f%% rq %6.2f%% cpu %-4"PRId32" %-8s", buf,
+		    (long)(pause->rt_start_nsec / NO_NS_IN_USEC), (double)pause->duration / NO_NS_IN_SEC,
+		    (pause->duration > 0 ? (double)pause->steal / pause->duration * 100 : 0.0),
+		    (pause->duration > 0 ? (double)pause->run_delay / pause->duration * 100 : 0.0),
+		    pause->cpu, spausedd_shm_class_str(pause->class));
+
+		if (pause->perf_mask != 0) {
+			printf(" %"PRIu64" cycles, IPC %0.2f", pause->perf[SPAUSEDD_SHM_PERF_CYCLES],
+			    display_ipc(pause->perf, pause->perf_mask));
+		}
+		printf("\n");
+	}
+}
+
+static void
+display(const struct spausedd_shm *shm, int stale, int batch)
+{
+	const struct snapshot *base;
+	int rows;
+	int cols;
+	int lines;
+	int pause_lines;
+
+	utils_term_size_get(&rows, &cols);
+	if (batch) {
+		rows = 0;
+	}
+
+	base = snapshot_rolling_base_get();
+
+	if (!batch) {
+		printf("\033[H");
+	}
+
+	display_header(shm, stale);
+	lines = 5;
+	lines += display_perf(shm);
+	lines += display_histogram(shm, base, cols);
+
+	/*
+	 * Keep space for a few recent pauses on small terminal
+	 */
+	pause_lines = (shm->pauses_total < 4 ? (int)shm->pauses_total : 4);
+	lines += display_cpus(shm, base, cols, (rows > 0 ? rows - lines - pause_lines - 3 : 0));
+	display_pauses(shm, (rows > 0 ? rows - lines - 3 : 0));
+
+	if (batch) {
+		printf("\n");
+	} else {
+		printf("\033[J");
+	}
+
+	fflush(stdout);
+}
+
+/*
+ * CLI
+ */
+static void
+usage(void)
+{
+
+	printf("usage: %s [-bh] [-d delay] [-n iterations]\n", PROGRAM_NAME);
+	printf("\n");
+	printf("  -b            Batch mode - don't control terminal, print every refresh\n");
+	printf("  -d delay      Refresh every delay milliseconds (default: %u)\n", DEFAULT_DELAY);
+	printf("  -h            Show help\n");
+	printf("  -n iterations Exit after given number of refreshes\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct spausedd_shm *shm;
+	const struct spausedd_shm *new_shm;
+	size_t shm_size;
+	size_t new_shm_size;
+	long long int tmpll;
+	uint64_t delay;
+	uint64_t iterations;
+	uint64_t i;
+	uint64_t last_updated;
+	uint64_t last_change;
+	int batch;
+	int stale;
+	int ch;
+
+	batch = 0;
+	delay = DEFAULT_DELAY;
+	iterations = 0;
+
+	while ((ch = getopt(argc, argv, "bhd:n:")) != -1) {
+		switch (ch) {
+		case 'b':
+			batch = 1;
+			break;
+		case 'd':
+			if (util_strtonum(optarg, 1, MAX_DELAY, &tmpll) != 0) {
+				errx(1, "Delay %s is invalid", optarg);
+			}
+			delay = (uint64_t)tmpll;
+			break;
+		case 'n':
+			if (util_strtonum(optarg, 1, LLONG_MAX, &tmpll) != 0) {
+				errx(1, "Number of iterations %s is invalid", optarg);
+			}
+			iterations = (uint64_t)tmpll;
+			break;
+		case 'h':
+		case '?':
+			usage();
+			exit(1);
+			break;
+		default:
+			errx(1, "Unhandled option %c", ch);
+		}
+	}
+
+	shm = shm_map(&shm_size);
+	if (shm == NULL) {
+		err(1, "Can't map shared statistics page %s (is spausedd running?)",
+		    SPAUSEDD_SHM_NAME);
+	}
+
+	snapshots_size = ROLLING_WINDOW * 1000 / delay + 1;
+	if (snapshots_size > ROLLING_SNAPSHOTS_MAX) {
+		snapshots_size = ROLLING_SNAPSHOTS_MAX;
+	}
+	if (snapshots_size < 2) {
+		snapshots_size = 2;
+	}
+
+	snapshots = calloc(snapshots_size, sizeof(*snapshots));
+	if (snapshots == NULL) {
+		err(1, "Can't allocate memory");
+	}
+
+	signal_handlers_register();
+
+	if (!batch) {
+		printf("\033[?25l\033[H\033[2J");
+	}
+
+	last_updated = 0;
+	last_change = nano_current_get();
+
+	for (i = 0; !stop_main_loop && (iterations == 0 || i < iterations); i++) {
+		if (i > 0) {
+			(void)poll(NULL, 0, delay);
+		}
+
+		if (shm_copy(shm, shm_size, &page) == -1) {
+			if (!batch) {
+				printf("\033[H\033[J");
+			}
+			printf("Shared statistics page is not valid (incompatible spausedd version?)\n");
+			fflush(stdout);
+			continue;
+		}
+
+		/*
+		 * Page is considered not updated when daemon didn't update it for
+		 * twice its timeout
+		 */
+		if (page.updated != last_updated) {
+			last_updated = page.updated;
+			last_change = nano_current_get();
+		}
+		stale = (nano_current_get() - last_change > 2 * page.timeout * NO_NS_IN_MSEC);
+
+		if (stale) {
+			/*
+			 * spausedd may have been restarted and created new page
+			 */
+			new_shm = shm_map(&new_shm_size);
+			if (new_shm != NULL) {
+				(void)munmap((void *)shm, shm_size);
+				shm = new_shm;
+				shm_size = new_shm_size;
+			}
+		}
+
+		snapshot_add(&page);
+		display(&page, stale, batch);
+	}
+
+	if (!batch) {
+		printf("\033[?25h");
+		fflush(stdout);
+	}
+
+	free(snapshots);
+	free(page_buf);
+	(void)munmap((void *)shm, shm_size);
+
+	return (0);
+}